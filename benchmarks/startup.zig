@@ -0,0 +1,120 @@
+const std = @import("std");
+
+// Startup latency: wall time of trivial invocations (`echo a | sed s/a/b/`),
+// this sed against the system one. Usage: sed-bench-startup <sed> [--runs N]
+// [--system PATH]
+
+const INPUT = "a\n";
+const SCRIPT = "s/a/b/";
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    var sed_path: ?[]const u8 = null;
+    var system_path: []const u8 = "/usr/bin/sed";
+    var runs: usize = 500;
+
+    var i: usize = 1;
+    while (i < args.len) : (i += 1) {
+        if (std.mem.eql(u8, args[i], "--runs") and i + 1 < args.len) {
+            i += 1;
+            runs = try std.fmt.parseInt(usize, args[i], 10);
+        } else if (std.mem.eql(u8, args[i], "--system") and i + 1 < args.len) {
+            i += 1;
+            system_path = args[i];
+        } else {
+            sed_path = args[i];
+        }
+    }
+    const sed = sed_path orelse {
+        std.debug.print("Usage: sed-bench-startup <sed> [--runs N] [--system PATH]\n", .{});
+        return;
+    };
+
+    std.debug.print("\n====== STARTUP BENCHMARK ======\n\n", .{});
+    std.debug.print("Command:  echo a | sed {s}\n", .{SCRIPT});
+    std.debug.print("Runs:     {d}\n\n", .{runs});
+
+    const ours = try benchmark(allocator, sed, runs);
+    const system: ?Stats = benchmark(allocator, system_path, runs) catch |err| blk: {
+        std.debug.print("System sed ({s}) unavailable: {}\n", .{ system_path, err });
+        break :blk null;
+    };
+
+    std.debug.print("{s:<12} {s:>12} {s:>12} {s:>12} {s:>10}\n", .{ "Binary", "Mean (us)", "Median (us)", "Min (us)", "Ratio" });
+    std.debug.print("{s:-<12} {s:->12} {s:->12} {s:->12} {s:->10}\n", .{ "", "", "", "", "" });
+    const baseline = if (system) |s| s.median_us else ours.median_us;
+    printStats("sed", ours, baseline);
+    if (system) |s| printStats("system sed", s, baseline);
+    std.debug.print("\n", .{});
+}
+
+const Stats = struct {
+    mean_us: f64,
+    median_us: f64,
+    min_us: f64,
+};
+
+fn benchmark(allocator: std.mem.Allocator, path: []const u8, runs: usize) !Stats {
+    const samples = try allocator.alloc(u64, runs);
+    defer allocator.free(samples);
+
+    // One untimed run warms the page cache and checks the output
+    if (!std.mem.eql(u8, try runOnce(path, null), "b\n")) return error.UnexpectedOutput;
+
+    var total: u64 = 0;
+    for (samples) |*sample| {
+        var timer = try std.time.Timer.start();
+        _ = try runOnce(path, &timer);
+        sample.* = timer.read();
+        total += sample.*;
+    }
+
+    std.mem.sort(u64, samples, {}, std.sort.asc(u64));
+    return Stats{
+        .mean_us = @as(f64, @floatFromInt(total / runs)) / 1000.0,
+        .median_us = @as(f64, @floatFromInt(samples[runs / 2])) / 1000.0,
+        .min_us = @as(f64, @floatFromInt(samples[0])) / 1000.0,
+    };
+}
+
+var output_buf: [64]u8 = undefined;
+
+/// Spawn `path s/a/b/`, feed it INPUT and wait for it; returns its stdout
+fn runOnce(path: []const u8, timer: ?*std.time.Timer) ![]const u8 {
+    var child = std.process.Child.init(&.{ path, SCRIPT }, std.heap.page_allocator);
+    child.stdin_behavior = .Pipe;
+    child.stdout_behavior = .Pipe;
+    child.stderr_behavior = .Ignore;
+
+    if (timer) |t| t.reset();
+    try child.spawn();
+    try child.stdin.?.writeAll(INPUT);
+    child.stdin.?.close();
+    child.stdin = null;
+
+    var len: usize = 0;
+    while (len < output_buf.len) {
+        const n = try child.stdout.?.read(output_buf[len..]);
+        if (n == 0) break;
+        len += n;
+    }
+    const term = try child.wait();
+    if (term != .Exited or term.Exited != 0) return error.CommandFailed;
+    return output_buf[0..len];
+}
+
+fn printStats(name: []const u8, stats: Stats, baseline_us: f64) void {
+    std.debug.print("{s:<12} {d:>12.1} {d:>12.1} {d:>12.1} {d:>9.2}x\n", .{
+        name,
+        stats.mean_us,
+        stats.median_us,
+        stats.min_us,
+        stats.median_us / baseline_us,
+    });
+}
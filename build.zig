@@ -55,40 +55,59 @@ pub fn build(b: *std.Build) void {
     // Shared shader library
     const shaders_common = b.dependency("shaders_common", .{});
 
-    // Compile SPIR-V shader from GLSL for Vulkan (literal substitution)
-    const spirv_compile = b.addSystemCommand(&.{
-        "glslc",
-        "--target-env=vulkan1.2",
-        "-O",
-    });
-    // Add include path for shared GLSL headers
-    spirv_compile.addArg("-I");
-    spirv_compile.addDirectoryArg(shaders_common.path("glsl"));
-    spirv_compile.addArg("-o");
-    const spirv_output = spirv_compile.addOutputFileArg("substitute.spv");
-    spirv_compile.addFileArg(b.path("src/shaders/substitute.comp"));
-
-    // Compile SPIR-V shader from GLSL for Vulkan (regex substitution)
-    const spirv_regex_compile = b.addSystemCommand(&.{
-        "glslc",
-        "--target-env=vulkan1.2",
-        "-O",
-    });
-    spirv_regex_compile.addArg("-I");
-    spirv_regex_compile.addDirectoryArg(shaders_common.path("glsl"));
-    spirv_regex_compile.addArg("-o");
-    const spirv_regex_output = spirv_regex_compile.addOutputFileArg("substitute_regex.spv");
-    spirv_regex_compile.addFileArg(b.path("src/shaders/substitute_regex.comp"));
+    // Compile SPIR-V shaders from GLSL for Vulkan and embed them via the "spirv" module.
+    // Variants of one source differ only in preprocessor defines; the host picks one at
+    // VulkanSubstituter.init from the device's capabilities.
+    const ShaderVariant = struct {
+        decl: []const u8, // Name exported from the spirv module
+        source: []const u8, // File under src/shaders
+        output: []const u8,
+        defines: []const []const u8 = &.{},
+    };
+    const shader_variants = [_]ShaderVariant{
+        .{ .decl = "EMBEDDED_SPIRV", .source = "substitute.comp", .output = "substitute.spv" },
+        .{ .decl = "EMBEDDED_SPIRV_SUBGROUP", .source = "substitute.comp", .output = "substitute_subgroup.spv", .defines = &.{"SUBGROUP_OPS"} },
+        .{ .decl = "EMBEDDED_SPIRV_8BIT", .source = "substitute.comp", .output = "substitute_8bit.spv", .defines = &.{"STORAGE_8BIT"} },
+        .{ .decl = "EMBEDDED_SPIRV_SUBGROUP_8BIT", .source = "substitute.comp", .output = "substitute_subgroup_8bit.spv", .defines = &.{ "SUBGROUP_OPS", "STORAGE_8BIT" } },
+        .{ .decl = "EMBEDDED_SPIRV_REGEX", .source = "substitute_regex.comp", .output = "substitute_regex.spv" },
+        .{ .decl = "EMBEDDED_SPIRV_REGEX_SUBGROUP", .source = "substitute_regex.comp", .output = "substitute_regex_subgroup.spv", .defines = &.{"SUBGROUP_OPS"} },
+        .{ .decl = "EMBEDDED_SPIRV_REGEX_8BIT", .source = "substitute_regex.comp", .output = "substitute_regex_8bit.spv", .defines = &.{"STORAGE_8BIT"} },
+        .{ .decl = "EMBEDDED_SPIRV_REGEX_SUBGROUP_8BIT", .source = "substitute_regex.comp", .output = "substitute_regex_subgroup_8bit.spv", .defines = &.{ "SUBGROUP_OPS", "STORAGE_8BIT" } },
+        .{ .decl = "EMBEDDED_SPIRV_TRANSLITERATE", .source = "transliterate.comp", .output = "transliterate.spv" },
+        .{ .decl = "EMBEDDED_SPIRV_LINE_INDEX", .source = "line_index.comp", .output = "line_index.spv" },
+        .{ .decl = "EMBEDDED_SPIRV_LINE_INDEX_SUBGROUP", .source = "line_index.comp", .output = "line_index_subgroup.spv", .defines = &.{"SUBGROUP_OPS"} },
+    };
+
+    var spirv_source: std.ArrayListUnmanaged(u8) = .{};
+    var spirv_outputs: [shader_variants.len]std.Build.LazyPath = undefined;
+    for (shader_variants, 0..) |variant, i| {
+        const spirv_compile = b.addSystemCommand(&.{
+            "glslc",
+            "--target-env=vulkan1.2",
+            "-O",
+        });
+        // Add include path for shared GLSL headers
+        spirv_compile.addArg("-I");
+        spirv_compile.addDirectoryArg(shaders_common.path("glsl"));
+        for (variant.defines) |define| {
+            spirv_compile.addArg(b.fmt("-D{s}", .{define}));
+        }
+        spirv_compile.addArg("-o");
+        spirv_outputs[i] = spirv_compile.addOutputFileArg(variant.output);
+        spirv_compile.addFileArg(b.path(b.fmt("src/shaders/{s}", .{variant.source})));
+        // Local includes are not arguments, so rebuild when they change too
+        spirv_compile.addFileInput(b.path("src/shaders/match_compact.glsl"));
+
+        spirv_source.appendSlice(b.allocator, b.fmt("pub const {s} = @embedFile(\"{s}\");\n", .{ variant.decl, variant.output })) catch @panic("OOM");
+    }
 
-    // Create embedded SPIR-V module with both shaders
+    // Create embedded SPIR-V module with all shader variants
     const spirv_module = b.addModule("spirv", .{
-        .root_source_file = b.addWriteFiles().add("spirv.zig",
-            \\pub const EMBEDDED_SPIRV = @embedFile("substitute.spv");
-            \\pub const EMBEDDED_SPIRV_REGEX = @embedFile("substitute_regex.spv");
-        ),
+        .root_source_file = b.addWriteFiles().add("spirv.zig", spirv_source.items),
     });
-    spirv_module.addAnonymousImport("substitute.spv", .{ .root_source_file = spirv_output });
-    spirv_module.addAnonymousImport("substitute_regex.spv", .{ .root_source_file = spirv_regex_output });
+    for (shader_variants, spirv_outputs) |variant, spirv_output| {
+        spirv_module.addAnonymousImport(variant.output, .{ .root_source_file = spirv_output });
+    }
 
     // Preprocess Metal shader to inline the string_ops.h and regex_ops.h includes
     // Concatenates: headers + shader (with include lines removed)
@@ -171,13 +190,9 @@ pub fn build(b: *std.Build) void {
             exe.linkFramework("QuartzCore");
         }
         if (enable_vulkan) {
-            if (is_macos) {
-                // MoltenVK from Homebrew for Vulkan on macOS
-                exe.root_module.addLibraryPath(.{ .cwd_relative = "/opt/homebrew/opt/molten-vk/lib" });
-                exe.linkSystemLibrary("MoltenVK");
-            } else {
-                exe.linkSystemLibrary("vulkan");
-            }
+            // The Vulkan loader (libvulkan / MoltenVK) is dlopen'ed on first GPU
+            // use, not linked: runs that stay on the CPU never load it
+            exe.linkLibC();
         }
     }
 
@@ -284,6 +299,46 @@ pub fn build(b: *std.Build) void {
     const smoke_step = b.step("smoke", "Run smoke tests");
     smoke_step.dependOn(&smoke_cmd.step);
 
+    // Embeddable library (C ABI in include/sed.h): `zig build lib`
+    const lib_step = b.step("lib", "Build libsed (static and shared) and install sed.h");
+    for ([_]std.builtin.LinkMode{ .static, .dynamic }) |linkage| {
+        const lib = b.addLibrary(.{
+            .name = "sed",
+            .linkage = linkage,
+            .root_module = b.createModule(.{
+                .root_source_file = b.path("src/lib.zig"),
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+                .imports = &.{
+                    .{ .name = "gpu", .module = gpu_module },
+                    .{ .name = "cpu", .module = cpu_module },
+                },
+            }),
+        });
+        lib_step.dependOn(&b.addInstallArtifact(lib, .{}).step);
+    }
+    lib_step.dependOn(&b.addInstallHeaderFile(b.path("include/sed.h"), "sed.h").step);
+
+    // Startup latency benchmark: spawns the installed sed and the system sed
+    const bench_startup_exe = b.addExecutable(.{
+        .name = "sed-bench-startup",
+        .root_module = b.createModule(.{
+            .root_source_file = b.path("benchmarks/startup.zig"),
+            .target = target,
+            .optimize = .ReleaseFast,
+        }),
+    });
+
+    const bench_startup_cmd = b.addRunArtifact(bench_startup_exe);
+    bench_startup_cmd.addArtifactArg(exe);
+    if (b.args) |args| {
+        bench_startup_cmd.addArgs(args);
+    }
+
+    const bench_startup_step = b.step("bench-startup", "Benchmark startup latency against the system sed");
+    bench_startup_step.dependOn(&bench_startup_cmd.step);
+
     // Tests from src/main.zig
     const main_tests = b.addTest(.{
         .root_module = b.createModule(.{
@@ -317,6 +372,20 @@ pub fn build(b: *std.Build) void {
         }
     }
 
+    // Host-side modules the GPU-vs-CPU tests drive directly
+    const batch_module = b.createModule(.{
+        .root_source_file = b.path("src/batch.zig"),
+        .imports = &.{
+            .{ .name = "gpu", .module = gpu_module },
+        },
+    });
+    const memory_budget_module = b.createModule(.{
+        .root_source_file = b.path("src/memory_budget.zig"),
+        .imports = &.{
+            .{ .name = "gpu", .module = gpu_module },
+        },
+    });
+
     // Unit tests from tests/unit_tests.zig
     const unit_tests = b.addTest(.{
         .root_module = b.createModule(.{
@@ -330,6 +399,8 @@ pub fn build(b: *std.Build) void {
                 .{ .name = "spirv", .module = spirv_module },
                 .{ .name = "gpu", .module = gpu_module },
                 .{ .name = "cpu", .module = cpu_module },
+                .{ .name = "batch", .module = batch_module },
+                .{ .name = "memory_budget", .module = memory_budget_module },
             },
         }),
     });
@@ -403,12 +474,28 @@ pub fn build(b: *std.Build) void {
         }
     }
 
+    // C ABI tests from src/lib.zig (libsed allocates with the C allocator)
+    const lib_tests = b.addTest(.{
+        .root_module = b.createModule(.{
+            .root_source_file = b.path("src/lib.zig"),
+            .target = target,
+            .optimize = optimize,
+            .link_libc = true,
+            .imports = &.{
+                .{ .name = "gpu", .module = gpu_module },
+                .{ .name = "cpu", .module = cpu_module },
+            },
+        }),
+    });
+
     const run_main_tests = b.addRunArtifact(main_tests);
     const run_unit_tests = b.addRunArtifact(unit_tests);
     const run_regex_tests = b.addRunArtifact(regex_tests);
+    const run_lib_tests = b.addRunArtifact(lib_tests);
 
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(&run_main_tests.step);
     test_step.dependOn(&run_unit_tests.step);
     test_step.dependOn(&run_regex_tests.step);
+    test_step.dependOn(&run_lib_tests.step);
 }
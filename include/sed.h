@@ -0,0 +1,57 @@
+/*
+ * sed.h - embeddable sed (libsed)
+ *
+ * Compile a script once, run it on any number of buffers. A compiled script
+ * is read-only, so one handle may be run from several threads at once.
+ * Runs use the CPU backend.
+ *
+ *     const char *exprs[] = { "s/foo/bar/g", "/^#/d" };
+ *     sed_script *s;
+ *     if (sed_compile(exprs, 2, 0, &s) == SED_OK) {
+ *         sed_run(s, buf, len, write_cb, ctx);
+ *         sed_free(s);
+ *     }
+ */
+#ifndef SED_H
+#define SED_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return codes */
+#define SED_OK        0
+#define SED_EINVAL    1 /* bad argument or expression */
+#define SED_ENOMEM    2
+#define SED_EWRITE    3 /* output callback returned non-zero */
+#define SED_EINTERNAL 4
+
+/* sed_compile flags */
+#define SED_EXTENDED 1u /* -E: extended regular expressions */
+#define SED_QUIET    2u /* -n: no automatic printing */
+
+typedef struct sed_script sed_script;
+
+/*
+ * Output callback: receives output in order (p lines, then the edited text
+ * unless SED_QUIET). Return non-zero to stop the run with SED_EWRITE.
+ */
+typedef int (*sed_write_fn)(void *ctx, const char *data, size_t len);
+
+/* Parse `count` expressions (as given to -e) into *out. */
+int sed_compile(const char *const *expressions, size_t count, unsigned flags, sed_script **out);
+
+/* Run a compiled script over input[0..len). Thread-safe per handle. */
+int sed_run(const sed_script *script, const char *input, size_t len, sed_write_fn write, void *ctx);
+
+void sed_free(sed_script *script);
+
+const char *sed_strerror(int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SED_H */
@@ -0,0 +1,162 @@
+const std = @import("std");
+const gpu = @import("gpu");
+
+const MatchResult = gpu.MatchResult;
+
+/// Files up to this size are packed into a shared batch instead of being run
+/// one at a time (on their own they would never reach the GPU)
+pub const MAX_BATCHED_FILE_SIZE: usize = gpu.MIN_GPU_SIZE;
+
+/// One packed file: its bytes start at `base` in the batch text and its first
+/// line is line `line_base` of the batch
+pub const Segment = struct {
+    file_id: u32,
+    base: u32,
+    len: u32,
+    line_base: u32,
+};
+
+/// Many small inputs concatenated into one buffer so that a single dispatch
+/// covers all of them. Every segment ends on a line boundary (a newline is
+/// added after a file that lacks one), so per-line kernels and ^/$ anchors
+/// see each file exactly as they would alone.
+pub const Batch = struct {
+    text: std.ArrayListUnmanaged(u8) = .{},
+    segments: std.ArrayListUnmanaged(Segment) = .{},
+    num_lines: u32 = 0,
+    /// Packed text limit (the GPU buffer limit, or less under --max-memory)
+    max_bytes: usize = gpu.MAX_GPU_BUFFER_SIZE,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator) Batch {
+        return Batch{ .allocator = allocator };
+    }
+
+    pub fn deinit(self: *Batch) void {
+        self.text.deinit(self.allocator);
+        self.segments.deinit(self.allocator);
+    }
+
+    /// Drop the packed files, keeping the buffers for the next batch
+    pub fn reset(self: *Batch) void {
+        self.text.clearRetainingCapacity();
+        self.segments.clearRetainingCapacity();
+        self.num_lines = 0;
+    }
+
+    pub fn isEmpty(self: Batch) bool {
+        return self.segments.items.len == 0;
+    }
+
+    /// Pack a file; false (and nothing added) when it would push the batch
+    /// past `max_bytes`
+    pub fn append(self: *Batch, file_id: u32, contents: []const u8) !bool {
+        const separator = contents.len > 0 and contents[contents.len - 1] != '\n';
+        if (self.text.items.len + contents.len + @intFromBool(separator) > self.max_bytes) return false;
+
+        try self.segments.append(self.allocator, .{
+            .file_id = file_id,
+            .base = @intCast(self.text.items.len),
+            .len = @intCast(contents.len),
+            .line_base = self.num_lines,
+        });
+        try self.text.appendSlice(self.allocator, contents);
+        if (separator) try self.text.append(self.allocator, '\n');
+        self.num_lines += gpu.lineCount(contents);
+        return true;
+    }
+
+    pub fn segmentText(self: Batch, segment: Segment) []const u8 {
+        return self.text.items[segment.base..][0..segment.len];
+    }
+
+    /// Split batch-wide matches per segment, rebased to file offsets and line
+    /// numbers. Matches are sorted in place first (GPU results arrive in any
+    /// order); hits that overlap an earlier one or run past their file's end
+    /// (through the added newline) are dropped. The returned slices point into
+    /// `matches`; free the outer slice with the batch allocator.
+    pub fn splitMatches(self: Batch, matches: []MatchResult) ![]const []const MatchResult {
+        std.mem.sort(MatchResult, matches, {}, struct {
+            fn lessThan(_: void, a: MatchResult, b: MatchResult) bool {
+                return a.start < b.start;
+            }
+        }.lessThan);
+
+        const per_segment = try self.allocator.alloc([]const MatchResult, self.segments.items.len);
+        @memset(per_segment, &.{});
+
+        var write_idx: usize = 0;
+        var seg_idx: usize = 0;
+        var seg_first: usize = 0;
+        var last_end: u32 = 0;
+        for (matches) |match| {
+            // Last segment starting at or before the match (empty files share a base with the next)
+            var next_idx = seg_idx;
+            while (next_idx + 1 < self.segments.items.len and self.segments.items[next_idx + 1].base <= match.start) next_idx += 1;
+            if (next_idx != seg_idx) {
+                per_segment[seg_idx] = matches[seg_first..write_idx];
+                seg_idx = next_idx;
+                seg_first = write_idx;
+                last_end = 0;
+            }
+
+            const segment = self.segments.items[seg_idx];
+            if (match.end > segment.base + segment.len) continue;
+            const start = match.start - segment.base;
+            if (start < last_end) continue;
+
+            matches[write_idx] = .{
+                .start = start,
+                .end = match.end - segment.base,
+                .line_num = match.line_num -| segment.line_base,
+            };
+            last_end = matches[write_idx].end;
+            write_idx += 1;
+        }
+        if (per_segment.len > 0) per_segment[seg_idx] = matches[seg_first..write_idx];
+        return per_segment;
+    }
+};
+
+test "Batch: segments end on line boundaries" {
+    var batch = Batch.init(std.testing.allocator);
+    defer batch.deinit();
+
+    try std.testing.expect(try batch.append(0, "a\nb\n"));
+    try std.testing.expect(try batch.append(1, "c"));
+    try std.testing.expect(try batch.append(2, ""));
+    try std.testing.expect(try batch.append(3, "d\n"));
+
+    try std.testing.expectEqualStrings("a\nb\nc\nd\n", batch.text.items);
+    try std.testing.expectEqual(@as(u32, 4), batch.num_lines);
+    try std.testing.expectEqual(@as(u32, 6), batch.segments.items[3].base);
+    try std.testing.expectEqual(@as(u32, 3), batch.segments.items[3].line_base);
+    try std.testing.expectEqualStrings("c", batch.segmentText(batch.segments.items[1]));
+}
+
+test "Batch: splitMatches rebases per file" {
+    var batch = Batch.init(std.testing.allocator);
+    defer batch.deinit();
+
+    _ = try batch.append(0, "xx\nx");
+    _ = try batch.append(1, "");
+    _ = try batch.append(2, "ax\n");
+
+    // Unordered, as the GPU returns them; the last one spans the added newline
+    var matches = [_]MatchResult{
+        .{ .start = 6, .end = 7, .line_num = 2 },
+        .{ .start = 0, .end = 1, .line_num = 0 },
+        .{ .start = 3, .end = 4, .line_num = 1 },
+        .{ .start = 1, .end = 2, .line_num = 0 },
+        .{ .start = 4, .end = 6, .line_num = 1 },
+    };
+    const per_file = try batch.splitMatches(&matches);
+    defer std.testing.allocator.free(per_file);
+
+    try std.testing.expectEqual(@as(usize, 3), per_file[0].len);
+    try std.testing.expectEqual(@as(u32, 3), per_file[0][2].start);
+    try std.testing.expectEqual(@as(usize, 0), per_file[1].len);
+    try std.testing.expectEqual(@as(usize, 1), per_file[2].len);
+    try std.testing.expectEqual(@as(u32, 1), per_file[2][0].start);
+    try std.testing.expectEqual(@as(u32, 0), per_file[2][0].line_num);
+}
@@ -0,0 +1,412 @@
+const std = @import("std");
+
+const flate = std.compress.flate;
+const zstd = std.compress.zstd;
+
+// Compressed inputs (.gz, .zst), detected by magic number and decompressed
+// before editing. Independent units decode in parallel: zstd frames (found by
+// walking frame and block headers, without decoding) and BGZF gzip members
+// (whose extra field records their size). Other multi-member gzip has no
+// index, so its members decode one after another. Under --max-memory the
+// input is instead decoded as a stream (StreamDecoder), a chunk at a time.
+
+pub const Codec = enum {
+    none,
+    gzip,
+    zstd,
+
+    /// Command that recompresses to this codec on stdout (for -i)
+    fn compressor(self: Codec) []const []const u8 {
+        return switch (self) {
+            .none => unreachable,
+            .gzip => &.{ "gzip", "-c", "-n" },
+            .zstd => &.{ "zstd", "-q", "-c" },
+        };
+    }
+};
+
+/// Largest decompressed input accepted (match offsets are 32-bit)
+pub const MAX_DECOMPRESSED_SIZE: usize = std.math.maxInt(u32);
+
+const gzip_magic = [_]u8{ 0x1f, 0x8b };
+const zstd_magic = [_]u8{ 0x28, 0xb5, 0x2f, 0xfd };
+
+pub fn detect(data: []const u8) Codec {
+    if (std.mem.startsWith(u8, data, &gzip_magic)) return .gzip;
+    if (std.mem.startsWith(u8, data, &zstd_magic)) return .zstd;
+    return .none;
+}
+
+/// Byte range of one independently decodable member or frame
+const Unit = struct { start: usize, end: usize };
+
+/// zstd frames (skippable frames dropped), from frame and block headers
+fn zstdFrames(allocator: std.mem.Allocator, data: []const u8) ![]Unit {
+    var units: std.ArrayListUnmanaged(Unit) = .{};
+    errdefer units.deinit(allocator);
+
+    var pos: usize = 0;
+    while (pos < data.len) {
+        if (data.len - pos < 8) return error.CorruptInput;
+        const magic = std.mem.readInt(u32, data[pos..][0..4], .little);
+        if (magic & 0xFFFFFFF0 == 0x184D2A50) {
+            pos += 8 + @as(usize, std.mem.readInt(u32, data[pos + 4 ..][0..4], .little));
+            continue;
+        }
+        if (magic != 0xFD2FB528) return error.CorruptInput;
+
+        const start = pos;
+        const descriptor = data[pos + 4];
+        const single_segment = descriptor & 0x20 != 0;
+        const dictionary_sizes = [_]usize{ 0, 1, 2, 4 };
+        const content_sizes = [_]usize{ @intFromBool(single_segment), 2, 4, 8 };
+        pos += 5 + @intFromBool(!single_segment) + dictionary_sizes[descriptor & 3] + content_sizes[descriptor >> 6];
+
+        while (true) {
+            if (data.len < pos + 3) return error.CorruptInput;
+            const block = std.mem.readInt(u24, data[pos..][0..3], .little);
+            const size: usize = block >> 3;
+            pos += 3 + switch (@as(u2, @truncate(block >> 1))) {
+                0, 2 => size, // Raw, compressed
+                1 => 1, // RLE: one byte repeated `size` times
+                3 => return error.CorruptInput,
+            };
+            if (block & 1 != 0) break;
+        }
+        if (descriptor & 0x04 != 0) pos += 4; // Content checksum
+        if (pos > data.len) return error.CorruptInput;
+        try units.append(allocator, .{ .start = start, .end = pos });
+    }
+    return units.toOwnedSlice(allocator);
+}
+
+/// BGZF members from their BC extra subfield; null when any member lacks it
+fn bgzfMembers(allocator: std.mem.Allocator, data: []const u8) !?[]Unit {
+    var units: std.ArrayListUnmanaged(Unit) = .{};
+    errdefer units.deinit(allocator);
+
+    var pos: usize = 0;
+    while (pos < data.len) {
+        // 10-byte header with FEXTRA, XLEN 6, then 'B' 'C' 2 BSIZE
+        if (data.len - pos < 18 or !std.mem.startsWith(u8, data[pos..], &gzip_magic) or data[pos + 3] & 0x04 == 0) {
+            units.deinit(allocator);
+            return null;
+        }
+        const extra = data[pos + 12 ..][0..6];
+        if (extra[0] != 'B' or extra[1] != 'C' or std.mem.readInt(u16, extra[2..4], .little) != 2) {
+            units.deinit(allocator);
+            return null;
+        }
+        const member_len = @as(usize, std.mem.readInt(u16, extra[4..6], .little)) + 1;
+        if (member_len > data.len - pos) return error.CorruptInput;
+        try units.append(allocator, .{ .start = pos, .end = pos + member_len });
+        pos += member_len;
+    }
+    return try units.toOwnedSlice(allocator);
+}
+
+/// Decode the gzip members or zstd frame at the start of `data`, one after
+/// another until the input runs out
+fn decodeStream(allocator: std.mem.Allocator, codec: Codec, data: []const u8, out: *std.ArrayListUnmanaged(u8)) !void {
+    var in: std.Io.Reader = .fixed(data);
+    switch (codec) {
+        .none => unreachable,
+        .gzip => {
+            const window = try allocator.alloc(u8, flate.max_window_len);
+            defer allocator.free(window);
+            while (in.seek < data.len and std.mem.startsWith(u8, data[in.seek..], &gzip_magic)) {
+                var decoder: flate.Decompress = .init(&in, .gzip, window);
+                try appendDecoded(allocator, &decoder.reader, out);
+            }
+        },
+        .zstd => {
+            const window = try allocator.alloc(u8, zstd.default_window_len + zstd.block_size_max);
+            defer allocator.free(window);
+            var decoder: zstd.Decompress = .init(&in, window, .{});
+            try appendDecoded(allocator, &decoder.reader, out);
+        },
+    }
+}
+
+fn appendDecoded(allocator: std.mem.Allocator, reader: *std.Io.Reader, out: *std.ArrayListUnmanaged(u8)) !void {
+    const decoded = reader.allocRemaining(allocator, .limited(MAX_DECOMPRESSED_SIZE - out.items.len)) catch |err| switch (err) {
+        error.StreamTooLong => return error.InputTooLarge,
+        error.ReadFailed => return error.CorruptInput,
+        else => |e| return e,
+    };
+    defer allocator.free(decoded);
+    try out.appendSlice(allocator, decoded);
+}
+
+fn decodeUnits(allocator: std.mem.Allocator, codec: Codec, data: []const u8, units: []const Unit, out: *std.ArrayListUnmanaged(u8)) !void {
+    for (units) |unit| try decodeStream(allocator, codec, data[unit.start..unit.end], out);
+}
+
+const Worker = struct {
+    allocator: std.mem.Allocator,
+    codec: Codec,
+    data: []const u8,
+    units: []const Unit,
+    out: std.ArrayListUnmanaged(u8) = .{},
+    err: ?anyerror = null,
+
+    fn run(self: *Worker) void {
+        decodeUnits(self.allocator, self.codec, self.data, self.units, &self.out) catch |err| {
+            self.err = err;
+        };
+    }
+};
+
+/// Decompressed contents of `data`; independent units are split across up to
+/// `max_workers` cores
+pub fn decompress(allocator: std.mem.Allocator, codec: Codec, data: []const u8, max_workers: usize) ![]u8 {
+    const units: ?[]Unit = switch (codec) {
+        .none => return allocator.dupe(u8, data),
+        .gzip => try bgzfMembers(allocator, data),
+        .zstd => try zstdFrames(allocator, data),
+    };
+    defer if (units) |u| allocator.free(u);
+
+    const cpu_count = std.Thread.getCpuCount() catch 1;
+    const num_workers = if (units) |u| @min(u.len, cpu_count, max_workers) else 1;
+    if (num_workers <= 1) {
+        var out: std.ArrayListUnmanaged(u8) = .{};
+        errdefer out.deinit(allocator);
+        if (units) |u| {
+            try decodeUnits(allocator, codec, data, u, &out);
+        } else {
+            try decodeStream(allocator, codec, data, &out);
+        }
+        return out.toOwnedSlice(allocator);
+    }
+
+    // Contiguous runs of units per worker, so output is a plain concatenation
+    const unit_list = units.?;
+    const workers = try allocator.alloc(Worker, num_workers);
+    defer {
+        for (workers) |*worker| worker.out.deinit(allocator);
+        allocator.free(workers);
+    }
+    var threads: std.ArrayListUnmanaged(std.Thread) = .{};
+    defer threads.deinit(allocator);
+    try threads.ensureTotalCapacity(allocator, num_workers);
+
+    for (workers, 0..) |*worker, w| {
+        const first = unit_list.len * w / num_workers;
+        const end = unit_list.len * (w + 1) / num_workers;
+        worker.* = .{ .allocator = allocator, .codec = codec, .data = data, .units = unit_list[first..end] };
+        if (std.Thread.spawn(.{}, Worker.run, .{worker})) |thread| {
+            threads.appendAssumeCapacity(thread);
+        } else |_| {
+            worker.run(); // No thread available: decode here
+        }
+    }
+    for (threads.items) |thread| thread.join();
+
+    var total: usize = 0;
+    for (workers) |worker| {
+        if (worker.err) |err| return err;
+        total += worker.out.items.len;
+    }
+    if (total > MAX_DECOMPRESSED_SIZE) return error.InputTooLarge;
+
+    const out = try allocator.alloc(u8, total);
+    var pos: usize = 0;
+    for (workers) |worker| {
+        @memcpy(out[pos..][0..worker.out.items.len], worker.out.items);
+        pos += worker.out.items.len;
+    }
+    return out;
+}
+
+/// Decoder that yields a compressed stream's text a buffer at a time, for
+/// inputs edited in chunks (--max-memory) instead of decoded whole. Members
+/// and frames decode one after another on the calling thread.
+pub const StreamDecoder = struct {
+    allocator: std.mem.Allocator,
+    codec: Codec,
+    file_reader: std.fs.File.Reader,
+    in_buf: []u8,
+    window: []u8,
+    decoder: union(enum) {
+        idle,
+        gzip: flate.Decompress,
+        zstd: zstd.Decompress,
+    } = .idle,
+
+    /// Decode `file` from its current position; `prefix` holds bytes already
+    /// read from it (standard input). Heap-allocated: the decoders point at
+    /// the file reader.
+    pub fn init(allocator: std.mem.Allocator, codec: Codec, file: std.fs.File, prefix: []const u8) !*StreamDecoder {
+        const self = try allocator.create(StreamDecoder);
+        errdefer allocator.destroy(self);
+        const in_buf = try allocator.alloc(u8, @max(64 * 1024, prefix.len));
+        errdefer allocator.free(in_buf);
+        const window = try allocator.alloc(u8, switch (codec) {
+            .none => unreachable,
+            .gzip => flate.max_window_len,
+            .zstd => zstd.default_window_len + zstd.block_size_max,
+        });
+        self.* = .{ .allocator = allocator, .codec = codec, .file_reader = file.readerStreaming(in_buf), .in_buf = in_buf, .window = window };
+        @memcpy(in_buf[0..prefix.len], prefix);
+        self.file_reader.interface.end = prefix.len;
+        return self;
+    }
+
+    pub fn deinit(self: *StreamDecoder) void {
+        self.allocator.free(self.window);
+        self.allocator.free(self.in_buf);
+        self.allocator.destroy(self);
+    }
+
+    /// Fill `buf` with decoded text; fewer bytes than `buf.len` only at the end
+    pub fn read(self: *StreamDecoder, buf: []u8) !usize {
+        var len: usize = 0;
+        while (len < buf.len) {
+            const reader = switch (self.decoder) {
+                .idle => if (try self.nextUnit()) continue else break,
+                .gzip => |*decoder| &decoder.reader,
+                .zstd => |*decoder| &decoder.reader,
+            };
+            const n = reader.readSliceShort(buf[len..]) catch return error.CorruptInput;
+            len += n;
+            // Short read: this member or frame is done
+            if (len < buf.len) self.decoder = .idle;
+        }
+        return len;
+    }
+
+    /// Start the decoder on the next gzip member or zstd frame (skippable
+    /// frames dropped); false at the end of the input
+    fn nextUnit(self: *StreamDecoder) !bool {
+        const in = &self.file_reader.interface;
+        switch (self.codec) {
+            .none => unreachable,
+            .gzip => {
+                const magic = in.peek(gzip_magic.len) catch |err| return endOrFail(err);
+                if (!std.mem.eql(u8, magic, &gzip_magic)) return false;
+                self.decoder = .{ .gzip = .init(in, .gzip, self.window) };
+            },
+            .zstd => while (true) {
+                const header = in.peek(8) catch |err| return endOrFail(err);
+                const magic = std.mem.readInt(u32, header[0..4], .little);
+                if (magic & 0xFFFFFFF0 == 0x184D2A50) {
+                    in.discardAll(8 + @as(usize, std.mem.readInt(u32, header[4..8], .little))) catch return error.CorruptInput;
+                    continue;
+                }
+                if (magic != 0xFD2FB528) return false;
+                self.decoder = .{ .zstd = .init(in, self.window, .{}) };
+                break;
+            },
+        }
+        return true;
+    }
+
+    fn endOrFail(err: std.Io.Reader.Error) !bool {
+        return switch (err) {
+            error.EndOfStream => false,
+            error.ReadFailed => error.CorruptInput,
+        };
+    }
+};
+
+/// Compress `text` with the codec's command-line tool into `file` (std has no
+/// gzip or zstd encoder)
+pub fn compressTo(allocator: std.mem.Allocator, codec: Codec, text: []const u8, file: std.fs.File) !void {
+    return runCompressor(allocator, codec, .{ .bytes = text }, file);
+}
+
+/// Compress the rest of `input` (a spilled, already edited text) into `file`
+pub fn compressFileTo(allocator: std.mem.Allocator, codec: Codec, input: std.fs.File, file: std.fs.File) !void {
+    return runCompressor(allocator, codec, .{ .file = input }, file);
+}
+
+const CompressorInput = union(enum) {
+    bytes: []const u8,
+    file: std.fs.File,
+};
+
+fn runCompressor(allocator: std.mem.Allocator, codec: Codec, input: CompressorInput, file: std.fs.File) !void {
+    var child = std.process.Child.init(codec.compressor(), allocator);
+    child.stdin_behavior = .Pipe;
+    child.stdout_behavior = .Pipe;
+    try child.spawn();
+    errdefer _ = child.kill() catch {};
+
+    // Feed stdin from a thread so a full stdout pipe can't stall the writer
+    const Feeder = struct {
+        fn feed(stdin: std.fs.File, source: CompressorInput) void {
+            defer stdin.close();
+            switch (source) {
+                .bytes => |bytes| stdin.writeAll(bytes) catch {},
+                .file => |from| {
+                    var buf: [64 * 1024]u8 = undefined;
+                    while (true) {
+                        const n = from.read(&buf) catch return;
+                        if (n == 0) return;
+                        stdin.writeAll(buf[0..n]) catch return;
+                    }
+                },
+            }
+        }
+    };
+    const feeder = try std.Thread.spawn(.{}, Feeder.feed, .{ child.stdin.?, input });
+    child.stdin = null;
+
+    var buf: [64 * 1024]u8 = undefined;
+    while (true) {
+        const n = try child.stdout.?.read(&buf);
+        if (n == 0) break;
+        try file.writeAll(buf[0..n]);
+    }
+    feeder.join();
+
+    const term = try child.wait();
+    if (term != .Exited or term.Exited != 0) return error.CompressorFailed;
+}
+
+test "detect by magic number" {
+    try std.testing.expectEqual(Codec.gzip, detect(&.{ 0x1f, 0x8b, 0x08 }));
+    try std.testing.expectEqual(Codec.zstd, detect(&.{ 0x28, 0xb5, 0x2f, 0xfd, 0 }));
+    try std.testing.expectEqual(Codec.none, detect("plain text"));
+}
+
+test "zstd frames are split from headers alone" {
+    // Two single-segment frames, each with one raw block "ab\n"; a skippable frame between
+    const frame = [_]u8{ 0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x03, 0x19, 0x00, 0x00, 'a', 'b', '\n' };
+    const skippable = [_]u8{ 0x50, 0x2a, 0x4d, 0x18, 0x02, 0x00, 0x00, 0x00, 0xaa, 0xbb };
+    const data = frame ++ skippable ++ frame;
+
+    const units = try zstdFrames(std.testing.allocator, &data);
+    defer std.testing.allocator.free(units);
+    try std.testing.expectEqual(@as(usize, 2), units.len);
+    try std.testing.expectEqual(@as(usize, frame.len), units[0].end);
+    try std.testing.expectEqual(@as(usize, frame.len + skippable.len), units[1].start);
+}
+
+test "stream decoder reads frames one after another, after a read prefix" {
+    const frame = [_]u8{ 0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x03, 0x19, 0x00, 0x00, 'a', 'b', '\n' };
+    const skippable = [_]u8{ 0x50, 0x2a, 0x4d, 0x18, 0x02, 0x00, 0x00, 0x00, 0xaa, 0xbb };
+    const data = frame ++ skippable ++ frame;
+
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    try tmp.dir.writeFile(.{ .sub_path = "in.zst", .data = &data });
+    const file = try tmp.dir.openFile("in.zst", .{});
+    defer file.close();
+    // As standard input arrives: the magic number has already been read
+    var prefix: [5]u8 = undefined;
+    try std.testing.expectEqual(prefix.len, try file.readAll(&prefix));
+
+    const decoder = try StreamDecoder.init(std.testing.allocator, .zstd, file, &prefix);
+    defer decoder.deinit();
+    var out: [16]u8 = undefined;
+    var len: usize = 0;
+    while (true) {
+        // Small reads cross the frame boundary
+        const n = try decoder.read(out[len..@min(len + 4, out.len)]);
+        len += n;
+        if (n < 4) break;
+    }
+    try std.testing.expectEqualStrings("ab\nab\n", out[0..len]);
+}
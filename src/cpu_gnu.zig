@@ -20,3 +20,13 @@ pub fn findMatches(text: []const u8, pattern: []const u8, options: SubstituteOpt
 pub fn findMatchesRegex(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !SubstituteResult {
     return cpu_optimized.findMatchesRegex(text, pattern, options, allocator);
 }
+
+/// GNU sed backend for d/p line selection. Delegates to optimized backend.
+pub fn selectLines(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.LineSelection {
+    return cpu_optimized.selectLines(text, pattern, options, allocator);
+}
+
+/// GNU sed backend for regex d/p line selection. Delegates to optimized backend.
+pub fn selectLinesRegex(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.LineSelection {
+    return cpu_optimized.selectLinesRegex(text, pattern, options, allocator);
+}
@@ -18,9 +18,18 @@ const CASE_DIFF_VEC16: Vec16 = @splat(32);
 
 /// CPU-based substitute/search using SIMD-optimized Boyer-Moore-Horspool algorithm
 pub fn findMatches(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !SubstituteResult {
-    if (pattern.len == 0 or text.len < pattern.len) {
-        return SubstituteResult{ .matches = &.{}, .total_matches = 0, .allocator = allocator };
-    }
+    var collector = gpu.MatchCollector{ .allocator = allocator };
+    defer collector.deinit();
+    const total_matches = try forEachMatch(text, pattern, options, &collector, gpu.MatchCollector.add);
+    return collector.finish(total_matches);
+}
+
+/// Literal search that hands each match to `onMatch` in text order as it is
+/// found, so consumers never hold a match array. Returns the match count.
+pub fn forEachMatch(text: []const u8, pattern: []const u8, options: SubstituteOptions, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+    // Match offsets are u32: callers search longer inputs chunk by chunk
+    if (text.len > gpu.MAX_CHUNK_LEN) return error.ChunkTooLarge;
+    if (pattern.len == 0 or text.len < pattern.len) return 0;
 
     // Pre-compute lowercase pattern if case insensitive
     var lower_pattern_buf: [1024]u8 = undefined;
@@ -31,9 +40,6 @@ pub fn findMatches(text: []const u8, pattern: []const u8, options: SubstituteOpt
 
     const skip_table = buildSkipTable(search_pattern, options.case_insensitive);
 
-    var matches: std.ArrayListUnmanaged(MatchResult) = .{};
-    defer matches.deinit(allocator);
-
     var pos: usize = 0;
     var total_matches: u64 = 0;
     var line_num: u32 = 0;
@@ -67,7 +73,7 @@ pub fn findMatches(text: []const u8, pattern: []const u8, options: SubstituteOpt
                 continue;
             }
 
-            try matches.append(allocator, MatchResult{
+            try onMatch(context, MatchResult{
                 .start = @intCast(pos),
                 .end = @intCast(pos + pattern.len),
                 .line_num = line_num,
@@ -95,8 +101,7 @@ pub fn findMatches(text: []const u8, pattern: []const u8, options: SubstituteOpt
         pos += @max(skip, 1);
     }
 
-    const result = try matches.toOwnedSlice(allocator);
-    return SubstituteResult{ .matches = result, .total_matches = total_matches, .allocator = allocator };
+    return total_matches;
 }
 
 /// SIMD-optimized pattern matching at a specific position
@@ -202,6 +207,11 @@ pub fn transliterate(text: []u8, source: []const u8, dest: []const u8) void {
         table[source[i]] = dest[i];
     }
 
+    transliterateTable(text, &table);
+}
+
+/// Apply a prebuilt 256-entry byte map in place
+pub fn transliterateTable(text: []u8, table: *const [256]u8) void {
     // Translate using SIMD - process 32 bytes at a time
     var i: usize = 0;
     while (i + 32 <= text.len) {
@@ -242,124 +252,197 @@ pub fn buildSkipTable(pattern: []const u8, case_insensitive: bool) [256]usize {
 /// CPU-based regex match finding using Thompson NFA
 /// Supports BRE (Basic Regular Expressions) and ERE (Extended Regular Expressions)
 pub fn findMatchesRegex(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !SubstituteResult {
-    // Empty pattern - match empty string at start (GNU sed behavior)
-    if (pattern.len == 0) {
-        var matches: std.ArrayListUnmanaged(MatchResult) = .{};
-        try matches.append(allocator, MatchResult{
-            .start = 0,
-            .end = 0,
-            .line_num = 0,
-        });
-        const result = try matches.toOwnedSlice(allocator);
-        return SubstituteResult{ .matches = result, .total_matches = 1, .allocator = allocator };
-    }
+    var collector = gpu.MatchCollector{ .allocator = allocator };
+    defer collector.deinit();
+    const total_matches = try forEachMatchRegex(text, pattern, options, allocator, &collector, gpu.MatchCollector.add);
+    return collector.finish(total_matches);
+}
 
-    // Convert BRE pattern to ERE if needed
-    const ere_pattern = if (!options.extended)
-        try convertBREtoERE(pattern, allocator)
-    else
-        null;
-    defer if (ere_pattern) |p| allocator.free(p);
-
-    const actual_pattern = ere_pattern orelse pattern;
-
-    // Compile the regex pattern
-    var compiled = regex.Regex.compile(allocator, actual_pattern, .{
-        .case_insensitive = options.case_insensitive,
-        .extended = true, // Always use ERE internally after conversion
-        .multiline = true, // Enable multiline mode for ^ and $ to match at line boundaries
-    }) catch |err| {
-        // If regex compilation fails, fall back to literal search
-        if (err == error.InvalidPattern or err == error.UnmatchedParen or err == error.UnmatchedBracket) {
-            return findMatches(text, pattern, .{
-                .case_insensitive = options.case_insensitive,
-                .global = options.global,
-                .first_only = options.first_only,
-                .anchor_start = options.anchor_start,
-            }, allocator);
-        }
-        return err;
-    };
-    defer compiled.deinit();
+/// Regex search that hands each match to `onMatch` in text order as it is
+/// found (`allocator` is only for the compiled pattern). Returns the match count.
+pub fn forEachMatchRegex(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+    if (text.len > gpu.MAX_CHUNK_LEN) return error.ChunkTooLarge;
+    var matcher = try Matcher.init(allocator, pattern, options, true);
+    defer matcher.deinit();
+    return matcher.forEach(text, allocator, context, onMatch);
+}
 
-    var matches: std.ArrayListUnmanaged(MatchResult) = .{};
-    defer matches.deinit(allocator);
+/// A pattern prepared once for any number of searches: BRE converted and the
+/// regex compiled, or a literal search (no regex syntax, or a pattern the
+/// regex engine rejects). Searches only read it, so threads may share one.
+pub const Matcher = struct {
+    pattern: []const u8,
+    options: SubstituteOptions,
+    /// Null for a literal search
+    compiled: ?regex.Regex = null,
+    /// ERE form of a BRE pattern, kept for as long as the compiled regex
+    ere_pattern: ?[]u8 = null,
+    /// An empty regex matches once, at the start (GNU sed behavior)
+    empty_regex: bool = false,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, pattern: []const u8, options: SubstituteOptions, is_regex: bool) !Matcher {
+        var matcher = Matcher{ .pattern = pattern, .options = options, .allocator = allocator };
+        if (!is_regex) return matcher;
+        if (pattern.len == 0) {
+            matcher.empty_regex = true;
+            return matcher;
+        }
 
-    var total_matches: u64 = 0;
-    var line_num: u32 = 0;
-    var line_start: usize = 0;
-    var pos: usize = 0;
-    var found_in_line = false;
+        // Convert BRE pattern to ERE if needed
+        if (!options.extended) matcher.ere_pattern = try convertBREtoERE(pattern, allocator);
+        errdefer matcher.deinit();
+
+        matcher.compiled = regex.Regex.compile(allocator, matcher.ere_pattern orelse pattern, .{
+            .case_insensitive = options.case_insensitive,
+            .extended = true, // Always use ERE internally after conversion
+            .multiline = true, // Enable multiline mode for ^ and $ to match at line boundaries
+        }) catch |err| blk: {
+            // If regex compilation fails, fall back to literal search
+            if (err == error.InvalidPattern or err == error.UnmatchedParen or err == error.UnmatchedBracket) break :blk null;
+            return err;
+        };
+        return matcher;
+    }
 
-    while (pos <= text.len) {
-        // Update line number tracking
-        while (line_start < pos) {
-            if (text[line_start] == '\n') {
-                line_num += 1;
-                found_in_line = false;
-            }
-            line_start += 1;
-        }
+    pub fn deinit(self: *Matcher) void {
+        if (self.compiled) |*compiled| compiled.deinit();
+        if (self.ere_pattern) |ere| self.allocator.free(ere);
+        self.compiled = null;
+        self.ere_pattern = null;
+    }
 
-        // For anchor_start, only match at line boundaries
-        if (options.anchor_start) {
-            // Find current line start
-            var current_line_start = pos;
-            if (pos > 0) {
-                var i = pos - 1;
-                while (i > 0 and text[i] != '\n') i -= 1;
-                current_line_start = if (text[i] == '\n') i + 1 else i;
-            }
-            if (pos != current_line_start) {
-                // Skip to next line
-                while (pos < text.len and text[pos] != '\n') pos += 1;
-                pos += 1;
-                continue;
-            }
+    /// Hand each match to `onMatch` in text order as it is found (`allocator`
+    /// holds the regex engine's working state). Returns the match count.
+    pub fn forEach(self: *const Matcher, text: []const u8, allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+        if (self.empty_regex) {
+            if (text.len > gpu.MAX_CHUNK_LEN) return error.ChunkTooLarge;
+            try onMatch(context, MatchResult{
+                .start = 0,
+                .end = 0,
+                .line_num = 0,
+            });
+            return 1;
         }
-
-        // For non-global mode, only match first occurrence per line
-        if (!options.global and found_in_line) {
-            // Skip to next line
-            while (pos < text.len and text[pos] != '\n') pos += 1;
-            pos += 1;
-            continue;
+        if (self.compiled == null) {
+            return forEachMatch(text, self.pattern, .{
+                .case_insensitive = self.options.case_insensitive,
+                .global = self.options.global,
+                .first_only = self.options.first_only,
+                .anchor_start = self.options.anchor_start,
+            }, context, onMatch);
         }
-
-        // Try to find a match at this position
-        if (compiled.findAt(text, pos, allocator)) |m_opt| {
-            if (m_opt) |m| {
-                defer {
-                    var m_copy = m;
-                    m_copy.deinit();
+        if (text.len > gpu.MAX_CHUNK_LEN) return error.ChunkTooLarge;
+
+        // findAt only reads the compiled program; searching through a copy of
+        // the handle leaves the matcher itself untouched
+        var compiled = self.compiled.?;
+        _ = &compiled;
+
+        var total_matches: u64 = 0;
+        var line_num: u32 = 0;
+        var line_start: usize = 0;
+        var pos: usize = 0;
+        var found_in_line = false;
+
+        while (pos <= text.len) {
+            // Update line number tracking
+            while (line_start < pos) {
+                if (text[line_start] == '\n') {
+                    line_num += 1;
+                    found_in_line = false;
                 }
+                line_start += 1;
+            }
 
-                try matches.append(allocator, MatchResult{
-                    .start = @intCast(m.start),
-                    .end = @intCast(m.end),
-                    .line_num = line_num,
-                });
-                total_matches += 1;
-                found_in_line = true;
-
-                if (options.first_only) {
+            // For anchor_start, only match at line boundaries
+            if (self.options.anchor_start) {
+                // Find current line start
+                var current_line_start = pos;
+                if (pos > 0) {
+                    var i = pos - 1;
+                    while (i > 0 and text[i] != '\n') i -= 1;
+                    current_line_start = if (text[i] == '\n') i + 1 else i;
+                }
+                if (pos != current_line_start) {
                     // Skip to next line
                     while (pos < text.len and text[pos] != '\n') pos += 1;
                     pos += 1;
                     continue;
                 }
+            }
 
-                // Move past the match (avoid zero-length infinite loop)
-                pos = if (m.end > m.start) m.end else m.start + 1;
+            // For non-global mode, only match first occurrence per line
+            if (!self.options.global and found_in_line) {
+                // Skip to next line
+                while (pos < text.len and text[pos] != '\n') pos += 1;
+                pos += 1;
                 continue;
             }
-        } else |_| {}
 
-        break;
+            // Try to find a match at this position
+            if (compiled.findAt(text, pos, allocator)) |m_opt| {
+                if (m_opt) |m| {
+                    defer {
+                        var m_copy = m;
+                        m_copy.deinit();
+                    }
+
+                    try onMatch(context, MatchResult{
+                        .start = @intCast(m.start),
+                        .end = @intCast(m.end),
+                        .line_num = line_num,
+                    });
+                    total_matches += 1;
+                    found_in_line = true;
+
+                    if (self.options.first_only) {
+                        // Skip to next line
+                        while (pos < text.len and text[pos] != '\n') pos += 1;
+                        pos += 1;
+                        continue;
+                    }
+
+                    // Move past the match (avoid zero-length infinite loop)
+                    pos = if (m.end > m.start) m.end else m.start + 1;
+                    continue;
+                }
+            } else |_| {}
+
+            break;
+        }
+
+        return total_matches;
     }
 
-    const result = try matches.toOwnedSlice(allocator);
-    return SubstituteResult{ .matches = result, .total_matches = total_matches, .allocator = allocator };
+    /// Lines containing a match (for d and p); only the first match per line matters
+    pub fn selectLines(self: *const Matcher, text: []const u8, allocator: std.mem.Allocator) !gpu.LineSelection {
+        var line_matcher = self.*;
+        line_matcher.options.global = false;
+        var selection = try gpu.LineSelection.init(allocator, gpu.lineCount(text));
+        errdefer selection.deinit();
+        _ = try line_matcher.forEach(text, allocator, &selection, gpu.LineSelection.add);
+        return selection;
+    }
+};
+
+/// Select the lines containing a literal pattern (for d and p).
+/// Only the first match per line matters, so the search skips ahead after each hit.
+pub fn selectLines(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.LineSelection {
+    var line_options = options;
+    line_options.global = false;
+    var selection = try gpu.LineSelection.init(allocator, gpu.lineCount(text));
+    errdefer selection.deinit();
+    _ = try forEachMatch(text, pattern, line_options, &selection, gpu.LineSelection.add);
+    return selection;
+}
+
+/// Select the lines matching a regex (for d and p)
+pub fn selectLinesRegex(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.LineSelection {
+    if (text.len > gpu.MAX_CHUNK_LEN) return error.ChunkTooLarge;
+    var matcher = try Matcher.init(allocator, pattern, options, true);
+    defer matcher.deinit();
+    return matcher.selectLines(text, allocator);
 }
 
 /// Convert BRE (Basic Regular Expression) pattern to ERE (Extended Regular Expression)
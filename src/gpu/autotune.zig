@@ -0,0 +1,151 @@
+const std = @import("std");
+const mod = @import("mod.zig");
+
+const KernelConfig = mod.KernelConfig;
+
+// Candidate grid timed by --gpu-autotune. Literal tiles are workgroup size x
+// bytes per thread; regex runs one line per invocation, so only its workgroup
+// size varies.
+pub const literal_workgroup_sizes = [_]u32{ 64, 128, 256, 512 };
+pub const literal_bytes_per_thread = [_]u32{ 8, 16, 32 };
+pub const regex_workgroup_sizes = [_]u32{ 32, 64, 128, 256 };
+
+// Synthetic corpus every candidate is timed on
+pub const CORPUS_SIZE: usize = 4 * 1024 * 1024;
+pub const LITERAL_PATTERN = "needle";
+pub const REGEX_PATTERN = "ne+dle[0-9]*";
+pub const RUNS: usize = 3; // Best of, so the first (re-recording) run doesn't count
+
+/// Matches the CPU finds in the corpus (global search for each pattern). A
+/// shape that finds a different number is broken on the device and never kept.
+pub const Reference = struct {
+    literal_matches: u64,
+    regex_matches: u64,
+};
+
+// Shared memory of substitute.comp: the match staging area plus the tile and its halo
+const STAGE_CAPACITY: u32 = 2048;
+const MAX_HALO: u32 = mod.MAX_PATTERN_LEN - 1;
+
+/// Device limits a kernel configuration has to respect
+pub const Limits = struct {
+    max_workgroup_size: u32, // min(maxComputeWorkGroupSize[0], maxComputeWorkGroupInvocations)
+    max_shared_memory: u32,
+};
+
+/// Whether a configuration fits the device and the shaders' assumptions
+/// (staging flushes every STAGE_CAPACITY / workgroup size rounds, tiles are
+/// word-aligned and a whole number of rounds and of flushes)
+pub fn isValid(config: KernelConfig, limits: Limits) bool {
+    const wg = config.literal_workgroup_size;
+    const tile = config.literal_tile_bytes;
+    if (wg == 0 or wg > limits.max_workgroup_size or STAGE_CAPACITY % wg != 0) return false;
+    if (tile == 0 or tile % wg != 0 or tile % 4 != 0) return false;
+    if ((tile / wg) % (STAGE_CAPACITY / wg) != 0) return false;
+    const shared_bytes = STAGE_CAPACITY * 4 + ((tile + MAX_HALO + 3) / 4) * 4 + 8;
+    if (shared_bytes > limits.max_shared_memory) return false;
+    return config.regex_workgroup_size > 0 and config.regex_workgroup_size <= limits.max_workgroup_size;
+}
+
+/// Deterministic text resembling a log: short lowercase lines, some with the patterns
+pub fn buildCorpus(allocator: std.mem.Allocator) ![]u8 {
+    const corpus = try allocator.alloc(u8, CORPUS_SIZE);
+    var prng = std.Random.DefaultPrng.init(0x5ed);
+    const random = prng.random();
+
+    var pos: usize = 0;
+    while (pos < corpus.len) {
+        const line_len = @min(random.intRangeAtMost(usize, 20, 120), corpus.len - pos);
+        for (corpus[pos..][0..line_len]) |*c| {
+            c.* = if (random.uintLessThan(u8, 6) == 0) ' ' else 'a' + random.uintLessThan(u8, 26);
+        }
+        if (line_len > LITERAL_PATTERN.len and random.uintLessThan(u8, 4) == 0) {
+            const at = random.uintLessThan(usize, line_len - LITERAL_PATTERN.len);
+            @memcpy(corpus[pos + at ..][0..LITERAL_PATTERN.len], LITERAL_PATTERN);
+        }
+        pos += line_len;
+        corpus[pos - 1] = '\n';
+    }
+    return corpus;
+}
+
+/// Cache file: one line per device, "<pipeline cache UUID hex> <literal workgroup>
+/// <literal tile bytes> <regex workgroup>". The pipeline cache UUID also changes
+/// with the driver, so a driver update retunes.
+pub fn cachePath(allocator: std.mem.Allocator) ![]u8 {
+    return mod.cachePath(allocator, "autotune");
+}
+
+/// Cached configuration for a device, if one was stored
+pub fn load(allocator: std.mem.Allocator, uuid: [16]u8) ?KernelConfig {
+    const path = cachePath(allocator) catch return null;
+    defer allocator.free(path);
+    const contents = std.fs.cwd().readFileAlloc(allocator, path, 64 * 1024) catch return null;
+    defer allocator.free(contents);
+    return find(contents, uuid);
+}
+
+fn find(contents: []const u8, uuid: [16]u8) ?KernelConfig {
+    const key = std.fmt.bytesToHex(uuid, .lower);
+    var lines = std.mem.tokenizeScalar(u8, contents, '\n');
+    while (lines.next()) |line| {
+        var fields = std.mem.tokenizeScalar(u8, line, ' ');
+        if (!std.mem.eql(u8, fields.next() orelse continue, &key)) continue;
+        var config = KernelConfig{};
+        config.literal_workgroup_size = std.fmt.parseInt(u32, fields.next() orelse return null, 10) catch return null;
+        config.literal_tile_bytes = std.fmt.parseInt(u32, fields.next() orelse return null, 10) catch return null;
+        config.regex_workgroup_size = std.fmt.parseInt(u32, fields.next() orelse return null, 10) catch return null;
+        return config;
+    }
+    return null;
+}
+
+/// Record a device's configuration, replacing any earlier entry for it
+pub fn store(allocator: std.mem.Allocator, uuid: [16]u8, config: KernelConfig) !void {
+    const path = try cachePath(allocator);
+    defer allocator.free(path);
+    if (std.fs.path.dirname(path)) |dir| try std.fs.cwd().makePath(dir);
+
+    const old = std.fs.cwd().readFileAlloc(allocator, path, 64 * 1024) catch "";
+    defer if (old.len > 0) allocator.free(old);
+
+    var contents: std.ArrayListUnmanaged(u8) = .{};
+    defer contents.deinit(allocator);
+    const key = std.fmt.bytesToHex(uuid, .lower);
+    var lines = std.mem.tokenizeScalar(u8, old, '\n');
+    while (lines.next()) |line| {
+        if (std.mem.startsWith(u8, line, &key)) continue;
+        try contents.appendSlice(allocator, line);
+        try contents.append(allocator, '\n');
+    }
+    try contents.print(allocator, "{s} {d} {d} {d}\n", .{ &key, config.literal_workgroup_size, config.literal_tile_bytes, config.regex_workgroup_size });
+
+    // Write beside the cache and rename, so a concurrent reader never sees half a file
+    const tmp_path = try std.fmt.allocPrint(allocator, "{s}.tmp", .{path});
+    defer allocator.free(tmp_path);
+    try std.fs.cwd().writeFile(.{ .sub_path = tmp_path, .data = contents.items });
+    try std.fs.cwd().rename(tmp_path, path);
+}
+
+test "isValid rejects shapes the device or shader can't run" {
+    const limits = Limits{ .max_workgroup_size = 256, .max_shared_memory = 16 * 1024 };
+    try std.testing.expect(isValid(.{}, limits));
+    try std.testing.expect(!isValid(.{ .literal_workgroup_size = 512, .literal_tile_bytes = 4096 }, limits));
+    try std.testing.expect(!isValid(.{ .literal_workgroup_size = 256, .literal_tile_bytes = 8192 }, limits));
+    try std.testing.expect(!isValid(.{ .literal_workgroup_size = 96, .literal_tile_bytes = 96 * 8 }, limits));
+    // Tiles that end partway through a staging flush
+    try std.testing.expect(!isValid(.{ .literal_workgroup_size = 64, .literal_tile_bytes = 64 * 8 }, limits));
+    try std.testing.expect(!isValid(.{ .literal_workgroup_size = 128, .literal_tile_bytes = 128 * 8 }, limits));
+    try std.testing.expect(isValid(.{ .literal_workgroup_size = 64, .literal_tile_bytes = 64 * 32 }, limits));
+}
+
+test "find reads the entry for a device" {
+    const uuid = [_]u8{0xab} ** 16;
+    const contents = "00000000000000000000000000000000 64 512 32\n" ++
+        "abababababababababababababababab 128 2048 64\n";
+    const config = find(contents, uuid).?;
+    try std.testing.expectEqual(@as(u32, 128), config.literal_workgroup_size);
+    try std.testing.expectEqual(@as(u32, 2048), config.literal_tile_bytes);
+    try std.testing.expectEqual(@as(u32, 64), config.regex_workgroup_size);
+    try std.testing.expect(find(contents, [_]u8{0xcd} ** 16) == null);
+}
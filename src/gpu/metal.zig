@@ -456,6 +456,150 @@ pub const MetalSubstituter = struct {
         };
     }
 
+    /// Select the lines containing a literal pattern (for d and p), one GPU thread per line
+    pub fn selectLines(
+        self: *Self,
+        text: []const u8,
+        pattern: []const u8,
+        options: SubstituteOptions,
+        allocator: std.mem.Allocator,
+    ) !mod.LineSelection {
+        var lines = try mod.LineTable.build(self.allocator, text);
+        defer lines.deinit();
+
+        var selection = try mod.LineSelection.init(allocator, lines.len());
+        errdefer selection.deinit();
+        const num_lines = lines.offsets.len;
+        if (pattern.len == 0 or num_lines == 0) return selection;
+
+        const text_buffer = self.device.newBufferWithLengthOptions(text.len, mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer text_buffer.release();
+        if (text_buffer.contents()) |ptr| {
+            @memcpy(@as([*]u8, @ptrCast(ptr))[0..text.len], text);
+        }
+
+        const pattern_buffer = self.device.newBufferWithLengthOptions(pattern.len, mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer pattern_buffer.release();
+        if (pattern_buffer.contents()) |ptr| {
+            @memcpy(@as([*]u8, @ptrCast(ptr))[0..pattern.len], pattern);
+        }
+
+        var line_options = options;
+        line_options.line_mode = true;
+        const config = SubstituteConfig{
+            .text_len = @intCast(text.len),
+            .pattern_len = @intCast(pattern.len),
+            .replacement_len = 0,
+            .flags = line_options.toFlags(),
+            .max_matches = 0,
+            .num_threads = @intCast(num_lines),
+        };
+        const config_buffer = self.device.newBufferWithLengthOptions(@sizeOf(SubstituteConfig), mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer config_buffer.release();
+        if (config_buffer.contents()) |ptr| {
+            @as(*SubstituteConfig, @ptrCast(@alignCast(ptr))).* = config;
+        }
+
+        // One bit per line; kernels only set bits, so start cleared
+        const bitmap_size = selection.bits.len * @sizeOf(u32);
+        const bitmap_buffer = self.device.newBufferWithLengthOptions(bitmap_size, mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer bitmap_buffer.release();
+        const bitmap_ptr: [*]u32 = @ptrCast(@alignCast(bitmap_buffer.contents()));
+        @memset(bitmap_ptr[0..selection.bits.len], 0);
+
+        const line_offsets_buffer = self.device.newBufferWithLengthOptions(num_lines * @sizeOf(u32), mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer line_offsets_buffer.release();
+        if (line_offsets_buffer.contents()) |ptr| {
+            @memcpy(@as([*]u32, @ptrCast(@alignCast(ptr)))[0..num_lines], lines.offsets);
+        }
+
+        const line_lengths_buffer = self.device.newBufferWithLengthOptions(num_lines * @sizeOf(u32), mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer line_lengths_buffer.release();
+        if (line_lengths_buffer.contents()) |ptr| {
+            @memcpy(@as([*]u32, @ptrCast(@alignCast(ptr)))[0..num_lines], lines.lengths);
+        }
+
+        const command_buffer = self.command_queue.commandBuffer() orelse return error.CommandBufferCreationFailed;
+        const encoder = command_buffer.computeCommandEncoder() orelse return error.EncoderCreationFailed;
+
+        encoder.setComputePipelineState(self.filter_pipeline);
+        encoder.setBufferOffsetAtIndex(text_buffer, 0, 0);
+        encoder.setBufferOffsetAtIndex(pattern_buffer, 0, 1);
+        encoder.setBufferOffsetAtIndex(config_buffer, 0, 2);
+        encoder.setBufferOffsetAtIndex(bitmap_buffer, 0, 3);
+        encoder.setBufferOffsetAtIndex(line_offsets_buffer, 0, 4);
+        encoder.setBufferOffsetAtIndex(line_lengths_buffer, 0, 5);
+
+        const grid_size = mtl.MTLSize{ .width = num_lines, .height = 1, .depth = 1 };
+        const thread_group_size = mtl.MTLSize{ .width = @min(self.threads_per_group, num_lines), .height = 1, .depth = 1 };
+
+        encoder.dispatchThreadsThreadsPerThreadgroup(grid_size, thread_group_size);
+        encoder.endEncoding();
+
+        command_buffer.commit();
+        command_buffer.waitUntilCompleted();
+
+        @memcpy(selection.bits, bitmap_ptr[0..selection.bits.len]);
+        return selection;
+    }
+
+    /// Select the lines matching a regex (for d and p). The Metal regex kernel
+    /// has no line mode, so this keeps the first match per line and maps it to bits.
+    pub fn selectLinesRegex(
+        self: *Self,
+        text: []const u8,
+        pattern: []const u8,
+        options: SubstituteOptions,
+        allocator: std.mem.Allocator,
+    ) !mod.LineSelection {
+        var line_options = options;
+        line_options.global = false;
+        var result = try self.findMatchesRegex(text, pattern, line_options, allocator);
+        defer result.deinit();
+        return mod.LineSelection.fromMatches(allocator, result.matches, mod.lineCount(text));
+    }
+
+    /// Apply a y/// byte map to text in place
+    pub fn transliterate(self: *Self, text: []u8, table: *const [256]u8) !void {
+        if (text.len == 0) return;
+
+        const text_buffer = self.device.newBufferWithLengthOptions(text.len, mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer text_buffer.release();
+        const text_ptr: [*]u8 = @ptrCast(text_buffer.contents() orelse return error.BufferCreationFailed);
+        @memcpy(text_ptr[0..text.len], text);
+
+        const table_buffer = self.device.newBufferWithLengthOptions(table.len, mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer table_buffer.release();
+        if (table_buffer.contents()) |ptr| {
+            @memcpy(@as([*]u8, @ptrCast(ptr))[0..table.len], table);
+        }
+
+        const len_buffer = self.device.newBufferWithLengthOptions(@sizeOf(u32), mtl.MTLResourceOptions.MTLResourceCPUCacheModeDefaultCache) orelse return error.BufferCreationFailed;
+        defer len_buffer.release();
+        if (len_buffer.contents()) |ptr| {
+            @as(*u32, @ptrCast(@alignCast(ptr))).* = @intCast(text.len);
+        }
+
+        const command_buffer = self.command_queue.commandBuffer() orelse return error.CommandBufferCreationFailed;
+        const encoder = command_buffer.computeCommandEncoder() orelse return error.EncoderCreationFailed;
+
+        encoder.setComputePipelineState(self.transliterate_pipeline);
+        encoder.setBufferOffsetAtIndex(text_buffer, 0, 0);
+        encoder.setBufferOffsetAtIndex(table_buffer, 0, 1);
+        encoder.setBufferOffsetAtIndex(len_buffer, 0, 2);
+
+        const grid_size = mtl.MTLSize{ .width = text.len, .height = 1, .depth = 1 };
+        const thread_group_size = mtl.MTLSize{ .width = @min(self.threads_per_group, text.len), .height = 1, .depth = 1 };
+
+        encoder.dispatchThreadsThreadsPerThreadgroup(grid_size, thread_group_size);
+        encoder.endEncoding();
+
+        command_buffer.commit();
+        command_buffer.waitUntilCompleted();
+
+        @memcpy(text, text_ptr[0..text.len]);
+    }
+
     pub fn getCapabilities(self: *Self) mod.GpuCapabilities {
         return self.capabilities;
     }
@@ -19,6 +19,12 @@ pub const vulkan = @import("vulkan.zig");
 // Regex compiler for GPU regex support
 pub const regex_compiler = @import("regex_compiler.zig");
 
+// Per-device kernel shape tuning (--gpu-autotune)
+pub const autotune = @import("autotune.zig");
+
+// Cached "no usable GPU" verdict, so auto mode stops probing on GPU-less hosts
+pub const probe = @import("probe.zig");
+
 // Configuration
 pub const BATCH_SIZE: usize = 1024 * 1024;
 pub const MAX_GPU_BUFFER_SIZE: usize = 64 * 1024 * 1024;
@@ -42,7 +48,9 @@ pub const SubstituteConfig = extern struct {
     _pad2: u32 = 0,
 };
 
-// Result for each match (must match shader struct layout)
+// Result for each match (must match shader struct layout). Offsets and the
+// line number are relative to the text searched, which is at most
+// MAX_CHUNK_LEN bytes; ChunkBase places them in a larger input.
 pub const MatchResult = extern struct {
     start: u32,
     end: u32,
@@ -50,12 +58,85 @@ pub const MatchResult = extern struct {
     _pad: u32 = 0,
 };
 
+/// A match as the Vulkan kernels write it (MatchRecord in
+/// match_compact.glsl) and the host buffers it: offset and length in 8
+/// bytes, half a MatchResult. The line number is recovered by counting
+/// newlines while the sorted records are replayed (emitPacked).
+pub const PackedMatch = extern struct {
+    start: u32,
+    len: u32,
+
+    pub fn end(self: PackedMatch) u32 {
+        return self.start + self.len;
+    }
+
+    pub fn lessThan(_: void, a: PackedMatch, b: PackedMatch) bool {
+        return a.start < b.start;
+    }
+};
+
+/// Longest text a single find or select call accepts (u32 match offsets).
+/// Longer inputs are searched in line-aligned chunks.
+pub const MAX_CHUNK_LEN: usize = std.math.maxInt(u32);
+
+/// Where a chunk starts in the whole input
+pub const ChunkBase = struct {
+    offset: u64 = 0,
+    line: u64 = 0,
+
+    /// Position of a chunk-relative match in the whole input
+    pub fn locate(self: ChunkBase, match: MatchResult) MatchLocation {
+        return .{
+            .start = self.offset + match.start,
+            .end = self.offset + match.end,
+            .line = self.line + match.line_num,
+        };
+    }
+
+    /// The base of the chunk that follows `chunk`
+    pub fn advance(self: ChunkBase, chunk: []const u8) ChunkBase {
+        return .{ .offset = self.offset + chunk.len, .line = self.line + lineCount(chunk) };
+    }
+};
+
+/// A match in a whole input of any size (line is 0-indexed)
+pub const MatchLocation = struct {
+    start: u64,
+    end: u64,
+    line: u64,
+};
+
+/// Longest prefix of `text` that ends on a line boundary and fits in `max_len`
+/// bytes; a single longer line is returned whole
+pub fn nextChunk(text: []const u8, max_len: usize) []const u8 {
+    if (text.len <= max_len) return text;
+    if (std.mem.lastIndexOfScalar(u8, text[0..max_len], '\n')) |nl| return text[0 .. nl + 1];
+    const end = if (std.mem.indexOfScalarPos(u8, text, max_len, '\n')) |nl| nl + 1 else text.len;
+    return text[0..end];
+}
+
 // Substitute flags
 pub const SubstituteFlags = struct {
     pub const CASE_INSENSITIVE: u32 = 1;
     pub const GLOBAL: u32 = 2;
     pub const FIRST_ONLY: u32 = 4;
     pub const LINE_MODE: u32 = 8;
+    pub const ANCHOR_START: u32 = 16;
+    pub const TILED: u32 = 32; // Vulkan search mode: shared-memory tile per workgroup
+};
+
+// Launch shape of the Vulkan search kernels, passed as specialization
+// constants. Defaults hold until --gpu-autotune caches a faster shape for the
+// device. A tiled literal workgroup covers literal_tile_bytes positions
+// (workgroup size x bytes per thread) plus a halo of up to MAX_PATTERN_LEN - 1.
+pub const KernelConfig = struct {
+    literal_workgroup_size: u32 = 256,
+    literal_tile_bytes: u32 = 4096,
+    regex_workgroup_size: u32 = 64,
+
+    pub fn bytesPerThread(self: KernelConfig) u32 {
+        return self.literal_tile_bytes / self.literal_workgroup_size;
+    }
 };
 
 // Substitute options
@@ -73,6 +154,7 @@ pub const SubstituteOptions = struct {
         if (self.global) flags |= SubstituteFlags.GLOBAL;
         if (self.first_only) flags |= SubstituteFlags.FIRST_ONLY;
         if (self.line_mode) flags |= SubstituteFlags.LINE_MODE;
+        if (self.anchor_start) flags |= SubstituteFlags.ANCHOR_START;
         return flags;
     }
 };
@@ -88,9 +170,211 @@ pub const SubstituteResult = struct {
     }
 };
 
+/// Replay position-sorted packed matches to `onMatch` in text order, filling
+/// in line numbers; with `first_only`, only a line's first match is kept.
+/// Returns the number of matches passed on.
+pub fn emitPacked(text: []const u8, matches: []const PackedMatch, first_only: bool, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+    var line_num: u32 = 0;
+    var text_pos: usize = 0;
+    var last_line: ?u32 = null;
+    var emitted: u64 = 0;
+    for (matches) |match| {
+        line_num += @intCast(std.mem.count(u8, text[text_pos..match.start], "\n"));
+        text_pos = match.start;
+        if (first_only and last_line != null and last_line.? == line_num) continue;
+        last_line = line_num;
+        try onMatch(context, .{ .start = match.start, .end = match.end(), .line_num = line_num });
+        emitted += 1;
+    }
+    return emitted;
+}
+
+/// onMatch target that buffers every match, for callers that need the whole
+/// SubstituteResult at once (batched runs split it per file)
+pub const MatchCollector = struct {
+    matches: std.ArrayListUnmanaged(MatchResult) = .{},
+    allocator: std.mem.Allocator,
+
+    pub fn add(self: *MatchCollector, match: MatchResult) anyerror!void {
+        try self.matches.append(self.allocator, match);
+    }
+
+    pub fn finish(self: *MatchCollector, total_matches: u64) !SubstituteResult {
+        return .{ .matches = try self.matches.toOwnedSlice(self.allocator), .total_matches = total_matches, .allocator = self.allocator };
+    }
+
+    pub fn deinit(self: *MatchCollector) void {
+        self.matches.deinit(self.allocator);
+    }
+};
+
+// Line selection for d and p: bit i is set when line i (0-indexed) matched.
+// Produced directly by the GPU line-mode kernels, so the host never sees matches.
+pub const LineSelection = struct {
+    bits: []u32,
+    num_lines: u32,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, num_lines: u32) !LineSelection {
+        const bits = try allocator.alloc(u32, wordsFor(num_lines));
+        @memset(bits, 0);
+        return LineSelection{ .bits = bits, .num_lines = num_lines, .allocator = allocator };
+    }
+
+    /// Build a selection from match records whose line_num is populated
+    pub fn fromMatches(allocator: std.mem.Allocator, matches: []const MatchResult, num_lines: u32) !LineSelection {
+        var selection = try init(allocator, num_lines);
+        for (matches) |match| try selection.add(match);
+        return selection;
+    }
+
+    /// onMatch target: select the match's line as it is found
+    pub fn add(self: *LineSelection, match: MatchResult) anyerror!void {
+        if (match.line_num < self.num_lines) self.set(match.line_num);
+    }
+
+    pub fn deinit(self: *LineSelection) void {
+        self.allocator.free(self.bits);
+    }
+
+    pub fn wordsFor(num_lines: u32) usize {
+        return (@as(usize, num_lines) + 31) / 32;
+    }
+
+    pub inline fn isSelected(self: LineSelection, line: u32) bool {
+        return ((self.bits[line >> 5] >> @intCast(line & 31)) & 1) != 0;
+    }
+
+    pub inline fn set(self: *LineSelection, line: u32) void {
+        self.bits[line >> 5] |= @as(u32, 1) << @intCast(line & 31);
+    }
+
+    pub fn count(self: LineSelection) u32 {
+        var total: u32 = 0;
+        for (self.bits) |word| total += @popCount(word);
+        return total;
+    }
+};
+
+/// Number of lines in text (a trailing line without newline counts, empty text has none)
+pub fn lineCount(text: []const u8) u32 {
+    var lines: usize = std.mem.count(u8, text, "\n");
+    if (text.len > 0 and text[text.len - 1] != '\n') lines += 1;
+    return @intCast(lines);
+}
+
+// Per-line start offsets and lengths (newline excluded), as consumed by the
+// one-thread-per-line kernels
+pub const LineTable = struct {
+    offsets: []u32,
+    lengths: []u32,
+    allocator: std.mem.Allocator,
+
+    pub fn build(allocator: std.mem.Allocator, text: []const u8) !LineTable {
+        const num_lines = lineCount(text);
+        const offsets = try allocator.alloc(u32, num_lines);
+        errdefer allocator.free(offsets);
+        const lengths = try allocator.alloc(u32, num_lines);
+
+        var line_idx: usize = 0;
+        var line_start: usize = 0;
+        while (line_idx < num_lines) : (line_idx += 1) {
+            const line_end = std.mem.indexOfScalarPos(u8, text, line_start, '\n') orelse text.len;
+            offsets[line_idx] = @intCast(line_start);
+            lengths[line_idx] = @intCast(line_end - line_start);
+            line_start = line_end + 1;
+        }
+        return LineTable{ .offsets = offsets, .lengths = lengths, .allocator = allocator };
+    }
+
+    pub fn deinit(self: *LineTable) void {
+        self.allocator.free(self.offsets);
+        self.allocator.free(self.lengths);
+    }
+
+    pub fn len(self: LineTable) u32 {
+        return @intCast(self.offsets.len);
+    }
+};
+
+// Byte map for y/SOURCE/DEST/. Adjacent y commands compose into one table,
+// so a whole run of them costs a single pass over the text.
+pub const TransliterateTable = struct {
+    map: [256]u8,
+
+    pub fn identity() TransliterateTable {
+        var table: TransliterateTable = undefined;
+        for (&table.map, 0..) |*entry, i| entry.* = @intCast(i);
+        return table;
+    }
+
+    /// First occurrence of a source byte wins; extra source bytes map to themselves
+    pub fn init(source: []const u8, dest: []const u8) TransliterateTable {
+        var table = identity();
+        var i = @min(source.len, dest.len);
+        while (i > 0) {
+            i -= 1;
+            table.map[source[i]] = dest[i];
+        }
+        return table;
+    }
+
+    /// Table equivalent to applying self, then next
+    pub fn then(self: TransliterateTable, next: TransliterateTable) TransliterateTable {
+        var table: TransliterateTable = undefined;
+        for (&table.map, self.map) |*entry, mid| entry.* = next.map[mid];
+        return table;
+    }
+};
+
+/// Below this size a y/// byte map is cheaper on the CPU than the upload and readback
+pub const MIN_GPU_TRANSLITERATE_SIZE: usize = 1024 * 1024;
+
+// Where a GPU substituter's time went, reported per command under -V.
+// Host phases come from a monotonic timer; line_index_ns and kernel_ns from
+// device timestamp queries (zero when the queue has no timestamp support).
+pub const GpuTimings = struct {
+    init_ns: u64 = 0, // Instance, device, pipelines
+    upload_ns: u64 = 0, // Text and pattern into GPU-visible memory
+    setup_ns: u64 = 0, // Buffers, descriptors, recording, regex compile
+    submit_ns: u64 = 0, // Submit until the fence signals
+    readback_ns: u64 = 0, // Results back into host allocations
+    line_index_ns: u64 = 0, // Device: line table passes
+    kernel_ns: u64 = 0, // Device: search / transliterate kernels
+    dispatches: u32 = 0,
+
+    pub fn print(self: GpuTimings, backend: []const u8) void {
+        std.debug.print("GPU timings ({s}, {d} submissions): init {d:.3} ms, upload {d:.3} ms, setup {d:.3} ms, submit {d:.3} ms " ++
+            "[line index {d:.3} ms, kernel {d:.3} ms], readback {d:.3} ms\n", .{
+            backend,
+            self.dispatches,
+            toMs(self.init_ns),
+            toMs(self.upload_ns),
+            toMs(self.setup_ns),
+            toMs(self.submit_ns),
+            toMs(self.line_index_ns),
+            toMs(self.kernel_ns),
+            toMs(self.readback_ns),
+        });
+    }
+
+    fn toMs(ns: u64) f64 {
+        return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+    }
+};
+
 // Use library's Backend enum
 pub const Backend = e_jerk_gpu.Backend;
 
+/// Path of a per-user cache file: $XDG_CACHE_HOME/sed/<name>, else ~/.cache/sed/<name>
+pub fn cachePath(allocator: std.mem.Allocator, name: []const u8) ![]u8 {
+    if (std.posix.getenv("XDG_CACHE_HOME")) |dir| {
+        if (dir.len > 0) return std.fs.path.join(allocator, &.{ dir, "sed", name });
+    }
+    const home = std.posix.getenv("HOME") orelse return error.NoCacheDir;
+    return std.fs.path.join(allocator, &.{ home, ".cache", "sed", name });
+}
+
 pub fn detectBestBackend() Backend {
     if (build_options.is_macos) return .metal;
     return .vulkan;
@@ -150,7 +434,12 @@ pub const RegexSearchConfig = extern struct {
     num_bitmaps: u32,
     max_results: u32,
     flags: u32,
-    _pad: u32 = 0,
+    num_lines: u32 = 0,
+
+    // Sed-specific flags (low bits are shared with the regex header flags)
+    pub const FLAG_GLOBAL: u32 = 0x08;
+    pub const FLAG_FIRST_ONLY: u32 = 0x10;
+    pub const FLAG_LINE_MODE: u32 = 0x20;
 };
 
 pub const RegexMatchResult = extern struct {
@@ -0,0 +1,99 @@
+const std = @import("std");
+const builtin = @import("builtin");
+const mod = @import("mod.zig");
+
+// Vulkan device probing is remembered twice: for the rest of the process (in
+// vulkan.zig) and, when no usable device was found, on disk for later
+// processes. The disk entry is only trusted while the host fingerprint
+// matches: same boot, same ICD manifests, same loader overrides. Installing a
+// driver, rebooting or pointing VK_ICD_FILENAMES elsewhere probes again.
+
+const CACHE_NAME = "no-gpu";
+
+// Where Vulkan loaders look for driver (ICD) manifests
+const icd_dirs = [_][]const u8{
+    "/usr/share/vulkan/icd.d",
+    "/usr/local/share/vulkan/icd.d",
+    "/etc/vulkan/icd.d",
+};
+const icd_env_vars = [_][]const u8{ "VK_ICD_FILENAMES", "VK_DRIVER_FILES", "VK_ADD_DRIVER_FILES" };
+
+var known_unavailable: ?bool = null;
+
+/// Whether an earlier process on this host found no usable Vulkan device.
+/// Read once per process; false when the host can't be fingerprinted.
+pub fn knownUnavailable() bool {
+    if (known_unavailable) |unavailable| return unavailable;
+    known_unavailable = readVerdict();
+    return known_unavailable.?;
+}
+
+fn readVerdict() bool {
+    const key = fingerprint() orelse return false;
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    var fba = std.heap.FixedBufferAllocator.init(&path_buf);
+    const path = mod.cachePath(fba.allocator(), CACHE_NAME) catch return false;
+
+    var contents_buf: [128]u8 = undefined;
+    const contents = std.fs.cwd().readFile(path, &contents_buf) catch return false;
+    return matches(contents, key);
+}
+
+fn matches(contents: []const u8, key: u64) bool {
+    var hex_buf: [16]u8 = undefined;
+    const hex = std.fmt.bufPrint(&hex_buf, "{x:0>16}", .{key}) catch unreachable;
+    return std.mem.startsWith(u8, contents, hex);
+}
+
+/// Remember that probing failed with `reason` (kept in the file for anyone debugging)
+pub fn recordUnavailable(reason: anyerror) void {
+    known_unavailable = true;
+    const key = fingerprint() orelse return;
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    var fba = std.heap.FixedBufferAllocator.init(&path_buf);
+    const path = mod.cachePath(fba.allocator(), CACHE_NAME) catch return;
+
+    var line_buf: [128]u8 = undefined;
+    const line = std.fmt.bufPrint(&line_buf, "{x:0>16} {s}\n", .{ key, @errorName(reason) }) catch return;
+    if (std.fs.path.dirname(path)) |dir| std.fs.cwd().makePath(dir) catch return;
+    std.fs.cwd().writeFile(.{ .sub_path = path, .data = line }) catch {};
+}
+
+/// A device came up after all (forced --vulkan run): drop a stale verdict
+pub fn clearUnavailable() void {
+    if (!knownUnavailable()) return;
+    known_unavailable = false;
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    var fba = std.heap.FixedBufferAllocator.init(&path_buf);
+    const path = mod.cachePath(fba.allocator(), CACHE_NAME) catch return;
+    std.fs.cwd().deleteFile(path) catch {};
+}
+
+/// Hash of the boot id, the ICD manifest directories' modification times and
+/// the loader's driver overrides; null off Linux (no boot id to scope by)
+fn fingerprint() ?u64 {
+    if (builtin.os.tag != .linux) return null;
+
+    var boot_id_buf: [64]u8 = undefined;
+    const boot_id = std.fs.cwd().readFile("/proc/sys/kernel/random/boot_id", &boot_id_buf) catch return null;
+
+    var hasher = std.hash.Wyhash.init(0);
+    hasher.update(boot_id);
+    for (icd_dirs) |dir| {
+        const stat = std.fs.cwd().statFile(dir) catch continue;
+        hasher.update(dir);
+        hasher.update(std.mem.asBytes(&stat.mtime));
+    }
+    for (icd_env_vars) |name| {
+        hasher.update(name);
+        hasher.update(std.posix.getenv(name) orelse "");
+    }
+    return hasher.final();
+}
+
+test "matches only the recorded fingerprint" {
+    const key: u64 = 0x0123456789abcdef;
+    try std.testing.expect(matches("0123456789abcdef NoVulkanDevice\n", key));
+    try std.testing.expect(!matches("0123456789abcdee NoVulkanDevice\n", key));
+    try std.testing.expect(!matches("", key));
+}
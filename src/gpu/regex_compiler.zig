@@ -18,8 +18,34 @@ pub const CompiledGpuRegex = struct {
         self.allocator.free(self.states);
         self.allocator.free(self.bitmaps);
     }
+
+    pub fn view(self: *const CompiledGpuRegex) GpuRegexView {
+        return .{ .header = self.header, .states = self.states, .bitmaps = self.bitmaps };
+    }
+};
+
+/// Read-only NFA tables, owned elsewhere (a CompiledGpuRegex or a mapped script artifact)
+pub const GpuRegexView = struct {
+    header: RegexHeader,
+    states: []const RegexState,
+    bitmaps: []const u32,
 };
 
+/// A regex compiled ahead of time (sed --compile-script), looked up by pattern
+/// and case flag before the kernel would compile it again
+pub const PrecompiledRegex = struct {
+    pattern: []const u8,
+    case_insensitive: bool,
+    tables: GpuRegexView,
+};
+
+pub fn findPrecompiled(list: []const PrecompiledRegex, pattern: []const u8, case_insensitive: bool) ?GpuRegexView {
+    for (list) |entry| {
+        if (entry.case_insensitive == case_insensitive and std.mem.eql(u8, entry.pattern, pattern)) return entry.tables;
+    }
+    return null;
+}
+
 /// Convert CPU regex to GPU-compatible format
 pub fn compileForGpu(pattern: []const u8, options: regex_lib.Regex.Options, allocator: std.mem.Allocator) !CompiledGpuRegex {
     // Compile the regex on CPU first
@@ -4,6 +4,8 @@ const vk = @import("vulkan");
 const spirv = @import("spirv");
 const mod = @import("mod.zig");
 const regex_compiler = @import("regex_compiler.zig");
+const autotune = @import("autotune.zig");
+const probe = @import("probe.zig");
 
 const SubstituteConfig = mod.SubstituteConfig;
 const MatchResult = mod.MatchResult;
@@ -53,6 +55,32 @@ fn getVkGetInstanceProcAddr() !vk.PfnGetInstanceProcAddr {
     return vulkan_loader.?.getProcAddr;
 }
 
+// Failures that mean this host has no usable Vulkan device at all (no loader,
+// no driver or device, no compute queue); later processes skip the probe
+const UnavailableError = error{ VulkanNotFound, UnsupportedPlatform, NoVulkanDevice, NoComputeQueue };
+
+// Probe failures that may not recur (out of memory, a driver hiccup) only stop
+// this process from retrying
+const ProbeError = UnavailableError || error{ InstanceCreationFailed, DeviceEnumerationFailed };
+
+// First probe failure in this process; later inits return it without retrying
+var probe_failure: ?ProbeError = null;
+
+fn probeFailed(err: ProbeError) ProbeError {
+    probe_failure = err;
+    switch (err) {
+        error.InstanceCreationFailed, error.DeviceEnumerationFailed => {},
+        else => probe.recordUnavailable(err),
+    }
+    return err;
+}
+
+/// Whether auto mode should consider Vulkan: false once a probe failed in this
+/// process, or while an earlier process's "no device" verdict still applies
+pub fn available() bool {
+    return probe_failure == null and !probe.knownUnavailable();
+}
+
 pub const VulkanSubstituter = struct {
     instance: vk.Instance,
     physical_device: vk.PhysicalDevice,
@@ -67,9 +95,57 @@ pub const VulkanSubstituter = struct {
     regex_pipeline_layout: vk.PipelineLayout,
     regex_compute_pipeline: vk.Pipeline,
     regex_shader_module: vk.ShaderModule,
-    descriptor_pool: vk.DescriptorPool,
+    // Transliteration pipeline (y///)
+    transliterate_descriptor_set_layout: vk.DescriptorSetLayout,
+    transliterate_pipeline_layout: vk.PipelineLayout,
+    transliterate_compute_pipeline: vk.Pipeline,
+    transliterate_shader_module: vk.ShaderModule,
+    // Line table construction (line_index.comp), four passes selected by push constant
+    line_index_descriptor_set_layout: vk.DescriptorSetLayout,
+    line_index_pipeline_layout: vk.PipelineLayout,
+    line_index_pipeline: vk.Pipeline,
+    line_index_shader_module: vk.ShaderModule,
+    // Subgroup arithmetic + ballot in compute shaders (Vulkan 1.1 core query)
+    subgroup_ops: bool,
+    subgroup_size: u32,
+    // storageBuffer8BitAccess enabled; shaders read uint8_t views of their buffers
+    storage_8bit: bool,
     shader_module: vk.ShaderModule,
+    // Bindings go through VK_KHR_push_descriptor when available; otherwise each
+    // pipeline keeps one persistent set, rewritten only when its buffers change
+    push_descriptors: bool,
+    descriptor_pool: vk.DescriptorPool,
+    descriptor_sets: [pipeline_kinds]vk.DescriptorSet,
+    bound: [pipeline_kinds][max_bindings]vk.Buffer,
+    // Buffers reused across dispatches, one per role, grown on demand
+    buffer_pool: [buffer_slots]?BufferAllocation,
     command_pool: vk.CommandPool,
+    // Pre-recorded command buffers, one per chain, re-recorded only after a
+    // pooled buffer was reallocated (bindings_generation changed) or when the
+    // chain's text buffer differs from the one it was recorded with
+    chains: [chain_kinds]RecordedChain,
+    bindings_generation: u32,
+    // Workgroup counts for vkCmdDispatchIndirect, one slot per DispatchSlot
+    dispatch_args: BufferAllocation,
+    // VK_EXT_external_memory_host: page-aligned input is imported as the text
+    // buffer instead of copied (0 when the extension is unavailable)
+    host_import_alignment: vk.DeviceSize,
+    imported_text: ?BufferAllocation,
+    // Three timestamps per chain (start, line table done, end); null handle
+    // when the queue can't write timestamps
+    query_pool: vk.QueryPool,
+    timestamp_period: f32, // Nanoseconds per tick
+    timestamp_mask: u64,
+    // Host phases are charged from phase_timer laps; device phases from the queries
+    phase_timer: std.time.Timer,
+    timings: mod.GpuTimings,
+    // Specialization constants of the literal and regex pipelines, from the
+    // autotune cache for this device (pipeline cache UUID) or the defaults
+    kernel_config: mod.KernelConfig,
+    tune_limits: autotune.Limits,
+    pipeline_cache_uuid: [16]u8,
+    // NFA tables from a precompiled script (sed -F), borrowed from its mapping
+    precompiled_regexes: []const regex_compiler.PrecompiledRegex = &.{},
     fence: vk.Fence,
     mem_props: vk.PhysicalDeviceMemoryProperties,
     allocator: std.mem.Allocator,
@@ -81,8 +157,66 @@ pub const VulkanSubstituter = struct {
     const Self = @This();
     const BufferAllocation = struct { buffer: vk.Buffer, memory: vk.DeviceMemory, size: vk.DeviceSize, mapped: ?*anyopaque };
 
+    const PipelineKind = enum { literal, regex, transliterate, line_index };
+    const pipeline_kinds = @typeInfo(PipelineKind).@"enum".fields.len;
+    const max_bindings = 10;
+
+    // Pooled buffer roles; the line table buffers are device-local, config is a uniform buffer
+    const BufferSlot = enum {
+        config,
+        text,
+        pattern,
+        results,
+        counters,
+        line_bitmap,
+        line_offsets,
+        line_lengths,
+        block_counts,
+        line_params,
+        regex_states,
+        regex_bitmaps,
+        regex_config,
+        regex_header,
+        table,
+    };
+    const buffer_slots = @typeInfo(BufferSlot).@"enum".fields.len;
+
+    // Command sequences recorded once and resubmitted; only dispatch_args and
+    // buffer contents change between submissions
+    const Chain = enum {
+        count_lines, // COUNT -> SCAN
+        literal, // literal search
+        literal_lines, // SCATTER -> LENGTHS -> literal line mode
+        regex, // SCATTER -> LENGTHS -> regex
+        transliterate,
+    };
+    const chain_kinds = @typeInfo(Chain).@"enum".fields.len;
+    const RecordedChain = struct { command_buffer: vk.CommandBuffer, generation: u32, text: vk.Buffer };
+
+    /// Pipelines whose descriptor sets a chain binds
+    fn chainKinds(chain: Chain) []const PipelineKind {
+        return switch (chain) {
+            .count_lines => &.{.line_index},
+            .literal => &.{.literal},
+            .literal_lines => &.{ .line_index, .literal },
+            .regex => &.{ .line_index, .regex },
+            .transliterate => &.{.transliterate},
+        };
+    }
+
+    const DispatchSlot = enum { count, scatter, lengths, literal, regex, transliterate };
+    const dispatch_slots = @typeInfo(DispatchSlot).@"enum".fields.len;
+
+    const timestamps_per_chain: u32 = 3;
+
+    // Host-side phases of a dispatch, each a GpuTimings field
+    const Phase = enum { upload, setup, submit, readback };
+    const MIN_POOLED_BUFFER_SIZE: vk.DeviceSize = 256;
+
     pub fn init(allocator: std.mem.Allocator) !*Self {
-        const vkb = vk.BaseWrapper.load(try getVkGetInstanceProcAddr());
+        if (probe_failure) |err| return err;
+        var init_timer = std.time.Timer.start() catch return error.TimerUnsupported;
+        const vkb = vk.BaseWrapper.load(getVkGetInstanceProcAddr() catch |err| return probeFailed(err));
 
         const app_info = vk.ApplicationInfo{
             .p_application_name = "sed",
@@ -92,21 +226,25 @@ pub const VulkanSubstituter = struct {
             .api_version = @bitCast(vk.API_VERSION_1_2),
         };
 
-        const instance = vkb.createInstance(&.{ .p_application_info = &app_info, .enabled_layer_count = 0, .pp_enabled_layer_names = null, .enabled_extension_count = 0, .pp_enabled_extension_names = null }, null) catch return error.InstanceCreationFailed;
+        const instance = vkb.createInstance(&.{ .p_application_info = &app_info, .enabled_layer_count = 0, .pp_enabled_layer_names = null, .enabled_extension_count = 0, .pp_enabled_extension_names = null }, null) catch |err| {
+            // The loader found no driver to create the instance with
+            return probeFailed(if (err == error.IncompatibleDriver) error.NoVulkanDevice else error.InstanceCreationFailed);
+        };
         const vki = vk.InstanceWrapper.load(instance, vkb.dispatch.vkGetInstanceProcAddr.?);
         errdefer vki.destroyInstance(instance, null);
 
         var device_count: u32 = 0;
-        _ = try vki.enumeratePhysicalDevices(instance, &device_count, null);
-        if (device_count == 0) return error.NoVulkanDevice;
+        _ = vki.enumeratePhysicalDevices(instance, &device_count, null) catch return probeFailed(error.DeviceEnumerationFailed);
+        if (device_count == 0) return probeFailed(error.NoVulkanDevice);
 
         var physical_devices: [16]vk.PhysicalDevice = undefined;
         device_count = @min(device_count, 16);
-        _ = try vki.enumeratePhysicalDevices(instance, &device_count, &physical_devices);
+        _ = vki.enumeratePhysicalDevices(instance, &device_count, &physical_devices) catch return probeFailed(error.DeviceEnumerationFailed);
 
         var selected_device: ?vk.PhysicalDevice = null;
         var selected_queue_family: u32 = 0;
         var selected_props: vk.PhysicalDeviceProperties = undefined;
+        var selected_timestamp_bits: u32 = 0;
 
         for (physical_devices[0..device_count]) |pdev| {
             const props = vki.getPhysicalDeviceProperties(pdev);
@@ -125,31 +263,105 @@ pub const VulkanSubstituter = struct {
                         selected_device = pdev;
                         selected_queue_family = @intCast(i);
                         selected_props = props;
+                        selected_timestamp_bits = qp.timestamp_valid_bits;
                     }
                     break;
                 }
             }
         }
 
-        const physical_device = selected_device orelse return error.NoComputeQueue;
+        const physical_device = selected_device orelse return probeFailed(error.NoComputeQueue);
+        probe.clearUnavailable();
+
+        // Host pointer import needs external memory (core in 1.1)
+        const external_memory_host = selected_props.api_version >= @as(u32, @bitCast(vk.API_VERSION_1_1)) and
+            hasDeviceExtension(vki, physical_device, allocator, external_memory_host_extension);
+        var host_memory_props = vk.PhysicalDeviceExternalMemoryHostPropertiesEXT{ .min_imported_host_pointer_alignment = 0 };
+
+        // Subgroup arithmetic lets the prefix sums skip the shared-memory scan, and
+        // ballot lets match compaction reserve slots once per subgroup
+        var subgroup_props = vk.PhysicalDeviceSubgroupProperties{
+            .p_next = if (external_memory_host) &host_memory_props else null,
+            .subgroup_size = 0,
+            .supported_stages = .{},
+            .supported_operations = .{},
+            .quad_operations_in_all_stages = .false,
+        };
+        if (selected_props.api_version >= @as(u32, @bitCast(vk.API_VERSION_1_1))) {
+            var props2 = vk.PhysicalDeviceProperties2{ .p_next = &subgroup_props, .properties = undefined };
+            vki.getPhysicalDeviceProperties2(physical_device, &props2);
+        }
+        const subgroup_ops = subgroup_props.supported_stages.compute_bit and
+            subgroup_props.supported_operations.basic_bit and
+            subgroup_props.supported_operations.arithmetic_bit and
+            subgroup_props.supported_operations.ballot_bit;
+
+        // Native byte loads (storageBuffer8BitAccess, core in 1.2) replace the
+        // shift-and-mask unpacking of text and NFA state records
+        var storage_8bit_features = vk.PhysicalDevice8BitStorageFeatures{
+            .storage_buffer_8_bit_access = .false,
+            .uniform_and_storage_buffer_8_bit_access = .false,
+            .storage_push_constant_8 = .false,
+        };
+        if (selected_props.api_version >= @as(u32, @bitCast(vk.API_VERSION_1_2))) {
+            var features2 = vk.PhysicalDeviceFeatures2{ .p_next = &storage_8bit_features, .features = .{} };
+            vki.getPhysicalDeviceFeatures2(physical_device, &features2);
+        }
+        const storage_8bit = storage_8bit_features.storage_buffer_8_bit_access == .true;
+        // Enable only what the shaders use
+        const enabled_8bit_features = vk.PhysicalDevice8BitStorageFeatures{
+            .storage_buffer_8_bit_access = .true,
+            .uniform_and_storage_buffer_8_bit_access = .false,
+            .storage_push_constant_8 = .false,
+        };
+
+        // Push descriptors write bindings straight into the command buffer
+        const push_descriptors = hasDeviceExtension(vki, physical_device, allocator, push_descriptor_extension);
+        var device_extensions: [2][*:0]const u8 = undefined;
+        var device_extension_count: u32 = 0;
+        if (push_descriptors) {
+            device_extensions[device_extension_count] = push_descriptor_extension;
+            device_extension_count += 1;
+        }
+        if (external_memory_host) {
+            device_extensions[device_extension_count] = external_memory_host_extension;
+            device_extension_count += 1;
+        }
 
         const queue_priority: f32 = 1.0;
         const device = vki.createDevice(physical_device, &.{
+            .p_next = if (storage_8bit) &enabled_8bit_features else null,
             .queue_create_info_count = 1,
             .p_queue_create_infos = @ptrCast(&vk.DeviceQueueCreateInfo{ .queue_family_index = selected_queue_family, .queue_count = 1, .p_queue_priorities = @ptrCast(&queue_priority) }),
             .enabled_layer_count = 0,
             .pp_enabled_layer_names = null,
-            .enabled_extension_count = 0,
-            .pp_enabled_extension_names = null,
+            .enabled_extension_count = device_extension_count,
+            .pp_enabled_extension_names = &device_extensions,
             .p_enabled_features = null,
         }, null) catch return error.DeviceCreationFailed;
 
+        const set_layout_flags: vk.DescriptorSetLayoutCreateFlags = .{ .push_descriptor_bit_khr = push_descriptors };
+
         const vkd = vk.DeviceWrapper.load(device, vki.dispatch.vkGetDeviceProcAddr.?);
         errdefer vkd.destroyDevice(device, null);
 
         const compute_queue = vkd.getDeviceQueue(device, selected_queue_family, 0);
 
-        const shader_module = vkd.createShaderModule(device, &.{ .code_size = spirv.EMBEDDED_SPIRV.len, .p_code = @ptrCast(@alignCast(spirv.EMBEDDED_SPIRV.ptr)) }, null) catch return error.ShaderModuleCreationFailed;
+        // Launch shape: the cached autotune result for this device when it still fits
+        const tune_limits = autotune.Limits{
+            .max_workgroup_size = @min(selected_props.limits.max_compute_work_group_size[0], selected_props.limits.max_compute_work_group_invocations),
+            .max_shared_memory = selected_props.limits.max_compute_shared_memory_size,
+        };
+        const kernel_config: mod.KernelConfig = blk: {
+            if (autotune.load(allocator, selected_props.pipeline_cache_uuid)) |cached| {
+                if (autotune.isValid(cached, tune_limits)) break :blk cached;
+            }
+            break :blk .{};
+        };
+
+        // Literal and regex kernels: subgroup or shared-atomic compaction, byte or word loads
+        const literal_spirv = shaderVariant(.{ spirv.EMBEDDED_SPIRV, spirv.EMBEDDED_SPIRV_SUBGROUP, spirv.EMBEDDED_SPIRV_8BIT, spirv.EMBEDDED_SPIRV_SUBGROUP_8BIT }, subgroup_ops, storage_8bit);
+        const shader_module = vkd.createShaderModule(device, &.{ .code_size = literal_spirv.len, .p_code = @ptrCast(@alignCast(literal_spirv.ptr)) }, null) catch return error.ShaderModuleCreationFailed;
         errdefer vkd.destroyShaderModule(device, shader_module, null);
 
         // 8 bindings: config, text, pattern, results, counters, line_matches, line_offsets, line_lengths
@@ -164,34 +376,34 @@ pub const VulkanSubstituter = struct {
             .{ .binding = 7, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null },
         };
 
-        const descriptor_set_layout = vkd.createDescriptorSetLayout(device, &.{ .binding_count = bindings.len, .p_bindings = &bindings }, null) catch return error.DescriptorSetLayoutCreationFailed;
+        const descriptor_set_layout = vkd.createDescriptorSetLayout(device, &.{ .flags = set_layout_flags, .binding_count = bindings.len, .p_bindings = &bindings }, null) catch return error.DescriptorSetLayoutCreationFailed;
         errdefer vkd.destroyDescriptorSetLayout(device, descriptor_set_layout, null);
 
         const pipeline_layout = vkd.createPipelineLayout(device, &.{ .set_layout_count = 1, .p_set_layouts = @ptrCast(&descriptor_set_layout), .push_constant_range_count = 0, .p_push_constant_ranges = null }, null) catch return error.PipelineLayoutCreationFailed;
         errdefer vkd.destroyPipelineLayout(device, pipeline_layout, null);
 
-        var compute_pipeline: vk.Pipeline = undefined;
-        _ = vkd.createComputePipelines(device, .null_handle, 1, @ptrCast(&vk.ComputePipelineCreateInfo{
-            .stage = .{ .stage = .{ .compute_bit = true }, .module = shader_module, .p_name = "main", .p_specialization_info = null },
-            .layout = pipeline_layout,
-            .base_pipeline_handle = .null_handle,
-            .base_pipeline_index = -1,
-        }), null, @ptrCast(&compute_pipeline)) catch return error.ComputePipelineCreationFailed;
+        const compute_pipeline = try createSpecializedPipeline(vkd, device, shader_module, pipeline_layout, &.{ kernel_config.literal_workgroup_size, kernel_config.literal_tile_bytes });
         errdefer vkd.destroyPipeline(device, compute_pipeline, null);
 
-        const pool_sizes = [_]vk.DescriptorPoolSize{
-            .{ .type = .uniform_buffer, .descriptor_count = 1 },
-            .{ .type = .storage_buffer, .descriptor_count = 7 },
-        };
-        const descriptor_pool = vkd.createDescriptorPool(device, &.{ .max_sets = 1, .pool_size_count = 2, .p_pool_sizes = &pool_sizes }, null) catch return error.DescriptorPoolCreationFailed;
-        errdefer vkd.destroyDescriptorPool(device, descriptor_pool, null);
-
         const command_pool = vkd.createCommandPool(device, &.{ .queue_family_index = selected_queue_family, .flags = .{ .reset_command_buffer_bit = true } }, null) catch return error.CommandPoolCreationFailed;
         errdefer vkd.destroyCommandPool(device, command_pool, null);
 
+        // One primary command buffer per chain, freed with the pool
+        var chain_buffers: [chain_kinds]vk.CommandBuffer = undefined;
+        vkd.allocateCommandBuffers(device, &.{ .command_pool = command_pool, .level = .primary, .command_buffer_count = chain_kinds }, &chain_buffers) catch return error.CommandBufferAllocationFailed;
+        var chains: [chain_kinds]RecordedChain = undefined;
+        for (&chains, chain_buffers) |*chain, command_buffer| chain.* = .{ .command_buffer = command_buffer, .generation = 0, .text = .null_handle };
+
         const fence = vkd.createFence(device, &.{ .flags = .{} }, null) catch return error.FenceCreationFailed;
         errdefer vkd.destroyFence(device, fence, null);
 
+        // Kernel timings for -V; without timestamp support only host phases are reported
+        const query_pool: vk.QueryPool = if (selected_timestamp_bits > 0 and selected_props.limits.timestamp_period > 0)
+            vkd.createQueryPool(device, &.{ .query_type = .timestamp, .query_count = chain_kinds * timestamps_per_chain, .pipeline_statistics = .{} }, null) catch .null_handle
+        else
+            .null_handle;
+        errdefer if (query_pool != .null_handle) vkd.destroyQueryPool(device, query_pool, null);
+
         const mem_props = vki.getPhysicalDeviceMemoryProperties(physical_device);
 
         const is_discrete = selected_props.device_type == .discrete_gpu;
@@ -223,13 +435,14 @@ pub const VulkanSubstituter = struct {
         };
 
         // Create regex shader module from SPIR-V
+        const regex_spirv = shaderVariant(.{ spirv.EMBEDDED_SPIRV_REGEX, spirv.EMBEDDED_SPIRV_REGEX_SUBGROUP, spirv.EMBEDDED_SPIRV_REGEX_8BIT, spirv.EMBEDDED_SPIRV_REGEX_SUBGROUP_8BIT }, subgroup_ops, storage_8bit);
         const regex_shader_module = vkd.createShaderModule(device, &.{
-            .code_size = spirv.EMBEDDED_SPIRV_REGEX.len,
-            .p_code = @ptrCast(@alignCast(spirv.EMBEDDED_SPIRV_REGEX.ptr)),
+            .code_size = regex_spirv.len,
+            .p_code = @ptrCast(@alignCast(regex_spirv.ptr)),
         }, null) catch return error.ShaderModuleCreationFailed;
         errdefer vkd.destroyShaderModule(device, regex_shader_module, null);
 
-        // Regex pipeline needs 9 bindings (all storage buffers for consistency with GLSL)
+        // Regex pipeline needs 10 bindings (all storage buffers for consistency with GLSL)
         const regex_bindings = [_]vk.DescriptorSetLayoutBinding{
             .{ .binding = 0, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // TextBuffer
             .{ .binding = 1, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // StatesBuffer
@@ -240,9 +453,11 @@ pub const VulkanSubstituter = struct {
             .{ .binding = 6, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // CounterBuffer
             .{ .binding = 7, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // LineOffsetsBuffer
             .{ .binding = 8, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // LineLengthsBuffer
+            .{ .binding = 9, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // LineBitmapBuffer
         };
 
         const regex_descriptor_set_layout = vkd.createDescriptorSetLayout(device, &.{
+            .flags = set_layout_flags,
             .binding_count = regex_bindings.len,
             .p_bindings = &regex_bindings,
         }, null) catch return error.DescriptorSetLayoutCreationFailed;
@@ -256,19 +471,112 @@ pub const VulkanSubstituter = struct {
         }, null) catch return error.PipelineLayoutCreationFailed;
         errdefer vkd.destroyPipelineLayout(device, regex_pipeline_layout, null);
 
-        var regex_compute_pipeline: vk.Pipeline = undefined;
+        const regex_compute_pipeline = try createSpecializedPipeline(vkd, device, regex_shader_module, regex_pipeline_layout, &.{kernel_config.regex_workgroup_size});
+        errdefer vkd.destroyPipeline(device, regex_compute_pipeline, null);
+
+        // Transliteration pipeline: text (read/write) and the 256-entry byte map
+        const transliterate_shader_module = vkd.createShaderModule(device, &.{
+            .code_size = spirv.EMBEDDED_SPIRV_TRANSLITERATE.len,
+            .p_code = @ptrCast(@alignCast(spirv.EMBEDDED_SPIRV_TRANSLITERATE.ptr)),
+        }, null) catch return error.ShaderModuleCreationFailed;
+        errdefer vkd.destroyShaderModule(device, transliterate_shader_module, null);
+
+        const transliterate_bindings = [_]vk.DescriptorSetLayoutBinding{
+            .{ .binding = 0, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // Text
+            .{ .binding = 1, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // Table
+        };
+
+        const transliterate_descriptor_set_layout = vkd.createDescriptorSetLayout(device, &.{
+            .flags = set_layout_flags,
+            .binding_count = transliterate_bindings.len,
+            .p_bindings = &transliterate_bindings,
+        }, null) catch return error.DescriptorSetLayoutCreationFailed;
+        errdefer vkd.destroyDescriptorSetLayout(device, transliterate_descriptor_set_layout, null);
+
+        const transliterate_pipeline_layout = vkd.createPipelineLayout(device, &.{
+            .set_layout_count = 1,
+            .p_set_layouts = @ptrCast(&transliterate_descriptor_set_layout),
+            .push_constant_range_count = 0,
+            .p_push_constant_ranges = null,
+        }, null) catch return error.PipelineLayoutCreationFailed;
+        errdefer vkd.destroyPipelineLayout(device, transliterate_pipeline_layout, null);
+
+        var transliterate_compute_pipeline: vk.Pipeline = undefined;
         _ = vkd.createComputePipelines(device, .null_handle, 1, @ptrCast(&vk.ComputePipelineCreateInfo{
             .stage = .{
                 .stage = .{ .compute_bit = true },
-                .module = regex_shader_module,
+                .module = transliterate_shader_module,
                 .p_name = "main",
                 .p_specialization_info = null,
             },
-            .layout = regex_pipeline_layout,
+            .layout = transliterate_pipeline_layout,
             .base_pipeline_handle = .null_handle,
             .base_pipeline_index = -1,
-        }), null, @ptrCast(&regex_compute_pipeline)) catch return error.ComputePipelineCreationFailed;
-        errdefer vkd.destroyPipeline(device, regex_compute_pipeline, null);
+        }), null, @ptrCast(&transliterate_compute_pipeline)) catch return error.ComputePipelineCreationFailed;
+        errdefer vkd.destroyPipeline(device, transliterate_compute_pipeline, null);
+
+        // Line index pipeline: text, block counts, offsets, lengths, params; pass id as push constant
+        const line_index_spirv = if (subgroup_ops) spirv.EMBEDDED_SPIRV_LINE_INDEX_SUBGROUP else spirv.EMBEDDED_SPIRV_LINE_INDEX;
+        const line_index_shader_module = vkd.createShaderModule(device, &.{
+            .code_size = line_index_spirv.len,
+            .p_code = @ptrCast(@alignCast(line_index_spirv.ptr)),
+        }, null) catch return error.ShaderModuleCreationFailed;
+        errdefer vkd.destroyShaderModule(device, line_index_shader_module, null);
+
+        const line_index_bindings = [_]vk.DescriptorSetLayoutBinding{
+            .{ .binding = 0, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // Text
+            .{ .binding = 1, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // BlockCounts
+            .{ .binding = 2, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // LineOffsets
+            .{ .binding = 3, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // LineLengths
+            .{ .binding = 4, .descriptor_type = .storage_buffer, .descriptor_count = 1, .stage_flags = .{ .compute_bit = true }, .p_immutable_samplers = null }, // Params
+        };
+
+        const line_index_descriptor_set_layout = vkd.createDescriptorSetLayout(device, &.{
+            .flags = set_layout_flags,
+            .binding_count = line_index_bindings.len,
+            .p_bindings = &line_index_bindings,
+        }, null) catch return error.DescriptorSetLayoutCreationFailed;
+        errdefer vkd.destroyDescriptorSetLayout(device, line_index_descriptor_set_layout, null);
+
+        const line_index_pipeline_layout = vkd.createPipelineLayout(device, &.{
+            .set_layout_count = 1,
+            .p_set_layouts = @ptrCast(&line_index_descriptor_set_layout),
+            .push_constant_range_count = 1,
+            .p_push_constant_ranges = @ptrCast(&vk.PushConstantRange{ .stage_flags = .{ .compute_bit = true }, .offset = 0, .size = @sizeOf(u32) }),
+        }, null) catch return error.PipelineLayoutCreationFailed;
+        errdefer vkd.destroyPipelineLayout(device, line_index_pipeline_layout, null);
+
+        var line_index_pipeline: vk.Pipeline = undefined;
+        _ = vkd.createComputePipelines(device, .null_handle, 1, @ptrCast(&vk.ComputePipelineCreateInfo{
+            .stage = .{
+                .stage = .{ .compute_bit = true },
+                .module = line_index_shader_module,
+                .p_name = "main",
+                .p_specialization_info = null,
+            },
+            .layout = line_index_pipeline_layout,
+            .base_pipeline_handle = .null_handle,
+            .base_pipeline_index = -1,
+        }), null, @ptrCast(&line_index_pipeline)) catch return error.ComputePipelineCreationFailed;
+        errdefer vkd.destroyPipeline(device, line_index_pipeline, null);
+
+        // Without push descriptors: one persistent set per pipeline, allocated once
+        var descriptor_pool: vk.DescriptorPool = .null_handle;
+        var descriptor_sets = [_]vk.DescriptorSet{.null_handle} ** pipeline_kinds;
+        if (!push_descriptors) {
+            const pool_sizes = [_]vk.DescriptorPoolSize{
+                .{ .type = .uniform_buffer, .descriptor_count = 1 },
+                .{ .type = .storage_buffer, .descriptor_count = 7 + regex_bindings.len + transliterate_bindings.len + line_index_bindings.len },
+            };
+            descriptor_pool = vkd.createDescriptorPool(device, &.{ .max_sets = pipeline_kinds, .pool_size_count = pool_sizes.len, .p_pool_sizes = &pool_sizes }, null) catch return error.DescriptorPoolCreationFailed;
+
+            const set_layouts = [pipeline_kinds]vk.DescriptorSetLayout{ descriptor_set_layout, regex_descriptor_set_layout, transliterate_descriptor_set_layout, line_index_descriptor_set_layout };
+            vkd.allocateDescriptorSets(device, &.{ .descriptor_pool = descriptor_pool, .descriptor_set_count = pipeline_kinds, .p_set_layouts = &set_layouts }, &descriptor_sets) catch {
+                vkd.destroyDescriptorPool(device, descriptor_pool, null);
+                return error.DescriptorSetAllocationFailed;
+            };
+        }
+        errdefer vkd.destroyDescriptorPool(device, descriptor_pool, null);
 
         const self = try allocator.create(Self);
         self.* = Self{
@@ -284,9 +592,37 @@ pub const VulkanSubstituter = struct {
             .regex_pipeline_layout = regex_pipeline_layout,
             .regex_compute_pipeline = regex_compute_pipeline,
             .regex_shader_module = regex_shader_module,
-            .descriptor_pool = descriptor_pool,
+            .transliterate_descriptor_set_layout = transliterate_descriptor_set_layout,
+            .transliterate_pipeline_layout = transliterate_pipeline_layout,
+            .transliterate_compute_pipeline = transliterate_compute_pipeline,
+            .transliterate_shader_module = transliterate_shader_module,
+            .line_index_descriptor_set_layout = line_index_descriptor_set_layout,
+            .line_index_pipeline_layout = line_index_pipeline_layout,
+            .line_index_pipeline = line_index_pipeline,
+            .line_index_shader_module = line_index_shader_module,
+            .subgroup_ops = subgroup_ops,
+            .subgroup_size = subgroup_props.subgroup_size,
+            .storage_8bit = storage_8bit,
             .shader_module = shader_module,
+            .push_descriptors = push_descriptors,
+            .descriptor_pool = descriptor_pool,
+            .descriptor_sets = descriptor_sets,
+            .bound = undefined,
+            .buffer_pool = [_]?BufferAllocation{null} ** buffer_slots,
             .command_pool = command_pool,
+            .chains = chains,
+            .bindings_generation = 1,
+            .dispatch_args = .{ .buffer = .null_handle, .memory = .null_handle, .size = 0, .mapped = null },
+            .host_import_alignment = if (external_memory_host) host_memory_props.min_imported_host_pointer_alignment else 0,
+            .imported_text = null,
+            .query_pool = query_pool,
+            .timestamp_period = selected_props.limits.timestamp_period,
+            .timestamp_mask = if (selected_timestamp_bits >= 64) std.math.maxInt(u64) else (@as(u64, 1) << @intCast(selected_timestamp_bits)) - 1,
+            .phase_timer = init_timer,
+            .timings = .{},
+            .kernel_config = kernel_config,
+            .tune_limits = tune_limits,
+            .pipeline_cache_uuid = selected_props.pipeline_cache_uuid,
             .fence = fence,
             .mem_props = mem_props,
             .allocator = allocator,
@@ -295,13 +631,35 @@ pub const VulkanSubstituter = struct {
             .vkd = vkd,
             .capabilities = capabilities,
         };
+        self.invalidateBindings();
+        self.dispatch_args = self.createHostBuffer(dispatch_slots * @sizeOf(vk.DispatchIndirectCommand), .{ .indirect_buffer_bit = true }) catch |err| {
+            self.deinit();
+            return err;
+        };
+        self.timings.init_ns = init_timer.read();
         return self;
     }
 
     pub fn deinit(self: *Self) void {
+        for (self.buffer_pool) |entry| {
+            if (entry) |buf| self.destroyBuffer(buf);
+        }
+        if (self.dispatch_args.mapped != null) self.destroyBuffer(self.dispatch_args);
+        self.releaseImportedText();
+        if (self.query_pool != .null_handle) self.vkd.destroyQueryPool(self.device, self.query_pool, null);
         self.vkd.destroyFence(self.device, self.fence, null);
         self.vkd.destroyCommandPool(self.device, self.command_pool, null);
         self.vkd.destroyDescriptorPool(self.device, self.descriptor_pool, null);
+        // Clean up line index pipeline
+        self.vkd.destroyPipeline(self.device, self.line_index_pipeline, null);
+        self.vkd.destroyPipelineLayout(self.device, self.line_index_pipeline_layout, null);
+        self.vkd.destroyDescriptorSetLayout(self.device, self.line_index_descriptor_set_layout, null);
+        self.vkd.destroyShaderModule(self.device, self.line_index_shader_module, null);
+        // Clean up transliteration pipeline
+        self.vkd.destroyPipeline(self.device, self.transliterate_compute_pipeline, null);
+        self.vkd.destroyPipelineLayout(self.device, self.transliterate_pipeline_layout, null);
+        self.vkd.destroyDescriptorSetLayout(self.device, self.transliterate_descriptor_set_layout, null);
+        self.vkd.destroyShaderModule(self.device, self.transliterate_shader_module, null);
         // Clean up regex pipeline
         self.vkd.destroyPipeline(self.device, self.regex_compute_pipeline, null);
         self.vkd.destroyPipelineLayout(self.device, self.regex_pipeline_layout, null);
@@ -317,8 +675,9 @@ pub const VulkanSubstituter = struct {
         self.allocator.destroy(self);
     }
 
-    fn createStorageBuffer(self: *Self, size: vk.DeviceSize) !BufferAllocation {
-        const buffer = self.vkd.createBuffer(self.device, &.{ .size = size, .usage = .{ .storage_buffer_bit = true }, .sharing_mode = .exclusive, .queue_family_index_count = 0, .p_queue_family_indices = null }, null) catch return error.BufferCreationFailed;
+    /// Host-visible, coherent, persistently mapped buffer
+    fn createHostBuffer(self: *Self, size: vk.DeviceSize, usage: vk.BufferUsageFlags) !BufferAllocation {
+        const buffer = self.vkd.createBuffer(self.device, &.{ .size = size, .usage = usage, .sharing_mode = .exclusive, .queue_family_index_count = 0, .p_queue_family_indices = null }, null) catch return error.BufferCreationFailed;
         const mem_reqs = self.vkd.getBufferMemoryRequirements(self.device, buffer);
         const mem_type_index = findMemoryType(&self.mem_props, mem_reqs.memory_type_bits, .{ .host_visible_bit = true, .host_coherent_bit = true }) orelse return error.NoSuitableMemoryType;
         const memory = self.vkd.allocateMemory(self.device, &.{ .allocation_size = mem_reqs.size, .memory_type_index = mem_type_index }, null) catch return error.MemoryAllocationFailed;
@@ -327,108 +686,233 @@ pub const VulkanSubstituter = struct {
         return BufferAllocation{ .buffer = buffer, .memory = memory, .size = size, .mapped = mapped };
     }
 
+    fn createStorageBuffer(self: *Self, size: vk.DeviceSize) !BufferAllocation {
+        return self.createHostBuffer(size, .{ .storage_buffer_bit = true });
+    }
+
     fn createUniformBuffer(self: *Self, size: vk.DeviceSize) !BufferAllocation {
-        const buffer = self.vkd.createBuffer(self.device, &.{ .size = size, .usage = .{ .uniform_buffer_bit = true }, .sharing_mode = .exclusive, .queue_family_index_count = 0, .p_queue_family_indices = null }, null) catch return error.BufferCreationFailed;
+        return self.createHostBuffer(size, .{ .uniform_buffer_bit = true });
+    }
+
+    /// Device-local buffer the host never touches; falls back to host-visible
+    /// memory on devices (integrated GPUs) without a separate device-only heap
+    fn createDeviceBuffer(self: *Self, size: vk.DeviceSize) !BufferAllocation {
+        const buffer = self.vkd.createBuffer(self.device, &.{ .size = size, .usage = .{ .storage_buffer_bit = true }, .sharing_mode = .exclusive, .queue_family_index_count = 0, .p_queue_family_indices = null }, null) catch return error.BufferCreationFailed;
         const mem_reqs = self.vkd.getBufferMemoryRequirements(self.device, buffer);
-        const mem_type_index = findMemoryType(&self.mem_props, mem_reqs.memory_type_bits, .{ .host_visible_bit = true, .host_coherent_bit = true }) orelse return error.NoSuitableMemoryType;
+        const mem_type_index = findMemoryType(&self.mem_props, mem_reqs.memory_type_bits, .{ .device_local_bit = true }) orelse {
+            self.vkd.destroyBuffer(self.device, buffer, null);
+            return self.createStorageBuffer(size);
+        };
         const memory = self.vkd.allocateMemory(self.device, &.{ .allocation_size = mem_reqs.size, .memory_type_index = mem_type_index }, null) catch return error.MemoryAllocationFailed;
         self.vkd.bindBufferMemory(self.device, buffer, memory, 0) catch return error.MemoryBindFailed;
-        const mapped = self.vkd.mapMemory(self.device, memory, 0, size, .{}) catch return error.MemoryMapFailed;
-        return BufferAllocation{ .buffer = buffer, .memory = memory, .size = size, .mapped = mapped };
+        return BufferAllocation{ .buffer = buffer, .memory = memory, .size = size, .mapped = null };
     }
 
     fn destroyBuffer(self: *Self, buf: BufferAllocation) void {
-        self.vkd.unmapMemory(self.device, buf.memory);
+        if (buf.mapped != null) self.vkd.unmapMemory(self.device, buf.memory);
         self.vkd.freeMemory(self.device, buf.memory, null);
         self.vkd.destroyBuffer(self.device, buf.buffer, null);
     }
 
-    pub fn findMatches(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !SubstituteResult {
-        if (text.len == 0 or pattern.len == 0) return SubstituteResult{ .matches = &[_]MatchResult{}, .total_matches = 0, .allocator = result_allocator };
-        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+    /// Pooled buffer for a role, grown (to a power of two) when too small.
+    /// The returned view's size is the requested size; bindings cover the whole
+    /// buffer so a recorded chain stays valid while the buffer does.
+    fn pooledBuffer(self: *Self, slot: BufferSlot, size: vk.DeviceSize) !BufferAllocation {
+        const entry = &self.buffer_pool[@intFromEnum(slot)];
+        if (entry.*) |buf| {
+            if (buf.size >= size) {
+                var view = buf;
+                view.size = size;
+                return view;
+            }
+            self.destroyBuffer(buf);
+            entry.* = null;
+            // A new buffer may reuse the old handle, so cached bindings can't be trusted
+            self.invalidateBindings();
+        }
 
-        // Create buffers
-        const config_buffer = try self.createUniformBuffer(@sizeOf(SubstituteConfig));
-        defer self.destroyBuffer(config_buffer);
+        const capacity = @max(std.math.ceilPowerOfTwoAssert(vk.DeviceSize, size), MIN_POOLED_BUFFER_SIZE);
+        const buf = switch (slot) {
+            .config => try self.createUniformBuffer(capacity),
+            .line_offsets, .line_lengths, .block_counts => try self.createDeviceBuffer(capacity),
+            else => try self.createStorageBuffer(capacity),
+        };
+        entry.* = buf;
 
-        const text_size: vk.DeviceSize = @intCast(((text.len + 3) / 4) * 4);
-        const text_buffer = try self.createStorageBuffer(@max(text_size, 4));
-        defer self.destroyBuffer(text_buffer);
+        var view = buf;
+        view.size = size;
+        return view;
+    }
 
-        const pattern_size: vk.DeviceSize = @intCast(((pattern.len + 3) / 4) * 4);
-        const pattern_buffer = try self.createStorageBuffer(@max(pattern_size, 4));
-        defer self.destroyBuffer(pattern_buffer);
+    /// Forget cached bindings and recorded chains
+    fn invalidateBindings(self: *Self) void {
+        for (&self.bound) |*set| @memset(set, .null_handle);
+        self.bindings_generation +%= 1;
+    }
 
-        const results_size: vk.DeviceSize = @intCast(@sizeOf(MatchResult) * MAX_RESULTS);
-        const results_buffer = try self.createStorageBuffer(results_size);
-        defer self.destroyBuffer(results_buffer);
+    fn pipelineLayout(self: *Self, kind: PipelineKind) vk.PipelineLayout {
+        return switch (kind) {
+            .literal => self.pipeline_layout,
+            .regex => self.regex_pipeline_layout,
+            .transliterate => self.transliterate_pipeline_layout,
+            .line_index => self.line_index_pipeline_layout,
+        };
+    }
 
-        const counters_buffer = try self.createStorageBuffer(8);
-        defer self.destroyBuffer(counters_buffer);
+    /// Bind buffers 0..n of a pipeline's set 0 while recording a chain. Push
+    /// descriptors record the writes into the command buffer; the persistent set
+    /// only has its changed bindings rewritten, which stales the other chains
+    /// that bind it.
+    fn bindBuffers(self: *Self, command_buffer: vk.CommandBuffer, kind: PipelineKind, buffers: []const BufferAllocation) void {
+        const set = self.descriptor_sets[@intFromEnum(kind)];
+        const bound = &self.bound[@intFromEnum(kind)];
+
+        var buffer_infos: [max_bindings]vk.DescriptorBufferInfo = undefined;
+        var writes: [max_bindings]vk.WriteDescriptorSet = undefined;
+        var num_writes: u32 = 0;
+        for (buffers, 0..) |buf, i| {
+            if (!self.push_descriptors and bound[i] == buf.buffer) continue;
+            buffer_infos[num_writes] = .{ .buffer = buf.buffer, .offset = 0, .range = vk.WHOLE_SIZE };
+            writes[num_writes] = .{
+                .dst_set = set,
+                .dst_binding = @intCast(i),
+                .dst_array_element = 0,
+                .descriptor_count = 1,
+                .descriptor_type = if (kind == .literal and i == 0) .uniform_buffer else .storage_buffer,
+                .p_image_info = undefined,
+                .p_buffer_info = @ptrCast(&buffer_infos[num_writes]),
+                .p_texel_buffer_view = undefined,
+            };
+            num_writes += 1;
+        }
 
-        // Placeholder buffers for line-mode operations
-        const placeholder_buffer = try self.createStorageBuffer(4);
-        defer self.destroyBuffer(placeholder_buffer);
+        if (self.push_descriptors) {
+            self.vkd.cmdPushDescriptorSetKHR(command_buffer, .compute, self.pipelineLayout(kind), 0, num_writes, &writes);
+            return;
+        }
+        if (num_writes > 0) {
+            // Chains recorded against the old contents are invalid once the set is
+            // updated; the one being recorded is marked current again by endChain
+            self.vkd.updateDescriptorSets(self.device, num_writes, &writes, 0, undefined);
+            for (buffers, 0..) |buf, i| bound[i] = buf.buffer;
+            for (&self.chains, 0..) |*recorded, c| {
+                if (std.mem.indexOfScalar(PipelineKind, chainKinds(@enumFromInt(c)), kind) != null) recorded.generation = self.bindings_generation -% 1;
+            }
+        }
+        self.vkd.cmdBindDescriptorSets(command_buffer, .compute, self.pipelineLayout(kind), 0, 1, @ptrCast(&set), 0, undefined);
+    }
 
-        // Copy data
-        @memcpy(@as([*]u8, @ptrCast(text_buffer.mapped))[0..text.len], text);
-        @memcpy(@as([*]u8, @ptrCast(pattern_buffer.mapped))[0..pattern.len], pattern);
+    // Dispatch output: match records, or one bit per line for d/p line mode
+    const Dispatch = union(enum) {
+        matches: PackedMatches,
+        selection: mod.LineSelection,
+    };
 
-        @as(*SubstituteConfig, @ptrCast(@alignCast(config_buffer.mapped))).* = SubstituteConfig{
-            .text_len = @intCast(text.len),
-            .pattern_len = @intCast(pattern.len),
-            .replacement_len = 0,
-            .flags = options.toFlags(),
-            .max_matches = MAX_RESULTS,
-            .num_threads = 0,
-        };
+    // Search readback: the kernels' 8-byte records, copied as they are and
+    // sorted by position (the kernels append in completion order). `total` exceeds the records kept
+    // when the results buffer filled up.
+    const PackedMatches = struct {
+        items: []mod.PackedMatch,
+        total: u64,
 
-        // Clear counters
-        @as(*[2]u32, @ptrCast(@alignCast(counters_buffer.mapped))).* = .{ 0, 0 };
+        const none: PackedMatches = .{ .items = &.{}, .total = 0 };
 
-        // Setup descriptor set
-        var descriptor_set: vk.DescriptorSet = undefined;
-        self.vkd.allocateDescriptorSets(self.device, &.{ .descriptor_pool = self.descriptor_pool, .descriptor_set_count = 1, .p_set_layouts = @ptrCast(&self.descriptor_set_layout) }, @ptrCast(&descriptor_set)) catch return error.DescriptorSetAllocationFailed;
-
-        const buffer_infos = [_]vk.DescriptorBufferInfo{
-            .{ .buffer = config_buffer.buffer, .offset = 0, .range = @sizeOf(SubstituteConfig) },
-            .{ .buffer = text_buffer.buffer, .offset = 0, .range = @max(text_size, 4) },
-            .{ .buffer = pattern_buffer.buffer, .offset = 0, .range = @max(pattern_size, 4) },
-            .{ .buffer = results_buffer.buffer, .offset = 0, .range = results_size },
-            .{ .buffer = counters_buffer.buffer, .offset = 0, .range = 8 },
-            .{ .buffer = placeholder_buffer.buffer, .offset = 0, .range = 4 },
-            .{ .buffer = placeholder_buffer.buffer, .offset = 0, .range = 4 },
-            .{ .buffer = placeholder_buffer.buffer, .offset = 0, .range = 4 },
-        };
+        fn overflowed(self: PackedMatches) bool {
+            return self.total > self.items.len;
+        }
+    };
+
+    // Device-side line table built by line_index.comp from an uploaded text buffer.
+    // The count_lines chain runs COUNT/SCAN so the table can be sized; the
+    // consuming chains then start with SCATTER/LENGTHS (recordLineIndexBuild).
+    const LineIndex = struct {
+        text: BufferAllocation,
+        offsets: BufferAllocation,
+        lengths: BufferAllocation,
+        block_counts: BufferAllocation,
+        params: BufferAllocation,
+        num_lines: u32,
+
+        const WORKGROUP_SIZE: u32 = 256;
+        const BLOCK_BYTES: usize = WORKGROUP_SIZE * 4 * 4; // 4 words per thread
+        const PASS_COUNT: u32 = 0;
+        const PASS_SCAN: u32 = 1;
+        const PASS_SCATTER: u32 = 2;
+        const PASS_LENGTHS: u32 = 3;
+    };
+
+    /// Set the workgroup count a chain's indirect dispatch will read
+    fn setDispatch(self: *Self, slot: DispatchSlot, workgroups: usize) void {
+        const args: [*]vk.DispatchIndirectCommand = @ptrCast(@alignCast(self.dispatch_args.mapped));
+        args[@intFromEnum(slot)] = .{ .x = @intCast(workgroups), .y = 1, .z = 1 };
+    }
 
-        const writes = [_]vk.WriteDescriptorSet{
-            .{ .dst_set = descriptor_set, .dst_binding = 0, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .uniform_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[0]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 1, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[1]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 2, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[2]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 3, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[3]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 4, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[4]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 5, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[5]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 6, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[6]), .p_texel_buffer_view = undefined },
-            .{ .dst_set = descriptor_set, .dst_binding = 7, .dst_array_element = 0, .descriptor_count = 1, .descriptor_type = .storage_buffer, .p_image_info = undefined, .p_buffer_info = @ptrCast(&buffer_infos[7]), .p_texel_buffer_view = undefined },
-        };
-        self.vkd.updateDescriptorSets(self.device, 8, &writes, 0, undefined);
+    fn dispatchIndirect(self: *Self, command_buffer: vk.CommandBuffer, slot: DispatchSlot) void {
+        self.vkd.cmdDispatchIndirect(command_buffer, self.dispatch_args.buffer, @intFromEnum(slot) * @sizeOf(vk.DispatchIndirectCommand));
+    }
+
+    /// Command buffer to record a chain into, or null when the recorded one is
+    /// still valid for this text buffer. Call after every pooledBuffer for the
+    /// submission.
+    fn beginChain(self: *Self, chain: Chain, text_buffer: BufferAllocation) !?vk.CommandBuffer {
+        const recorded = &self.chains[@intFromEnum(chain)];
+        if (recorded.generation == self.bindings_generation and recorded.text == text_buffer.buffer) return null;
+        recorded.text = text_buffer.buffer;
+
+        self.vkd.resetCommandBuffer(recorded.command_buffer, .{}) catch return error.CommandBufferBeginFailed;
+        self.vkd.beginCommandBuffer(recorded.command_buffer, &.{ .flags = .{} }) catch return error.CommandBufferBeginFailed;
+        if (self.query_pool != .null_handle) {
+            self.vkd.cmdResetQueryPool(recorded.command_buffer, self.query_pool, firstQuery(chain), timestamps_per_chain);
+        }
+        self.writeTimestamp(recorded.command_buffer, chain, 0, .{ .top_of_pipe_bit = true });
+        return recorded.command_buffer;
+    }
+
+    /// Mark the end of a chain's line table work; later work counts as kernel time
+    fn splitChain(self: *Self, command_buffer: vk.CommandBuffer, chain: Chain) void {
+        self.writeTimestamp(command_buffer, chain, 1, .{ .bottom_of_pipe_bit = true });
+    }
+
+    fn endChain(self: *Self, chain: Chain) !void {
+        const recorded = &self.chains[@intFromEnum(chain)];
+        self.writeTimestamp(recorded.command_buffer, chain, 2, .{ .bottom_of_pipe_bit = true });
+        self.vkd.endCommandBuffer(recorded.command_buffer) catch return error.CommandBufferEndFailed;
+        recorded.generation = self.bindings_generation;
+    }
+
+    fn firstQuery(chain: Chain) u32 {
+        return @as(u32, @intFromEnum(chain)) * timestamps_per_chain;
+    }
+
+    fn writeTimestamp(self: *Self, command_buffer: vk.CommandBuffer, chain: Chain, index: u32, stage: vk.PipelineStageFlags) void {
+        if (self.query_pool == .null_handle) return;
+        self.vkd.cmdWriteTimestamp(command_buffer, stage, self.query_pool, firstQuery(chain) + index);
+    }
 
-        // Record and submit
-        var command_buffer: vk.CommandBuffer = undefined;
-        self.vkd.allocateCommandBuffers(self.device, &.{ .command_pool = self.command_pool, .level = .primary, .command_buffer_count = 1 }, @ptrCast(&command_buffer)) catch return error.CommandBufferAllocationFailed;
-        defer self.vkd.freeCommandBuffers(self.device, self.command_pool, 1, @ptrCast(&command_buffer));
+    /// Charge the host time since the previous mark to a phase
+    fn markPhase(self: *Self, comptime phase: Phase) void {
+        @field(self.timings, @tagName(phase) ++ "_ns") += self.phase_timer.lap();
+    }
 
-        self.vkd.beginCommandBuffer(command_buffer, &.{ .flags = .{ .one_time_submit_bit = true } }) catch return error.CommandBufferBeginFailed;
-        self.vkd.cmdBindPipeline(command_buffer, .compute, self.compute_pipeline);
-        self.vkd.cmdBindDescriptorSets(command_buffer, .compute, self.pipeline_layout, 0, 1, @ptrCast(&descriptor_set), 0, undefined);
+    /// Add a completed chain's device time (line table, then kernels) to the timings
+    fn collectTimestamps(self: *Self, chain: Chain) void {
+        if (self.query_pool == .null_handle) return;
+        var stamps: [timestamps_per_chain]u64 = undefined;
+        const result = self.vkd.getQueryPoolResults(self.device, self.query_pool, firstQuery(chain), timestamps_per_chain, @sizeOf(@TypeOf(stamps)), &stamps, @sizeOf(u64), .{ .@"64_bit" = true }) catch return;
+        if (result != .success) return;
 
-        // Use chunked processing - dispatch fewer workgroups for efficiency
-        // Each thread handles multiple positions (similar to Metal approach)
-        const total_threads = @max(1, text.len / 64);
-        const workgroups = @max(1, (total_threads + 255) / 256);
-        self.vkd.cmdDispatch(command_buffer, @intCast(workgroups), 1, 1);
-        self.vkd.endCommandBuffer(command_buffer) catch return error.CommandBufferEndFailed;
+        self.timings.line_index_ns += self.ticksToNs(stamps[1] -% stamps[0]);
+        self.timings.kernel_ns += self.ticksToNs(stamps[2] -% stamps[1]);
+    }
 
+    fn ticksToNs(self: *Self, ticks: u64) u64 {
+        return @intFromFloat(@as(f64, @floatFromInt(ticks & self.timestamp_mask)) * self.timestamp_period);
+    }
+
+    /// Submit a recorded chain and wait for it; everything since the last mark was setup
+    fn submitChain(self: *Self, chain: Chain) !void {
+        self.markPhase(.setup);
+        const command_buffer = self.chains[@intFromEnum(chain)].command_buffer;
         self.vkd.queueSubmit(self.compute_queue, 1, @ptrCast(&vk.SubmitInfo{
             .wait_semaphore_count = 0,
             .p_wait_semaphores = undefined,
@@ -440,147 +924,339 @@ pub const VulkanSubstituter = struct {
         }), self.fence) catch return error.QueueSubmitFailed;
         _ = self.vkd.waitForFences(self.device, 1, @ptrCast(&self.fence), .true, std.math.maxInt(u64)) catch return error.FenceWaitFailed;
         self.vkd.resetFences(self.device, 1, @ptrCast(&self.fence)) catch return error.FenceResetFailed;
+        self.markPhase(.submit);
+        self.collectTimestamps(chain);
+        self.timings.dispatches += 1;
+    }
 
-        // Read results
-        const counters_ptr: *[2]u32 = @ptrCast(@alignCast(counters_buffer.mapped));
-        const match_count = counters_ptr[0];
-        var total_matches: u64 = counters_ptr[1];
+    /// Make one dispatch's storage writes visible to the next
+    fn computeBarrier(self: *Self, command_buffer: vk.CommandBuffer) void {
+        const barrier = vk.MemoryBarrier{
+            .src_access_mask = .{ .shader_write_bit = true },
+            .dst_access_mask = .{ .shader_read_bit = true, .shader_write_bit = true },
+        };
+        self.vkd.cmdPipelineBarrier(command_buffer, .{ .compute_shader_bit = true }, .{ .compute_shader_bit = true }, .{}, 1, @ptrCast(&barrier), 0, null, 0, null);
+    }
 
-        const num_to_copy = @min(match_count, MAX_RESULTS);
-        var matches = try result_allocator.alloc(MatchResult, num_to_copy);
-        if (num_to_copy > 0) {
-            @memcpy(matches, @as([*]MatchResult, @ptrCast(@alignCast(results_buffer.mapped)))[0..num_to_copy]);
+    fn pushLineIndexPass(self: *Self, command_buffer: vk.CommandBuffer, pass: u32) void {
+        self.vkd.cmdPushConstants(command_buffer, self.line_index_pipeline_layout, .{ .compute_bit = true }, 0, @sizeOf(u32), @ptrCast(&pass));
+    }
+
+    fn bindLineIndex(self: *Self, command_buffer: vk.CommandBuffer, index: *const LineIndex) void {
+        self.vkd.cmdBindPipeline(command_buffer, .compute, self.line_index_pipeline);
+        self.bindBuffers(command_buffer, .line_index, &.{ index.text, index.block_counts, index.offsets, index.lengths, index.params });
+    }
+
+    /// Count lines on the device (COUNT + SCAN) and size the line table.
+    /// Only the 16-byte params block crosses back to the host.
+    fn countLines(self: *Self, text_buffer: BufferAllocation, text: []const u8) !LineIndex {
+        const num_blocks: usize = @max(1, (text.len + LineIndex.BLOCK_BYTES - 1) / LineIndex.BLOCK_BYTES);
+
+        var index = LineIndex{
+            .text = text_buffer,
+            .block_counts = try self.pooledBuffer(.block_counts, @as(vk.DeviceSize, num_blocks) * @sizeOf(u32)),
+            .params = try self.pooledBuffer(.line_params, 4 * @sizeOf(u32)),
+            // COUNT/SCAN never touch the table, so whatever is pooled can stay bound
+            .offsets = try self.pooledBuffer(.line_offsets, @sizeOf(u32)),
+            .lengths = try self.pooledBuffer(.line_lengths, @sizeOf(u32)),
+            .num_lines = 0,
+        };
+
+        const params_ptr: *[4]u32 = @ptrCast(@alignCast(index.params.mapped));
+        params_ptr.* = .{ @intCast(text.len), @intCast(num_blocks), 0, 0 };
+        self.setDispatch(.count, num_blocks);
+        self.setDispatch(.scatter, num_blocks);
+
+        if (try self.beginChain(.count_lines, text_buffer)) |command_buffer| {
+            self.bindLineIndex(command_buffer, &index);
+            self.pushLineIndexPass(command_buffer, LineIndex.PASS_COUNT);
+            self.dispatchIndirect(command_buffer, .count);
+            self.computeBarrier(command_buffer);
+            self.pushLineIndexPass(command_buffer, LineIndex.PASS_SCAN);
+            self.vkd.cmdDispatch(command_buffer, 1, 1, 1);
+            self.splitChain(command_buffer, .count_lines);
+            try self.endChain(.count_lines);
         }
+        try self.submitChain(.count_lines);
 
-        // For first_only mode, filter to keep only first match per line
-        if (options.first_only and matches.len > 0) {
-            // Sort by position to process in order
-            std.mem.sort(MatchResult, matches, {}, struct {
-                fn cmp(_: void, a: MatchResult, b: MatchResult) bool {
-                    return a.start < b.start;
-                }
-            }.cmp);
-
-            // Compute line numbers efficiently by scanning text once
-            var line_num: u32 = 0;
-            var text_pos: usize = 0;
-            for (matches) |*match| {
-                // Count newlines from current position to match position
-                while (text_pos < match.start) {
-                    if (text[text_pos] == '\n') line_num += 1;
-                    text_pos += 1;
-                }
-                match.line_num = line_num;
-            }
+        // A trailing line without a newline still counts
+        index.num_lines = params_ptr[3] + @intFromBool(text.len > 0 and text[text.len - 1] != '\n');
+        params_ptr[2] = index.num_lines;
+        self.setDispatch(.lengths, @max(1, (index.num_lines + LineIndex.WORKGROUP_SIZE - 1) / LineIndex.WORKGROUP_SIZE));
 
-            // Filter to first match per line
-            var write_idx: usize = 0;
-            var last_line_num: u32 = std.math.maxInt(u32);
-            for (matches) |match| {
-                if (match.line_num != last_line_num) {
-                    matches[write_idx] = match;
-                    write_idx += 1;
-                    last_line_num = match.line_num;
-                }
-            }
-            // Shrink the slice
-            matches = try result_allocator.realloc(matches, write_idx);
-            total_matches = write_idx;
+        const table_size: vk.DeviceSize = @as(vk.DeviceSize, @max(index.num_lines, 1)) * @sizeOf(u32);
+        index.offsets = try self.pooledBuffer(.line_offsets, table_size);
+        index.lengths = try self.pooledBuffer(.line_lengths, table_size);
+        return index;
+    }
+
+    /// Record SCATTER + LENGTHS; the table is ready for the next dispatch after the barrier
+    fn recordLineIndexBuild(self: *Self, command_buffer: vk.CommandBuffer, index: *const LineIndex) void {
+        self.bindLineIndex(command_buffer, index);
+        self.pushLineIndexPass(command_buffer, LineIndex.PASS_SCATTER);
+        self.dispatchIndirect(command_buffer, .scatter);
+        self.computeBarrier(command_buffer);
+        self.pushLineIndexPass(command_buffer, LineIndex.PASS_LENGTHS);
+        self.dispatchIndirect(command_buffer, .lengths);
+        self.computeBarrier(command_buffer);
+    }
+
+    /// Bitmap buffer for line mode, cleared because kernels only ever set bits
+    fn lineBitmap(self: *Self, num_lines: u32) !BufferAllocation {
+        const size: vk.DeviceSize = @intCast(@max(mod.LineSelection.wordsFor(num_lines) * @sizeOf(u32), 4));
+        const bitmap = try self.pooledBuffer(.line_bitmap, size);
+        @memset(@as([*]u8, @ptrCast(bitmap.mapped))[0..size], 0);
+        return bitmap;
+    }
+
+    fn readLineBitmap(bitmap: BufferAllocation, num_lines: u32, result_allocator: std.mem.Allocator) !mod.LineSelection {
+        var selection = try mod.LineSelection.init(result_allocator, num_lines);
+        @memcpy(selection.bits, @as([*]const u32, @ptrCast(@alignCast(bitmap.mapped)))[0..selection.bits.len]);
+        return selection;
+    }
+
+    /// Text buffer for a dispatch (sized in whole words): the caller's memory
+    /// itself when it can be imported, otherwise a copy in the pooled buffer.
+    /// Pair with releaseImportedText once the submission has completed.
+    fn uploadText(self: *Self, text: []const u8, writable: bool) !BufferAllocation {
+        // Kernels that write back touch whole words, so an imported buffer they
+        // write must end on a word boundary of the caller's slice
+        if (!writable or text.len % 4 == 0) {
+            if (self.importHostText(text)) |imported| return imported;
         }
 
-        self.vkd.resetDescriptorPool(self.device, self.descriptor_pool, .{}) catch {};
-        return SubstituteResult{ .matches = matches, .total_matches = total_matches, .allocator = result_allocator };
+        const text_buffer = try self.pooledBuffer(.text, @intCast(@max(((text.len + 3) / 4) * 4, 4)));
+        @memcpy(@as([*]u8, @ptrCast(text_buffer.mapped))[0..text.len], text);
+        return text_buffer;
     }
 
-    /// GPU-accelerated regex pattern matching (Vulkan Thompson NFA)
-    pub fn findMatchesRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !SubstituteResult {
-        if (text.len == 0) return SubstituteResult{ .matches = &[_]MatchResult{}, .total_matches = 0, .allocator = result_allocator };
-        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+    /// Wrap page-aligned host memory in a storage buffer (VK_EXT_external_memory_host).
+    /// The import covers whole pages and is refused when rounding up to the
+    /// import alignment would reach past the last page holding part of the text,
+    /// which may be unmapped or belong to someone else. Null when the pointer or
+    /// device doesn't allow it.
+    fn importHostText(self: *Self, text: []const u8) ?BufferAllocation {
+        const alignment = self.host_import_alignment;
+        if (alignment == 0 or text.len == 0 or @intFromPtr(text.ptr) % alignment != 0) return null;
+
+        const handle_type: vk.ExternalMemoryHandleTypeFlags = .{ .host_allocation_bit_ext = true };
+        const host_pointer: *anyopaque = @ptrCast(@constCast(text.ptr));
+        const import_size = std.mem.alignForward(vk.DeviceSize, text.len, alignment);
+        if (import_size > std.mem.alignForward(vk.DeviceSize, text.len, std.heap.pageSize())) return null;
+
+        var pointer_props = vk.MemoryHostPointerPropertiesEXT{ .memory_type_bits = 0 };
+        self.vkd.getMemoryHostPointerPropertiesEXT(self.device, handle_type, host_pointer, &pointer_props) catch return null;
+
+        const external_info = vk.ExternalMemoryBufferCreateInfo{ .handle_types = handle_type };
+        const buffer = self.vkd.createBuffer(self.device, &.{ .p_next = &external_info, .size = import_size, .usage = .{ .storage_buffer_bit = true }, .sharing_mode = .exclusive, .queue_family_index_count = 0, .p_queue_family_indices = null }, null) catch return null;
+        const mem_reqs = self.vkd.getBufferMemoryRequirements(self.device, buffer);
+        const mem_type_index = findMemoryType(&self.mem_props, mem_reqs.memory_type_bits & pointer_props.memory_type_bits, .{ .host_visible_bit = true, .host_coherent_bit = true }) orelse {
+            self.vkd.destroyBuffer(self.device, buffer, null);
+            return null;
+        };
 
-        // Compile regex to GPU format
-        var gpu_regex = try regex_compiler.compileForGpu(pattern, .{
-            .case_insensitive = options.case_insensitive,
-        }, self.allocator);
-        defer gpu_regex.deinit();
+        const import_info = vk.ImportMemoryHostPointerInfoEXT{ .handle_type = handle_type, .p_host_pointer = host_pointer };
+        const memory = self.vkd.allocateMemory(self.device, &.{ .p_next = &import_info, .allocation_size = import_size, .memory_type_index = mem_type_index }, null) catch {
+            self.vkd.destroyBuffer(self.device, buffer, null);
+            return null;
+        };
+        self.vkd.bindBufferMemory(self.device, buffer, memory, 0) catch {
+            self.vkd.freeMemory(self.device, memory, null);
+            self.vkd.destroyBuffer(self.device, buffer, null);
+            return null;
+        };
+
+        // Only chains recorded with this handle bind it (beginChain compares the
+        // text buffer), so the other cached bindings stay valid
+        self.releaseImportedText();
+        const imported = BufferAllocation{ .buffer = buffer, .memory = memory, .size = @intCast(@max(((text.len + 3) / 4) * 4, 4)), .mapped = null };
+        self.imported_text = imported;
+        return imported;
+    }
 
-        // Count lines first
-        var num_lines: usize = 0;
-        for (text) |c| {
-            if (c == '\n') num_lines += 1;
+    /// Drop the import as soon as its dispatch is done: the caller may free the
+    /// memory, and a later allocation at the same address must not reuse it.
+    /// Only the chains and bindings that referenced the import are forgotten,
+    /// since a later buffer may reuse its handle.
+    fn releaseImportedText(self: *Self) void {
+        const imported = self.imported_text orelse return;
+        self.destroyBuffer(imported);
+        self.imported_text = null;
+        for (&self.chains) |*recorded| {
+            if (recorded.text == imported.buffer) recorded.generation = self.bindings_generation -% 1;
         }
-        if (text.len > 0 and text[text.len - 1] != '\n') num_lines += 1;
-        if (num_lines == 0) num_lines = 1;
-
-        // Allocate line offsets and lengths
-        const line_offsets_slice = try self.allocator.alloc(u32, num_lines);
-        defer self.allocator.free(line_offsets_slice);
-        const line_lengths_slice = try self.allocator.alloc(u32, num_lines);
-        defer self.allocator.free(line_lengths_slice);
-
-        // Fill in line data
-        var line_idx: usize = 0;
-        var line_start: u32 = 0;
-        for (text, 0..) |c, i| {
-            if (c == '\n') {
-                line_offsets_slice[line_idx] = line_start;
-                line_lengths_slice[line_idx] = @intCast(i - line_start);
-                line_idx += 1;
-                line_start = @intCast(i + 1);
+        for (&self.bound) |*set| {
+            for (set) |*buffer| {
+                if (buffer.* == imported.buffer) buffer.* = .null_handle;
             }
         }
-        if (line_start < text.len and line_idx < num_lines) {
-            line_offsets_slice[line_idx] = line_start;
-            line_lengths_slice[line_idx] = @intCast(text.len - line_start);
-        }
-
-        // Create buffers
-        const text_size: vk.DeviceSize = @intCast(((text.len + 3) / 4) * 4);
-        const text_buffer = try self.createStorageBuffer(text_size);
-        defer self.destroyBuffer(text_buffer);
+    }
 
-        const states_size: vk.DeviceSize = @intCast(gpu_regex.states.len * 3 * @sizeOf(u32));
-        const states_buffer = try self.createStorageBuffer(@max(states_size, 16));
-        defer self.destroyBuffer(states_buffer);
+    fn readMatches(results_buffer: BufferAllocation, counters_buffer: BufferAllocation, result_allocator: std.mem.Allocator) !PackedMatches {
+        const counters_ptr: *[2]u32 = @ptrCast(@alignCast(counters_buffer.mapped));
+        const num_to_copy = @min(counters_ptr[0], MAX_RESULTS);
+        const matches = try result_allocator.alloc(mod.PackedMatch, num_to_copy);
+        @memcpy(matches, @as([*]const mod.PackedMatch, @ptrCast(@alignCast(results_buffer.mapped)))[0..num_to_copy]);
+        std.mem.sort(mod.PackedMatch, matches, {}, mod.PackedMatch.lessThan);
+        return .{ .items = matches, .total = counters_ptr[0] };
+    }
 
-        const bitmaps_size: vk.DeviceSize = @intCast(@max(gpu_regex.bitmaps.len * @sizeOf(u32), 32));
-        const bitmaps_buffer = try self.createStorageBuffer(bitmaps_size);
-        defer self.destroyBuffer(bitmaps_buffer);
+    /// Replay a readback to `onMatch`, or fail before passing anything on if
+    /// the results buffer overflowed (the caller redoes the search elsewhere)
+    fn emitMatches(text: []const u8, matches: PackedMatches, first_only: bool, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+        if (matches.overflowed()) return error.TooManyMatches;
+        return mod.emitPacked(text, matches.items, first_only, context, onMatch);
+    }
 
-        const config_buffer = try self.createStorageBuffer(@sizeOf(RegexSearchConfig));
-        defer self.destroyBuffer(config_buffer);
+    /// Collect a readback for find callers; an overflow shows as total_matches
+    /// above the matches returned
+    fn collectMatches(text: []const u8, matches: PackedMatches, first_only: bool, result_allocator: std.mem.Allocator) !SubstituteResult {
+        var collector = mod.MatchCollector{ .allocator = result_allocator };
+        defer collector.deinit();
+        const emitted = try mod.emitPacked(text, matches.items, first_only, &collector, mod.MatchCollector.add);
+        return collector.finish(if (matches.overflowed()) matches.total else emitted);
+    }
 
-        const header_buffer = try self.createStorageBuffer(16);
-        defer self.destroyBuffer(header_buffer);
+    /// Run the literal kernel. Search mode returns sorted packed matches; line mode
+    /// builds the line table on the device and returns one bit per line.
+    fn dispatchLiteral(self: *Self, text: []const u8, pattern: []const u8, flags: u32, line_mode: bool, result_allocator: std.mem.Allocator) !Dispatch {
+        self.phase_timer.reset();
+        const config_buffer = try self.pooledBuffer(.config, @sizeOf(SubstituteConfig));
+        const text_buffer = try self.uploadText(text, false);
+        defer self.releaseImportedText();
 
-        const results_size: vk.DeviceSize = @intCast(@sizeOf(MatchResult) * MAX_RESULTS);
-        const results_buffer = try self.createStorageBuffer(results_size);
-        defer self.destroyBuffer(results_buffer);
+        const pattern_buffer = try self.pooledBuffer(.pattern, @intCast(@max(((pattern.len + 3) / 4) * 4, 4)));
+        @memcpy(@as([*]u8, @ptrCast(pattern_buffer.mapped))[0..pattern.len], pattern);
+        self.markPhase(.upload);
 
-        const counters_buffer = try self.createStorageBuffer(8);
-        defer self.destroyBuffer(counters_buffer);
+        // Line mode never writes match records
+        const max_results: u32 = if (line_mode) 1 else MAX_RESULTS;
+        const results_buffer = try self.pooledBuffer(.results, @sizeOf(mod.PackedMatch) * max_results);
+        const counters_buffer = try self.pooledBuffer(.counters, 8);
 
-        const line_offsets_size: vk.DeviceSize = @intCast(num_lines * @sizeOf(u32));
-        const line_offsets_buffer = try self.createStorageBuffer(line_offsets_size);
-        defer self.destroyBuffer(line_offsets_buffer);
+        // Line buffers (bitmap, offsets, lengths); search mode binds whatever is pooled
+        const line_index: ?LineIndex = if (line_mode) try self.countLines(text_buffer, text) else null;
+        const num_lines: u32 = if (line_index) |index| index.num_lines else 0;
+        const bitmap_buffer = try self.lineBitmap(num_lines);
+        const line_offsets = if (line_index) |index| index.offsets else try self.pooledBuffer(.line_offsets, 4);
+        const line_lengths = if (line_index) |index| index.lengths else try self.pooledBuffer(.line_lengths, 4);
 
-        const line_lengths_buffer = try self.createStorageBuffer(line_offsets_size);
-        defer self.destroyBuffer(line_lengths_buffer);
+        @as(*SubstituteConfig, @ptrCast(@alignCast(config_buffer.mapped))).* = SubstituteConfig{
+            .text_len = @intCast(text.len),
+            .pattern_len = @intCast(pattern.len),
+            .replacement_len = 0,
+            .flags = flags,
+            .max_matches = max_results,
+            .num_threads = num_lines,
+        };
 
-        // Upload data
-        @memcpy(@as([*]u8, @ptrCast(text_buffer.mapped))[0..text.len], text);
+        // Clear counters
+        @as(*[2]u32, @ptrCast(@alignCast(counters_buffer.mapped))).* = .{ 0, 0 };
 
-        // Pack states into GPU format (3 u32s per state)
-        const states_ptr: [*]u32 = @ptrCast(@alignCast(states_buffer.mapped));
-        for (gpu_regex.states, 0..) |state, i| {
-            const base = i * 3;
-            states_ptr[base] = @as(u32, state.type) |
-                (@as(u32, state.flags) << 8) |
-                (@as(u32, state.out) << 16);
-            states_ptr[base + 1] = @as(u32, state.out2) |
-                (@as(u32, state.literal_char) << 16) |
-                (@as(u32, state.group_idx) << 24);
-            states_ptr[base + 2] = state.bitmap_offset;
+        // Line mode runs one thread per line; tiled search runs one workgroup per
+        // tile; otherwise chunked processing where each thread handles multiple
+        // positions (similar to Metal)
+        const workgroup_size: usize = self.kernel_config.literal_workgroup_size;
+        const tile_bytes: usize = self.kernel_config.literal_tile_bytes;
+        self.setDispatch(.literal, if (line_mode)
+            @max(1, (@as(usize, num_lines) + workgroup_size - 1) / workgroup_size)
+        else if ((flags & mod.SubstituteFlags.TILED) != 0)
+            @max(1, (text.len - pattern.len + tile_bytes) / tile_bytes)
+        else
+            @max(1, (@max(1, text.len / 64) + workgroup_size - 1) / workgroup_size));
+
+        const chain: Chain = if (line_mode) .literal_lines else .literal;
+        if (try self.beginChain(chain, text_buffer)) |command_buffer| {
+            if (line_index) |*index| self.recordLineIndexBuild(command_buffer, index);
+            self.splitChain(command_buffer, chain);
+            self.vkd.cmdBindPipeline(command_buffer, .compute, self.compute_pipeline);
+            self.bindBuffers(command_buffer, .literal, &.{ config_buffer, text_buffer, pattern_buffer, results_buffer, counters_buffer, bitmap_buffer, line_offsets, line_lengths });
+            self.dispatchIndirect(command_buffer, .literal);
+            try self.endChain(chain);
         }
+        try self.submitChain(chain);
+
+        defer self.markPhase(.readback);
+        if (line_mode) return .{ .selection = try readLineBitmap(bitmap_buffer, num_lines, result_allocator) };
+        return .{ .matches = try readMatches(results_buffer, counters_buffer, result_allocator) };
+    }
+
+    /// Literal search readback; empty inputs never reach the device
+    fn searchLiteral(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !PackedMatches {
+        if (text.len == 0 or pattern.len == 0 or pattern.len > text.len) return .none;
+        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+
+        // The tile's halo holds up to MAX_PATTERN_LEN - 1 bytes; longer patterns use chunked search
+        var flags = options.toFlags();
+        if (pattern.len <= mod.MAX_PATTERN_LEN) flags |= mod.SubstituteFlags.TILED;
+
+        // The kernel matches anywhere; first_only keeps each line's first match on replay
+        return (try self.dispatchLiteral(text, pattern, flags, false, result_allocator)).matches;
+    }
+
+    pub fn findMatches(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !SubstituteResult {
+        const matches = try self.searchLiteral(text, pattern, options, result_allocator);
+        defer result_allocator.free(matches.items);
+        return collectMatches(text, matches, options.first_only, result_allocator);
+    }
+
+    /// Literal search handing matches to `onMatch` in text order after the
+    /// readback is sorted; returns the number passed on. Only the 8-byte
+    /// packed records are buffered on the host.
+    pub fn forEachMatch(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+        const matches = try self.searchLiteral(text, pattern, options, result_allocator);
+        defer result_allocator.free(matches.items);
+        return emitMatches(text, matches, options.first_only, context, onMatch);
+    }
+
+    /// Select the lines containing a literal pattern (for d and p), one GPU thread per line
+    pub fn selectLines(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !mod.LineSelection {
+        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+        if (text.len == 0 or pattern.len == 0) return mod.LineSelection.init(result_allocator, mod.lineCount(text));
+
+        var line_options = options;
+        line_options.line_mode = true;
+        return (try self.dispatchLiteral(text, pattern, line_options.toFlags(), true, result_allocator)).selection;
+    }
+
+    /// Run the regex kernel, one thread per line over a line table built on the
+    /// device. Search mode returns sorted packed matches; line mode one bit per line.
+    fn dispatchRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, line_mode: bool, result_allocator: std.mem.Allocator) !Dispatch {
+        self.phase_timer.reset();
+        // Compile regex to GPU format, unless a loaded script artifact already has it
+        var compiled: ?regex_compiler.CompiledGpuRegex = null;
+        defer if (compiled) |*c| c.deinit();
+        const gpu_regex = regex_compiler.findPrecompiled(self.precompiled_regexes, pattern, options.case_insensitive) orelse blk: {
+            compiled = try regex_compiler.compileForGpu(pattern, .{
+                .case_insensitive = options.case_insensitive,
+            }, self.allocator);
+            break :blk compiled.?.view();
+        };
+        self.markPhase(.setup);
+
+        const text_buffer = try self.uploadText(text, false);
+        defer self.releaseImportedText();
+        self.markPhase(.upload);
+        const states_buffer = try self.pooledBuffer(.regex_states, @intCast(@max(gpu_regex.states.len * @sizeOf(mod.RegexState), 16)));
+        const bitmaps_buffer = try self.pooledBuffer(.regex_bitmaps, @intCast(@max(gpu_regex.bitmaps.len * @sizeOf(u32), 32)));
+        const config_buffer = try self.pooledBuffer(.regex_config, @sizeOf(RegexSearchConfig));
+        const header_buffer = try self.pooledBuffer(.regex_header, 16);
+
+        // Line mode never writes match records
+        const max_results: u32 = if (line_mode) 1 else MAX_RESULTS;
+        const results_buffer = try self.pooledBuffer(.results, @sizeOf(mod.PackedMatch) * max_results);
+        const counters_buffer = try self.pooledBuffer(.counters, 8);
+
+        // The line table is built on the device from the text just uploaded
+        const line_index = try self.countLines(text_buffer, text);
+        const num_lines = line_index.num_lines;
+        const line_bitmap_buffer = try self.lineBitmap(if (line_mode) num_lines else 0);
+
+        // RegexState is already the shader's 12-byte record (u8 fields at fixed
+        // byte offsets), so states upload as-is for both word and byte views
+        comptime std.debug.assert(@sizeOf(mod.RegexState) == 3 * @sizeOf(u32));
+        const state_bytes = std.mem.sliceAsBytes(gpu_regex.states);
+        @memcpy(@as([*]u8, @ptrCast(states_buffer.mapped))[0..state_bytes.len], state_bytes);
 
         // Upload bitmaps
         if (gpu_regex.bitmaps.len > 0) {
@@ -595,8 +1271,9 @@ pub const VulkanSubstituter = struct {
             .start_state = gpu_regex.header.start_state,
             .header_flags = gpu_regex.header.flags,
             .num_bitmaps = @intCast(gpu_regex.bitmaps.len),
-            .max_results = MAX_RESULTS,
-            .flags = 0,
+            .max_results = max_results,
+            .flags = if (line_mode) RegexSearchConfig.FLAG_LINE_MODE else 0,
+            .num_lines = num_lines,
         };
 
         // Upload header
@@ -606,114 +1283,253 @@ pub const VulkanSubstituter = struct {
         header_ptr[2] = gpu_regex.header.num_groups;
         header_ptr[3] = gpu_regex.header.flags;
 
-        // Upload line data
-        @memcpy(@as([*]u32, @ptrCast(@alignCast(line_offsets_buffer.mapped)))[0..num_lines], line_offsets_slice);
-        @memcpy(@as([*]u32, @ptrCast(@alignCast(line_lengths_buffer.mapped)))[0..num_lines], line_lengths_slice);
-
         // Zero counters
-        const counters_ptr: *[2]u32 = @ptrCast(@alignCast(counters_buffer.mapped));
-        counters_ptr[0] = 0;
-        counters_ptr[1] = 0;
-
-        // Create temporary descriptor pool for regex pipeline (9 descriptors)
-        const regex_pool = self.vkd.createDescriptorPool(self.device, &.{
-            .max_sets = 1,
-            .pool_size_count = 1,
-            .p_pool_sizes = @ptrCast(&vk.DescriptorPoolSize{
-                .type = .storage_buffer,
-                .descriptor_count = 9,
-            }),
-        }, null) catch return error.DescriptorPoolCreationFailed;
-        defer self.vkd.destroyDescriptorPool(self.device, regex_pool, null);
-
-        var descriptor_set: vk.DescriptorSet = undefined;
-        self.vkd.allocateDescriptorSets(self.device, &.{
-            .descriptor_pool = regex_pool,
-            .descriptor_set_count = 1,
-            .p_set_layouts = @ptrCast(&self.regex_descriptor_set_layout),
-        }, @ptrCast(&descriptor_set)) catch return error.DescriptorSetAllocationFailed;
-
-        const buffer_infos = [_]vk.DescriptorBufferInfo{
-            .{ .buffer = text_buffer.buffer, .offset = 0, .range = text_size },
-            .{ .buffer = states_buffer.buffer, .offset = 0, .range = @max(states_size, 16) },
-            .{ .buffer = bitmaps_buffer.buffer, .offset = 0, .range = bitmaps_size },
-            .{ .buffer = config_buffer.buffer, .offset = 0, .range = @sizeOf(RegexSearchConfig) },
-            .{ .buffer = header_buffer.buffer, .offset = 0, .range = 16 },
-            .{ .buffer = results_buffer.buffer, .offset = 0, .range = results_size },
-            .{ .buffer = counters_buffer.buffer, .offset = 0, .range = 8 },
-            .{ .buffer = line_offsets_buffer.buffer, .offset = 0, .range = line_offsets_size },
-            .{ .buffer = line_lengths_buffer.buffer, .offset = 0, .range = line_offsets_size },
-        };
+        @as(*[2]u32, @ptrCast(@alignCast(counters_buffer.mapped))).* = .{ 0, 0 };
 
-        var writes: [9]vk.WriteDescriptorSet = undefined;
-        for (0..9) |i| {
-            writes[i] = .{
-                .dst_set = descriptor_set,
-                .dst_binding = @intCast(i),
-                .dst_array_element = 0,
-                .descriptor_count = 1,
-                .descriptor_type = .storage_buffer,
-                .p_image_info = undefined,
-                .p_buffer_info = @ptrCast(&buffer_infos[i]),
-                .p_texel_buffer_view = undefined,
-            };
+        // One regex thread per line
+        const workgroup_size = self.kernel_config.regex_workgroup_size;
+        self.setDispatch(.regex, @max(1, (num_lines + workgroup_size - 1) / workgroup_size));
+
+        // Build the line table, then run the regex kernel over it
+        if (try self.beginChain(.regex, text_buffer)) |command_buffer| {
+            self.recordLineIndexBuild(command_buffer, &line_index);
+            self.splitChain(command_buffer, .regex);
+            self.vkd.cmdBindPipeline(command_buffer, .compute, self.regex_compute_pipeline);
+            self.bindBuffers(command_buffer, .regex, &.{
+                text_buffer,
+                states_buffer,
+                bitmaps_buffer,
+                config_buffer,
+                header_buffer,
+                results_buffer,
+                counters_buffer,
+                line_index.offsets,
+                line_index.lengths,
+                line_bitmap_buffer,
+            });
+            self.dispatchIndirect(command_buffer, .regex);
+            try self.endChain(.regex);
         }
-        self.vkd.updateDescriptorSets(self.device, 9, &writes, 0, undefined);
+        try self.submitChain(.regex);
 
-        // Allocate and record command buffer
-        var command_buffer: vk.CommandBuffer = undefined;
-        self.vkd.allocateCommandBuffers(self.device, &.{
-            .command_pool = self.command_pool,
-            .level = .primary,
-            .command_buffer_count = 1,
-        }, @ptrCast(&command_buffer)) catch return error.CommandBufferAllocationFailed;
-        defer self.vkd.freeCommandBuffers(self.device, self.command_pool, 1, @ptrCast(&command_buffer));
+        defer self.markPhase(.readback);
+        if (line_mode) return .{ .selection = try readLineBitmap(line_bitmap_buffer, num_lines, result_allocator) };
+        return .{ .matches = try readMatches(results_buffer, counters_buffer, result_allocator) };
+    }
 
-        self.vkd.beginCommandBuffer(command_buffer, &.{ .flags = .{ .one_time_submit_bit = true } }) catch return error.CommandBufferBeginFailed;
-        self.vkd.cmdBindPipeline(command_buffer, .compute, self.regex_compute_pipeline);
-        self.vkd.cmdBindDescriptorSets(command_buffer, .compute, self.regex_pipeline_layout, 0, 1, @ptrCast(&descriptor_set), 0, undefined);
+    /// GPU-accelerated regex pattern matching (Vulkan Thompson NFA)
+    pub fn findMatchesRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !SubstituteResult {
+        const matches = try self.searchRegex(text, pattern, options, result_allocator);
+        defer result_allocator.free(matches.items);
+        return collectMatches(text, matches, false, result_allocator);
+    }
 
-        // Dispatch one thread per line (local_size_x = 64 in shader)
-        const workgroups = @max(1, (num_lines + 63) / 64);
-        self.vkd.cmdDispatch(command_buffer, @intCast(workgroups), 1, 1);
-        self.vkd.endCommandBuffer(command_buffer) catch return error.CommandBufferEndFailed;
+    /// Regex counterpart of forEachMatch
+    pub fn forEachMatchRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), MatchResult) anyerror!void) !u64 {
+        const matches = try self.searchRegex(text, pattern, options, result_allocator);
+        defer result_allocator.free(matches.items);
+        return emitMatches(text, matches, false, context, onMatch);
+    }
 
-        // Submit and wait
-        self.vkd.queueSubmit(self.compute_queue, 1, @ptrCast(&vk.SubmitInfo{
-            .wait_semaphore_count = 0,
-            .p_wait_semaphores = undefined,
-            .p_wait_dst_stage_mask = undefined,
-            .command_buffer_count = 1,
-            .p_command_buffers = @ptrCast(&command_buffer),
-            .signal_semaphore_count = 0,
-            .p_signal_semaphores = undefined,
-        }), self.fence) catch return error.QueueSubmitFailed;
-        _ = self.vkd.waitForFences(self.device, 1, @ptrCast(&self.fence), .true, std.math.maxInt(u64)) catch return error.FenceWaitFailed;
-        self.vkd.resetFences(self.device, 1, @ptrCast(&self.fence)) catch return error.FenceResetFailed;
+    fn searchRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !PackedMatches {
+        if (text.len == 0) return .none;
+        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
 
-        // Read results
-        const result_count = counters_ptr[0];
-        const total_matches: u64 = counters_ptr[1];
+        return (try self.dispatchRegex(text, pattern, options, false, result_allocator)).matches;
+    }
 
-        const num_to_copy = @min(result_count, MAX_RESULTS);
-        const matches = try result_allocator.alloc(MatchResult, num_to_copy);
-        if (num_to_copy > 0) {
-            @memcpy(matches, @as([*]MatchResult, @ptrCast(@alignCast(results_buffer.mapped)))[0..num_to_copy]);
+    /// Select the lines matching a regex (for d and p), one GPU thread per line
+    pub fn selectLinesRegex(self: *Self, text: []const u8, pattern: []const u8, options: SubstituteOptions, result_allocator: std.mem.Allocator) !mod.LineSelection {
+        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+        if (text.len == 0) return mod.LineSelection.init(result_allocator, 0);
+
+        return (try self.dispatchRegex(text, pattern, options, true, result_allocator)).selection;
+    }
+
+    /// Apply a y/// byte map to text in place: one upload, one dispatch, one readback
+    /// (none of either when the text is imported)
+    pub fn transliterate(self: *Self, text: []u8, table: *const [256]u8) !void {
+        if (text.len == 0) return;
+        if (text.len > MAX_GPU_BUFFER_SIZE) return error.TextTooLarge;
+
+        self.phase_timer.reset();
+        const text_buffer = try self.uploadText(text, true);
+        defer self.releaseImportedText();
+        self.markPhase(.upload);
+        // 256 map entries, then the word count (the binding spans the whole pooled buffer)
+        const table_buffer = try self.pooledBuffer(.table, 257 * @sizeOf(u32));
+        const table_ptr: *[257]u32 = @ptrCast(@alignCast(table_buffer.mapped));
+        for (table_ptr[0..256], table) |*entry, byte| entry.* = byte;
+        const num_words: usize = @intCast(text_buffer.size / 4);
+        table_ptr[256] = @intCast(num_words);
+
+        // One word per thread, capped so very large inputs use a grid-stride loop
+        self.setDispatch(.transliterate, @min(@max(1, (num_words + 255) / 256), 4096));
+
+        if (try self.beginChain(.transliterate, text_buffer)) |command_buffer| {
+            self.splitChain(command_buffer, .transliterate);
+            self.vkd.cmdBindPipeline(command_buffer, .compute, self.transliterate_compute_pipeline);
+            self.bindBuffers(command_buffer, .transliterate, &.{ text_buffer, table_buffer });
+            self.dispatchIndirect(command_buffer, .transliterate);
+            try self.endChain(.transliterate);
         }
+        try self.submitChain(.transliterate);
 
-        return SubstituteResult{ .matches = matches, .total_matches = total_matches, .allocator = result_allocator };
+        // An imported buffer was rewritten in place
+        if (text_buffer.mapped) |mapped| @memcpy(text, @as([*]const u8, @ptrCast(mapped))[0..text.len]);
+        self.markPhase(.readback);
     }
 
     pub fn getCapabilities(self: *Self) mod.GpuCapabilities {
         return self.capabilities;
     }
+
+    /// Host and device time spent by this substituter so far
+    pub fn getTimings(self: *Self) mod.GpuTimings {
+        return self.timings;
+    }
+
+    pub fn getKernelConfig(self: *Self) mod.KernelConfig {
+        return self.kernel_config;
+    }
+
+    /// Rebuild the literal and regex pipelines with a new launch shape
+    pub fn setKernelConfig(self: *Self, config: mod.KernelConfig) !void {
+        const literal = try createSpecializedPipeline(self.vkd, self.device, self.shader_module, self.pipeline_layout, &.{ config.literal_workgroup_size, config.literal_tile_bytes });
+        errdefer self.vkd.destroyPipeline(self.device, literal, null);
+        const regex = try createSpecializedPipeline(self.vkd, self.device, self.regex_shader_module, self.regex_pipeline_layout, &.{config.regex_workgroup_size});
+
+        self.vkd.destroyPipeline(self.device, self.compute_pipeline, null);
+        self.vkd.destroyPipeline(self.device, self.regex_compute_pipeline, null);
+        self.compute_pipeline = literal;
+        self.regex_compute_pipeline = regex;
+        self.kernel_config = config;
+        // Recorded chains bind the old pipelines
+        self.invalidateBindings();
+    }
+
+    /// Time every candidate shape from the autotune grid on `corpus` (from
+    /// autotune.buildCorpus), keep the fastest literal and regex shapes that
+    /// find the reference match counts, and store them for this device
+    pub fn tuneKernels(self: *Self, corpus: []const u8, reference: autotune.Reference) !mod.KernelConfig {
+        const original = self.kernel_config;
+        errdefer self.setKernelConfig(original) catch {};
+
+        var best = self.kernel_config;
+        var best_ns: u64 = std.math.maxInt(u64);
+        for (autotune.literal_workgroup_sizes) |workgroup_size| {
+            for (autotune.literal_bytes_per_thread) |bytes_per_thread| {
+                var candidate = best;
+                candidate.literal_workgroup_size = workgroup_size;
+                candidate.literal_tile_bytes = workgroup_size * bytes_per_thread;
+                if (!autotune.isValid(candidate, self.tune_limits)) continue;
+
+                try self.setKernelConfig(candidate);
+                const ns = try self.timeKernel(corpus, false, reference.literal_matches) orelse continue;
+                if (ns < best_ns) {
+                    best_ns = ns;
+                    best = candidate;
+                }
+            }
+        }
+        if (best_ns == std.math.maxInt(u64)) return error.NoWorkingKernelShape;
+
+        best_ns = std.math.maxInt(u64);
+        const literal_best = best;
+        for (autotune.regex_workgroup_sizes) |workgroup_size| {
+            var candidate = literal_best;
+            candidate.regex_workgroup_size = workgroup_size;
+            if (!autotune.isValid(candidate, self.tune_limits)) continue;
+
+            try self.setKernelConfig(candidate);
+            const ns = try self.timeKernel(corpus, true, reference.regex_matches) orelse continue;
+            if (ns < best_ns) {
+                best_ns = ns;
+                best = candidate;
+            }
+        }
+        if (best_ns == std.math.maxInt(u64)) return error.NoWorkingKernelShape;
+
+        try self.setKernelConfig(best);
+        try autotune.store(self.allocator, self.pipeline_cache_uuid, best);
+        return best;
+    }
+
+    /// Best-of-RUNS kernel time for one search: device timestamps when the queue
+    /// has them, otherwise submit-to-fence. Null when the current shape finds
+    /// other than `expected_matches`.
+    fn timeKernel(self: *Self, corpus: []const u8, regex: bool, expected_matches: u64) !?u64 {
+        const options = SubstituteOptions{ .global = true };
+        var best: u64 = std.math.maxInt(u64);
+        for (0..autotune.RUNS) |_| {
+            const before = self.timings;
+            var result = if (regex)
+                try self.findMatchesRegex(corpus, autotune.REGEX_PATTERN, options, self.allocator)
+            else
+                try self.findMatches(corpus, autotune.LITERAL_PATTERN, options, self.allocator);
+            const total_matches = result.total_matches;
+            result.deinit();
+            if (total_matches != expected_matches) return null;
+
+            const ns = if (self.query_pool != .null_handle)
+                (self.timings.line_index_ns - before.line_index_ns) + (self.timings.kernel_ns - before.kernel_ns)
+            else
+                self.timings.submit_ns - before.submit_ns;
+            best = @min(best, ns);
+        }
+        return best;
+    }
 };
 
+const push_descriptor_extension = "VK_KHR_push_descriptor";
+const external_memory_host_extension = "VK_EXT_external_memory_host";
+
+fn hasDeviceExtension(vki: vk.InstanceWrapper, physical_device: vk.PhysicalDevice, allocator: std.mem.Allocator, name: []const u8) bool {
+    var count: u32 = 0;
+    _ = vki.enumerateDeviceExtensionProperties(physical_device, null, &count, null) catch return false;
+    const extensions = allocator.alloc(vk.ExtensionProperties, count) catch return false;
+    defer allocator.free(extensions);
+    _ = vki.enumerateDeviceExtensionProperties(physical_device, null, &count, extensions.ptr) catch return false;
+    for (extensions[0..count]) |ext| {
+        if (std.mem.eql(u8, std.mem.sliceTo(&ext.extension_name, 0), name)) return true;
+    }
+    return false;
+}
+
+/// Compute pipeline whose specialization constants 0..n are `constants`
+fn createSpecializedPipeline(vkd: vk.DeviceWrapper, device: vk.Device, module: vk.ShaderModule, layout: vk.PipelineLayout, constants: []const u32) !vk.Pipeline {
+    var entries: [4]vk.SpecializationMapEntry = undefined;
+    for (entries[0..constants.len], 0..) |*entry, i| {
+        entry.* = .{ .constant_id = @intCast(i), .offset = @intCast(i * @sizeOf(u32)), .size = @sizeOf(u32) };
+    }
+    const specialization = vk.SpecializationInfo{
+        .map_entry_count = @intCast(constants.len),
+        .p_map_entries = &entries,
+        .data_size = constants.len * @sizeOf(u32),
+        .p_data = constants.ptr,
+    };
+
+    var pipeline: vk.Pipeline = undefined;
+    _ = vkd.createComputePipelines(device, .null_handle, 1, @ptrCast(&vk.ComputePipelineCreateInfo{
+        .stage = .{ .stage = .{ .compute_bit = true }, .module = module, .p_name = "main", .p_specialization_info = &specialization },
+        .layout = layout,
+        .base_pipeline_handle = .null_handle,
+        .base_pipeline_index = -1,
+    }), null, @ptrCast(&pipeline)) catch return error.ComputePipelineCreationFailed;
+    return pipeline;
+}
+
+/// Pick a shader build from { base, subgroup, 8-bit, subgroup + 8-bit }
+fn shaderVariant(variants: [4][]const u8, subgroup_ops: bool, storage_8bit: bool) []const u8 {
+    return variants[@as(usize, @intFromBool(subgroup_ops)) | (@as(usize, @intFromBool(storage_8bit)) << 1)];
+}
+
 fn findMemoryType(mem_props: *const vk.PhysicalDeviceMemoryProperties, type_filter: u32, properties: vk.MemoryPropertyFlags) ?u32 {
     for (0..mem_props.memory_type_count) |i| {
         const idx: u5 = @intCast(i);
         if ((type_filter & (@as(u32, 1) << idx)) != 0) {
             const mem_type = mem_props.memory_types[i];
+            if (properties.device_local_bit and !mem_type.property_flags.device_local_bit) continue;
             if (mem_type.property_flags.host_visible_bit == properties.host_visible_bit and mem_type.property_flags.host_coherent_bit == properties.host_coherent_bit) return @intCast(i);
         }
     }
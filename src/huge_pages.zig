@@ -0,0 +1,236 @@
+const std = @import("std");
+const builtin = @import("builtin");
+
+// Large buffers (input text, flattened command output, match arrays, spill
+// chunks) get their own anonymous mappings backed by 2 MB pages: a 64 MB
+// buffer then costs 32 page faults and TLB entries instead of 16384. When a
+// buffer is freed its mapping is kept and handed to the next buffer that
+// fits, so later files of a multi-file run scan pages that are already
+// faulted in. Smaller allocations go to the backing allocator untouched.
+
+pub const HUGE_PAGE_SIZE: usize = 2 * 1024 * 1024;
+
+/// Smallest allocation given its own mapping (one huge page)
+pub const MIN_MAPPED_SIZE: usize = HUGE_PAGE_SIZE;
+
+/// Default cap on freed mappings kept for reuse
+pub const DEFAULT_CACHE_BYTES: usize = 256 * 1024 * 1024;
+
+const MAX_CACHED_REGIONS = 16;
+
+const page_align = std.heap.page_size_min;
+
+pub const Mode = enum {
+    /// Everything from the backing allocator
+    off,
+    /// Transparent huge pages requested with MADV_HUGEPAGE (the default)
+    madvise,
+    /// Reserved huge pages (MAP_HUGETLB); madvise when none are free
+    hugetlb,
+};
+
+pub const Stats = struct {
+    /// Fresh mappings made
+    mapped: usize = 0,
+    /// Buffers served from a kept mapping
+    reused: usize = 0,
+    /// Fresh mappings backed by reserved huge pages
+    hugetlb: usize = 0,
+};
+
+const Region = struct {
+    ptr: [*]align(page_align) u8,
+    capacity: usize,
+
+    fn slice(self: Region) []align(page_align) u8 {
+        return self.ptr[0..self.capacity];
+    }
+};
+
+/// Page faults taken by the process so far
+pub const PageFaults = struct {
+    minor: u64,
+    major: u64,
+
+    pub fn sample() PageFaults {
+        const usage = std.posix.getrusage(std.posix.rusage.SELF);
+        return .{ .minor = @intCast(usage.minflt), .major = @intCast(usage.majflt) };
+    }
+};
+
+pub const LargePageAllocator = struct {
+    backing: std.mem.Allocator,
+    mode: Mode,
+    max_cached_bytes: usize = DEFAULT_CACHE_BYTES,
+    /// Mappings handed out, so free and resize can tell them from backing memory
+    live: std.ArrayListUnmanaged(Region) = .{},
+    /// Mappings whose buffers were freed, kept warm for reuse
+    cache: [MAX_CACHED_REGIONS]Region = undefined,
+    cached_len: usize = 0,
+    cached_bytes: usize = 0,
+    stats: Stats = .{},
+    // Decompression workers allocate from several threads
+    mutex: std.Thread.Mutex = .{},
+
+    pub fn init(backing: std.mem.Allocator, mode: Mode) LargePageAllocator {
+        return .{ .backing = backing, .mode = mode };
+    }
+
+    /// Unmap the kept mappings (and any buffer still live)
+    pub fn deinit(self: *LargePageAllocator) void {
+        for (self.cache[0..self.cached_len]) |region| std.posix.munmap(region.slice());
+        for (self.live.items) |region| std.posix.munmap(region.slice());
+        self.live.deinit(self.backing);
+        self.* = undefined;
+    }
+
+    pub fn allocator(self: *LargePageAllocator) std.mem.Allocator {
+        if (self.mode == .off) return self.backing;
+        return .{ .ptr = self, .vtable = &.{
+            .alloc = alloc,
+            .resize = resize,
+            .remap = remap,
+            .free = free,
+        } };
+    }
+
+    fn alloc(ctx: *anyopaque, len: usize, alignment: std.mem.Alignment, ret_addr: usize) ?[*]u8 {
+        const self: *LargePageAllocator = @ptrCast(@alignCast(ctx));
+        if (len < MIN_MAPPED_SIZE or alignment.toByteUnits() > HUGE_PAGE_SIZE) {
+            return self.backing.rawAlloc(len, alignment, ret_addr);
+        }
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.live.ensureUnusedCapacity(self.backing, 1) catch return null;
+        const region = self.takeCached(len) orelse self.map(len) orelse return null;
+        self.live.appendAssumeCapacity(region);
+        return region.ptr;
+    }
+
+    fn resize(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) bool {
+        const self: *LargePageAllocator = @ptrCast(@alignCast(ctx));
+        if (self.liveCapacity(memory.ptr)) |capacity| return new_len <= capacity;
+        // Backing memory that grows past the threshold moves into a mapping
+        if (new_len >= MIN_MAPPED_SIZE) return false;
+        return self.backing.rawResize(memory, alignment, new_len, ret_addr);
+    }
+
+    fn remap(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) ?[*]u8 {
+        const self: *LargePageAllocator = @ptrCast(@alignCast(ctx));
+        if (self.liveCapacity(memory.ptr)) |capacity| return if (new_len <= capacity) memory.ptr else null;
+        if (new_len >= MIN_MAPPED_SIZE) return null;
+        return self.backing.rawRemap(memory, alignment, new_len, ret_addr);
+    }
+
+    fn free(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, ret_addr: usize) void {
+        const self: *LargePageAllocator = @ptrCast(@alignCast(ctx));
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        const index = self.findLive(memory.ptr) orelse return self.backing.rawFree(memory, alignment, ret_addr);
+        const region = self.live.swapRemove(index);
+        if (self.cached_len < MAX_CACHED_REGIONS and self.cached_bytes + region.capacity <= self.max_cached_bytes) {
+            self.cache[self.cached_len] = region;
+            self.cached_len += 1;
+            self.cached_bytes += region.capacity;
+        } else {
+            std.posix.munmap(region.slice());
+        }
+    }
+
+    /// Size of the mapping behind a live buffer; null for backing memory
+    fn liveCapacity(self: *LargePageAllocator, ptr: [*]u8) ?usize {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        const index = self.findLive(ptr) orelse return null;
+        return self.live.items[index].capacity;
+    }
+
+    fn findLive(self: *const LargePageAllocator, ptr: [*]u8) ?usize {
+        for (self.live.items, 0..) |region, index| {
+            if (@intFromPtr(region.ptr) == @intFromPtr(ptr)) return index;
+        }
+        return null;
+    }
+
+    /// Smallest kept mapping that holds `len` bytes
+    fn takeCached(self: *LargePageAllocator, len: usize) ?Region {
+        var best: ?usize = null;
+        for (self.cache[0..self.cached_len], 0..) |region, index| {
+            if (region.capacity < len) continue;
+            if (best == null or region.capacity < self.cache[best.?].capacity) best = index;
+        }
+        const index = best orelse return null;
+        const region = self.cache[index];
+        self.cached_len -= 1;
+        self.cache[index] = self.cache[self.cached_len];
+        self.cached_bytes -= region.capacity;
+        self.stats.reused += 1;
+        return region;
+    }
+
+    /// A fresh mapping of whole huge pages
+    fn map(self: *LargePageAllocator, len: usize) ?Region {
+        const capacity = std.mem.alignForward(usize, len, HUGE_PAGE_SIZE);
+        // MAP_HUGETLB is Linux-only
+        if (builtin.os.tag == .linux) {
+            if (self.mode == .hugetlb) {
+                const flags: std.posix.MAP = .{ .TYPE = .PRIVATE, .ANONYMOUS = true, .HUGETLB = true };
+                if (std.posix.mmap(null, capacity, std.posix.PROT.READ | std.posix.PROT.WRITE, flags, -1, 0)) |memory| {
+                    self.stats.mapped += 1;
+                    self.stats.hugetlb += 1;
+                    return .{ .ptr = memory.ptr, .capacity = capacity };
+                } else |_| {}
+            }
+        }
+
+        // Over-map by one huge page and trim, so the region starts on a huge
+        // page boundary and every page of it can be backed by a huge page
+        const span = std.posix.mmap(null, capacity + HUGE_PAGE_SIZE, std.posix.PROT.READ | std.posix.PROT.WRITE, .{ .TYPE = .PRIVATE, .ANONYMOUS = true }, -1, 0) catch return null;
+        const start = std.mem.alignForward(usize, @intFromPtr(span.ptr), HUGE_PAGE_SIZE);
+        const head = start - @intFromPtr(span.ptr);
+        if (head > 0) std.posix.munmap(span[0..head]);
+        const tail = span[head + capacity ..];
+        if (tail.len > 0) std.posix.munmap(@alignCast(tail));
+
+        const region = Region{ .ptr = @ptrFromInt(start), .capacity = capacity };
+        if (builtin.os.tag == .linux) std.posix.madvise(region.ptr, capacity, std.posix.MADV.HUGEPAGE) catch {};
+        self.stats.mapped += 1;
+        return region;
+    }
+};
+
+test "freed mappings are reused and small allocations pass through" {
+    var pages = LargePageAllocator.init(std.testing.allocator, .madvise);
+    defer pages.deinit();
+    const gpa = pages.allocator();
+
+    const big = try gpa.alloc(u8, MIN_MAPPED_SIZE + 1);
+    try std.testing.expect(std.mem.isAligned(@intFromPtr(big.ptr), HUGE_PAGE_SIZE));
+    @memset(big, 'x');
+    gpa.free(big);
+
+    // Fits the kept two-page mapping
+    const again = try gpa.alloc(u8, MIN_MAPPED_SIZE);
+    defer gpa.free(again);
+    try std.testing.expectEqual(@as(usize, 1), pages.stats.mapped);
+    try std.testing.expectEqual(@as(usize, 1), pages.stats.reused);
+
+    const small = try gpa.alloc(u8, 64);
+    defer gpa.free(small);
+    try std.testing.expectEqual(@as(usize, 1), pages.live.items.len);
+}
+
+test "buffers grow out of the backing allocator into a mapping" {
+    var pages = LargePageAllocator.init(std.testing.allocator, .madvise);
+    defer pages.deinit();
+    const gpa = pages.allocator();
+
+    var list: std.ArrayListUnmanaged(u8) = .{};
+    defer list.deinit(gpa);
+    try list.appendNTimes(gpa, 'a', 1024);
+    try list.appendNTimes(gpa, 'b', MIN_MAPPED_SIZE);
+    try std.testing.expectEqual(@as(usize, 1), pages.live.items.len);
+    try std.testing.expectEqual(@as(u8, 'a'), list.items[1023]);
+    try std.testing.expectEqual(@as(u8, 'b'), list.items[list.items.len - 1]);
+}
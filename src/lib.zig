@@ -0,0 +1,153 @@
+const std = @import("std");
+const script = @import("script.zig");
+
+// C ABI over script.Script for embedding (include/sed.h). Handles are
+// immutable after sed_compile, so any number of threads may sed_run the same
+// handle at once.
+
+const allocator = std.heap.c_allocator;
+
+pub const SED_OK: c_int = 0;
+pub const SED_EINVAL: c_int = 1; // Bad argument or expression
+pub const SED_ENOMEM: c_int = 2;
+pub const SED_EWRITE: c_int = 3; // Output callback returned non-zero
+pub const SED_EINTERNAL: c_int = 4;
+
+pub const SED_EXTENDED: c_uint = 1; // -E
+pub const SED_QUIET: c_uint = 2; // -n
+
+const WriteFn = *const fn (context: ?*anyopaque, data: [*]const u8, len: usize) callconv(.c) c_int;
+
+const Output = struct {
+    write: WriteFn,
+    context: ?*anyopaque,
+
+    fn emit(self: Output, bytes: []const u8) anyerror!void {
+        if (bytes.len == 0) return;
+        if (self.write(self.context, bytes.ptr, bytes.len) != 0) return error.WriteFailed;
+    }
+};
+
+fn errorCode(err: anyerror) c_int {
+    return switch (err) {
+        error.OutOfMemory => SED_ENOMEM,
+        error.InvalidExpression => SED_EINVAL,
+        error.WriteFailed => SED_EWRITE,
+        else => SED_EINTERNAL,
+    };
+}
+
+export fn sed_compile(expressions: ?[*]const ?[*:0]const u8, count: usize, flags: c_uint, out: ?*?*script.Script) c_int {
+    const result = out orelse return SED_EINVAL;
+    result.* = null;
+    const exprs = expressions orelse return SED_EINVAL;
+    if (count == 0) return SED_EINVAL;
+
+    const slices = allocator.alloc([]const u8, count) catch return SED_ENOMEM;
+    defer allocator.free(slices);
+    for (slices, exprs[0..count]) |*slice, expr| slice.* = std.mem.span(expr orelse return SED_EINVAL);
+
+    const handle = allocator.create(script.Script) catch return SED_ENOMEM;
+    handle.* = script.Script.compile(allocator, slices, .{
+        .extended = flags & SED_EXTENDED != 0,
+        .quiet = flags & SED_QUIET != 0,
+    }) catch |err| {
+        allocator.destroy(handle);
+        return errorCode(err);
+    };
+    result.* = handle;
+    return SED_OK;
+}
+
+export fn sed_run(handle: ?*const script.Script, input: ?[*]const u8, len: usize, write: ?WriteFn, context: ?*anyopaque) c_int {
+    const compiled = handle orelse return SED_EINVAL;
+    const output = Output{ .write = write orelse return SED_EINVAL, .context = context };
+    const text: []const u8 = if (len == 0) "" else (input orelse return SED_EINVAL)[0..len];
+
+    compiled.run(allocator, text, output, Output.emit) catch |err| return errorCode(err);
+    return SED_OK;
+}
+
+export fn sed_free(handle: ?*script.Script) void {
+    const compiled = handle orelse return;
+    compiled.deinit();
+    allocator.destroy(compiled);
+}
+
+export fn sed_strerror(code: c_int) [*:0]const u8 {
+    return switch (code) {
+        SED_OK => "success",
+        SED_EINVAL => "invalid argument or expression",
+        SED_ENOMEM => "out of memory",
+        SED_EWRITE => "output callback failed",
+        else => "internal error",
+    };
+}
+
+/// Test output callback: collects what a run writes, or fails every write
+const Collected = struct {
+    bytes: std.ArrayListUnmanaged(u8) = .{},
+    fail: bool = false,
+
+    fn write(context: ?*anyopaque, data: [*]const u8, len: usize) callconv(.c) c_int {
+        const self: *Collected = @ptrCast(@alignCast(context.?));
+        if (self.fail) return 1;
+        self.bytes.appendSlice(std.testing.allocator, data[0..len]) catch return 1;
+        return 0;
+    }
+};
+
+test "sed_compile rejects bad arguments and expressions" {
+    const good = [_]?[*:0]const u8{"s/a/b/"};
+    var handle: ?*script.Script = undefined;
+    try std.testing.expectEqual(SED_EINVAL, sed_compile(&good, good.len, 0, null));
+    try std.testing.expectEqual(SED_EINVAL, sed_compile(null, 1, 0, &handle));
+    try std.testing.expect(handle == null);
+    try std.testing.expectEqual(SED_EINVAL, sed_compile(&good, 0, 0, &handle));
+
+    const missing = [_]?[*:0]const u8{ "s/a/b/", null };
+    try std.testing.expectEqual(SED_EINVAL, sed_compile(&missing, missing.len, 0, &handle));
+    const unknown = [_]?[*:0]const u8{ "s/a/b/", "k" };
+    try std.testing.expectEqual(SED_EINVAL, sed_compile(&unknown, unknown.len, 0, &handle));
+    try std.testing.expect(handle == null);
+    try std.testing.expectEqualStrings("invalid argument or expression", std.mem.span(sed_strerror(SED_EINVAL)));
+}
+
+test "sed_run writes through the callback and reports its failure" {
+    const exprs = [_]?[*:0]const u8{ "s/a/b/g", "/x/d" };
+    var handle: ?*script.Script = null;
+    try std.testing.expectEqual(SED_OK, sed_compile(&exprs, exprs.len, 0, &handle));
+    defer sed_free(handle);
+
+    var out = Collected{};
+    defer out.bytes.deinit(std.testing.allocator);
+    const input = "aa\nxa\nba\n";
+    try std.testing.expectEqual(SED_OK, sed_run(handle, input.ptr, input.len, &Collected.write, &out));
+    try std.testing.expectEqualStrings("bb\nbb\n", out.bytes.items);
+
+    // Empty input needs no buffer and writes nothing
+    out.bytes.clearRetainingCapacity();
+    try std.testing.expectEqual(SED_OK, sed_run(handle, null, 0, &Collected.write, &out));
+    try std.testing.expectEqual(@as(usize, 0), out.bytes.items.len);
+
+    try std.testing.expectEqual(SED_EINVAL, sed_run(null, input.ptr, input.len, &Collected.write, &out));
+    try std.testing.expectEqual(SED_EINVAL, sed_run(handle, null, input.len, &Collected.write, &out));
+    try std.testing.expectEqual(SED_EINVAL, sed_run(handle, input.ptr, input.len, null, &out));
+    out.fail = true;
+    try std.testing.expectEqual(SED_EWRITE, sed_run(handle, input.ptr, input.len, &Collected.write, &out));
+}
+
+test "sed_run under SED_QUIET writes only printed lines; sed_free takes null" {
+    const exprs = [_]?[*:0]const u8{"/err/p"};
+    var handle: ?*script.Script = null;
+    try std.testing.expectEqual(SED_OK, sed_compile(&exprs, exprs.len, SED_QUIET, &handle));
+
+    var out = Collected{};
+    defer out.bytes.deinit(std.testing.allocator);
+    const input = "ok\nerr 1\nerr 2\nok\n";
+    try std.testing.expectEqual(SED_OK, sed_run(handle, input.ptr, input.len, &Collected.write, &out));
+    try std.testing.expectEqualStrings("err 1\nerr 2\n", out.bytes.items);
+
+    sed_free(handle);
+    sed_free(null);
+}
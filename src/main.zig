@@ -1,8 +1,19 @@
 const std = @import("std");
+const builtin = @import("builtin");
 const build_options = @import("build_options");
 const gpu = @import("gpu");
 const cpu = @import("cpu");
 const cpu_gnu = @import("cpu_gnu");
+const output_sink = @import("output_sink.zig");
+const batch = @import("batch.zig");
+const server = @import("server.zig");
+const script = @import("script.zig");
+const script_artifact = @import("script_artifact.zig");
+const compressed = @import("compressed.zig");
+const piece_table = @import("piece_table.zig");
+const memory_budget = @import("memory_budget.zig");
+const huge_pages = @import("huge_pages.zig");
+const result_cache = @import("result_cache.zig");
 
 const SubstituteOptions = gpu.SubstituteOptions;
 
@@ -16,86 +27,65 @@ const BackendMode = enum {
     vulkan,
 };
 
-/// Sed command type
-const CommandType = enum {
-    substitute, // s/pattern/replacement/flags
-    delete, // /pattern/d
-    print, // /pattern/p
-    transliterate, // y/source/dest/
-};
+const CommandType = script.CommandType;
+const Address = script.Address;
+const SedCommand = script.SedCommand;
+const parseSedExpression = script.parseSedExpression;
+const processReplacement = script.processReplacement;
+const needsRegex = script.needsRegex;
+const doFindMatches = script.doFindMatches;
+const LineSpan = script.LineSpan;
+const SubstitutePieces = script.SubstitutePieces;
+const PieceTable = piece_table.PieceTable;
 
-/// Line address for sed commands
-const Address = struct {
-    start: ?u32 = null, // null means beginning or not specified
-    end: ?u32 = null, // null means same as start (single line) or end of file
-    is_last_line: bool = false, // $ address
-    end_is_last: bool = false, // $ as end of range
+pub fn main() !void {
+    // Leak checking in debug builds; release builds skip the debug allocator's
+    // bookkeeping, which otherwise shows up in the startup of tiny invocations
+    var debug_allocator: std.heap.DebugAllocator(.{}) = .init;
+    const allocator, const is_debug = switch (builtin.mode) {
+        .Debug, .ReleaseSafe => .{ debug_allocator.allocator(), true },
+        .ReleaseFast, .ReleaseSmall => .{ std.heap.smp_allocator, false },
+    };
+    defer if (is_debug) {
+        _ = debug_allocator.deinit();
+    };
 
-    /// Check if a line number matches this address (line_num is 1-indexed)
-    pub fn matches(self: Address, line_num: u32, total_lines: u32) bool {
-        // Handle $ (last line)
-        const effective_start = if (self.is_last_line) total_lines else (self.start orelse 1);
-        const effective_end = if (self.end_is_last) total_lines else (self.end orelse effective_start);
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
 
-        return line_num >= effective_start and line_num <= effective_end;
+    // Resident daemon and its thin client take the whole command line
+    if (args.len >= 3 and std.mem.eql(u8, args[1], "--serve")) {
+        return serveScripts(allocator, args[2]);
     }
-};
-
-/// Parsed sed command
-const SedCommand = struct {
-    cmd_type: CommandType,
-    pattern: []const u8,
-    replacement: []const u8,
-    options: SubstituteOptions,
-    address: ?Address = null, // Optional line address
-};
-
-/// Process replacement string, expanding special sequences like & (matched text)
-fn processReplacement(replacement: []const u8, matched_text: []const u8, output: *std.ArrayListUnmanaged(u8), allocator: std.mem.Allocator) !void {
-    var i: usize = 0;
-    while (i < replacement.len) {
-        if (replacement[i] == '&') {
-            // & expands to the matched text
-            try output.appendSlice(allocator, matched_text);
-            i += 1;
-        } else if (replacement[i] == '\\' and i + 1 < replacement.len) {
-            const next = replacement[i + 1];
-            if (next == '&') {
-                // \& is a literal &
-                try output.append(allocator, '&');
-                i += 2;
-            } else if (next == '\\') {
-                // \\ is a literal \
-                try output.append(allocator, '\\');
-                i += 2;
-            } else if (next == 'n') {
-                // \n is a newline
-                try output.append(allocator, '\n');
-                i += 2;
-            } else if (next == 't') {
-                // \t is a tab
-                try output.append(allocator, '\t');
-                i += 2;
-            } else {
-                // Other escapes pass through
-                try output.append(allocator, replacement[i]);
-                i += 1;
-            }
-        } else {
-            try output.append(allocator, replacement[i]);
-            i += 1;
+    if (args.len >= 3 and std.mem.eql(u8, args[1], "--client")) {
+        // Forward everything after the socket, keeping argv[0]
+        const forwarded = try allocator.alloc([]const u8, args.len - 2);
+        defer allocator.free(forwarded);
+        forwarded[0] = args[0];
+        for (args[3..], forwarded[1..]) |arg, *slot| slot.* = arg;
+
+        if (server.runClient(allocator, args[2], forwarded)) |status| {
+            std.process.exit(status);
+        } else |err| switch (err) {
+            // No daemon listening: run here instead
+            error.FileNotFound, error.ConnectionRefused => {
+                // Same command line without --client SOCKET (args itself is argsFree's)
+                const local_args = try allocator.alloc([:0]u8, args.len - 2);
+                defer allocator.free(local_args);
+                local_args[0] = args[0];
+                @memcpy(local_args[1..], args[3..]);
+                return run(allocator, local_args, null);
+            },
+            else => return err,
         }
     }
-}
-
-pub fn main() !void {
-    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
-    defer _ = gpa.deinit();
-    const allocator = gpa.allocator();
 
-    const args = try std.process.argsAlloc(allocator);
-    defer std.process.argsFree(allocator, args);
+    return run(allocator, args, null);
+}
 
+/// One sed invocation: `args[0]` is the program name. `scripts` is the
+/// daemon's parsed-script pool, null for a one-shot process.
+fn run(allocator: std.mem.Allocator, args: []const [:0]u8, scripts: ?*ScriptCache) !void {
     if (args.len < 2) {
         printUsage();
         return;
@@ -110,7 +100,15 @@ pub fn main() !void {
     var in_place = false;
     var suppress_output = false;
     var use_extended_regex = false; // ERE mode (-E/-r)
+    var unbuffered = false; // Flush output after every write (-u)
     var saw_explicit_expr = false; // Track if -e was used
+    var gpu_autotune = false;
+    var compile_script: ?[]const u8 = null; // --compile-script FILE
+    var output_path: ?[]const u8 = null; // -o FILE
+    var artifact_path: ?[]const u8 = null; // -F FILE
+    var max_memory: ?usize = null; // --max-memory SIZE
+    var huge_page_mode: huge_pages.Mode = .madvise; // --huge-pages MODE
+    var cache_dir: ?[]const u8 = null; // --cache-dir DIR
 
     // Parse arguments
     var i: usize = 1;
@@ -128,6 +126,8 @@ pub fn main() !void {
             use_extended_regex = true;
         } else if (std.mem.eql(u8, arg, "-i") or std.mem.eql(u8, arg, "--in-place")) {
             in_place = true;
+        } else if (std.mem.eql(u8, arg, "-u") or std.mem.eql(u8, arg, "--unbuffered")) {
+            unbuffered = true;
         } else if (std.mem.eql(u8, arg, "--cpu") or std.mem.eql(u8, arg, "--cpu-optimized")) {
             backend_mode = .cpu_mode;
         } else if (std.mem.eql(u8, arg, "--gnu")) {
@@ -140,6 +140,34 @@ pub fn main() !void {
             backend_mode = .vulkan;
         } else if (std.mem.eql(u8, arg, "--auto")) {
             backend_mode = .auto;
+        } else if (std.mem.eql(u8, arg, "--gpu-autotune")) {
+            gpu_autotune = true;
+        } else if (std.mem.eql(u8, arg, "--compile-script") and i + 1 < args.len) {
+            i += 1;
+            compile_script = args[i];
+            saw_explicit_expr = true;
+        } else if (std.mem.eql(u8, arg, "-o") and i + 1 < args.len) {
+            i += 1;
+            output_path = args[i];
+        } else if (std.mem.eql(u8, arg, "-F") and i + 1 < args.len) {
+            i += 1;
+            artifact_path = args[i];
+            saw_explicit_expr = true;
+        } else if (std.mem.eql(u8, arg, "--max-memory") and i + 1 < args.len) {
+            i += 1;
+            max_memory = memory_budget.parseSize(args[i]) catch {
+                std.debug.print("Error: invalid --max-memory size '{s}'\n", .{args[i]});
+                return;
+            };
+        } else if (std.mem.eql(u8, arg, "--cache-dir") and i + 1 < args.len) {
+            i += 1;
+            cache_dir = args[i];
+        } else if (std.mem.eql(u8, arg, "--huge-pages") and i + 1 < args.len) {
+            i += 1;
+            huge_page_mode = std.meta.stringToEnum(huge_pages.Mode, args[i]) orelse {
+                std.debug.print("Error: --huge-pages takes off, madvise or hugetlb, not '{s}'\n", .{args[i]});
+                return;
+            };
         } else if (std.mem.eql(u8, arg, "-V") or std.mem.eql(u8, arg, "--verbose")) {
             verbose = true;
         } else if (std.mem.eql(u8, arg, "-h") or std.mem.eql(u8, arg, "--help")) {
@@ -159,7 +187,34 @@ pub fn main() !void {
         }
     }
 
-    if (expressions.items.len == 0) {
+    if (gpu_autotune) {
+        try runAutotune(allocator, verbose);
+        return;
+    }
+
+    if (compile_script) |script_path| {
+        const out_path = output_path orelse {
+            std.debug.print("Error: --compile-script needs -o OUTPUT\n", .{});
+            return;
+        };
+        return compileScriptFile(allocator, script_path, out_path, use_extended_regex);
+    }
+
+    // Precompiled script: commands and GPU regex tables come from the mapping
+    var artifact: ?script_artifact.Loaded = null;
+    defer if (artifact) |*loaded| {
+        precompiled_regexes = &.{};
+        loaded.deinit();
+    };
+    if (artifact_path) |path| {
+        artifact = script_artifact.load(allocator, path) catch |err| {
+            std.debug.print("Error loading compiled script {s}: {}\n", .{ path, err });
+            return;
+        };
+        precompiled_regexes = artifact.?.regexes;
+    }
+
+    if (expressions.items.len == 0 and artifact == null) {
         std.debug.print("Error: No expression specified\n", .{});
         printUsage();
         return;
@@ -169,14 +224,30 @@ pub fn main() !void {
     var commands: std.ArrayListUnmanaged(SedCommand) = .{};
     defer commands.deinit(allocator);
 
-    for (expressions.items) |expr| {
-        var cmd = parseSedExpression(expr) catch |err| {
-            std.debug.print("Error parsing expression '{s}': {}\n", .{ expr, err });
-            return;
-        };
-        cmd.options.extended = use_extended_regex;
-        try commands.append(allocator, cmd);
+    // Compiled once for every input: patterns become CPU matchers the
+    // commands point at
+    var compiled: ?script.Script = null;
+    defer if (compiled) |*own| own.deinit();
+
+    // The daemon's cached scripts live until the cache evicts them, which
+    // only happens when a later request inserts one
+    var cached: ?*const script.Script = null;
+
+    if (artifact) |loaded| {
+        // Options (including -E) were fixed when the script was compiled
+        compiled = try script.Script.compileCommands(allocator, loaded.commands, false);
+    } else if (scripts) |cache| {
+        cached = cache.lookup(expressions.items, use_extended_regex);
+    }
+    if (compiled == null and cached == null) {
+        const fresh = try compileExpressions(allocator, expressions.items, use_extended_regex) orelse return;
+        if (scripts) |cache| {
+            cached = try cache.insert(expressions.items, use_extended_regex, fresh);
+        } else {
+            compiled = fresh;
+        }
     }
+    try commands.appendSlice(allocator, if (compiled) |*own| own.commands else cached.?.commands);
 
     // If no files specified, read from stdin
     const read_stdin = files.items.len == 0;
@@ -192,667 +263,769 @@ pub fn main() !void {
             std.debug.print("\n", .{});
         }
         std.debug.print("Mode: {s}\n", .{@tagName(backend_mode)});
+        if (max_memory) |budget| {
+            const plan = memory_budget.Plan.init(budget);
+            std.debug.print("Memory budget: {d} bytes (chunks of {d}, batches of {d})\n", .{ budget, plan.chunk_size, plan.batch_bytes });
+        }
         std.debug.print("\n", .{});
     }
 
-    // Process each file or stdin
-    if (read_stdin) {
-        try processStdinMulti(allocator, commands.items, backend_mode, verbose, suppress_output);
-    } else {
-        for (files.items) |filepath| {
-            // Handle "-" as stdin
-            if (std.mem.eql(u8, filepath, "-")) {
-                try processStdinMulti(allocator, commands.items, backend_mode, verbose, suppress_output);
-            } else {
-                try processFileMulti(allocator, filepath, commands.items, backend_mode, verbose, in_place, suppress_output);
-            }
-        }
-    }
-}
+    memory_plan = if (max_memory) |budget| memory_budget.Plan.init(budget) else null;
+    defer memory_plan = null;
 
-/// Check if pattern requires regex processing
-fn needsRegex(pattern: []const u8, options: SubstituteOptions) bool {
-    if (options.extended) return true;
-    // For BRE mode (default), also use regex for special characters
-    var i: usize = 0;
-    while (i < pattern.len) : (i += 1) {
-        const c = pattern[i];
-        if (c == '.' or c == '*' or c == '^' or c == '$' or c == '[') {
-            return true;
-        }
-        if (c == '\\' and i + 1 < pattern.len) {
-            const next = pattern[i + 1];
-            if (next == '+' or next == '?' or next == '|' or next == '(' or next == ')' or next == '{' or next == '}') {
-                return true;
-            }
-            i += 1;
-        }
+    // Under -n the output is not the edited text, so there is nothing to skip
+    if (cache_dir) |path| {
+        if (!suppress_output) edit_cache = result_cache.ResultCache.open(path, commands.items) catch |err| {
+            std.debug.print("Error opening cache directory {s}: {}\n", .{ path, err });
+            return;
+        };
     }
-    return false;
+    defer if (edit_cache) |*cache| {
+        cache.close();
+        edit_cache = null;
+    };
+
+    // All output goes through one buffered sink
+    var stdout_sink = try output_sink.OutputSink.init(allocator, std.posix.STDOUT_FILENO, output_sink.FlushPolicy.detect(std.posix.STDOUT_FILENO, unbuffered));
+    defer stdout_sink.deinit();
+
+    // Input, output and match buffers of a huge page or more come from their
+    // own mappings, kept for the next file once freed
+    var large_pages = huge_pages.LargePageAllocator.init(allocator, huge_page_mode);
+    defer large_pages.deinit();
+    if (memory_plan) |plan| large_pages.max_cached_bytes = plan.chunk_size;
+    const faults_before = huge_pages.PageFaults.sample();
+    defer if (verbose) printPageStats(&large_pages, faults_before);
+
+    processInputs(large_pages.allocator(), files.items, read_stdin, commands.items, backend_mode, verbose, in_place, suppress_output, &stdout_sink) catch |err| switch (err) {
+        // Reader went away (e.g. `| head`) - stop quietly like GNU sed
+        error.BrokenPipe => return,
+        else => return err,
+    };
 }
 
-/// Choose appropriate find function based on options (literal vs regex)
-fn doFindMatches(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.SubstituteResult {
-    if (needsRegex(pattern, options)) {
-        return cpu.findMatchesRegex(text, pattern, options, allocator);
-    }
-    return cpu.findMatches(text, pattern, options, allocator);
+/// Page faults over the run and how the large buffers were served (-V)
+fn printPageStats(pages: *const huge_pages.LargePageAllocator, before: huge_pages.PageFaults) void {
+    const after = huge_pages.PageFaults.sample();
+    std.debug.print("Page faults: {d} minor, {d} major\n", .{ after.minor - before.minor, after.major - before.major });
+    std.debug.print("Large buffers ({s}): {d} mapped, {d} hugetlb, {d} reused\n", .{ @tagName(pages.mode), pages.stats.mapped, pages.stats.hugetlb, pages.stats.reused });
 }
 
-fn processStdin(allocator: std.mem.Allocator, cmd: SedCommand, backend_mode: BackendMode, verbose: bool, suppress_output: bool) !void {
-    // Read all stdin into a buffer
-    var stdin_list: std.ArrayListUnmanaged(u8) = .{};
-    defer stdin_list.deinit(allocator);
+/// Compiled scripts kept by the daemon, keyed by -E and their expressions
+/// (joined by NUL, which can't occur in an argument). Each script owns its
+/// commands and matchers, so a hit skips parsing and regex compilation.
+const ScriptCache = struct {
+    const MAX_SCRIPTS = 256;
 
-    var buf: [4096]u8 = undefined;
-    while (true) {
-        const bytes_read = std.posix.read(std.posix.STDIN_FILENO, &buf) catch |err| {
-            if (err == error.WouldBlock) continue;
-            return err;
-        };
-        if (bytes_read == 0) break;
-        try stdin_list.appendSlice(allocator, buf[0..bytes_read]);
-        if (stdin_list.items.len > gpu.MAX_GPU_BUFFER_SIZE) break;
+    map: std.StringHashMapUnmanaged(script.Script) = .{},
+    allocator: std.mem.Allocator,
+    key_buf: std.ArrayListUnmanaged(u8) = .{},
+
+    fn init(allocator: std.mem.Allocator) ScriptCache {
+        return ScriptCache{ .allocator = allocator };
     }
-    const text = stdin_list.items;
 
-    const file_size = text.len;
+    fn deinit(self: *ScriptCache) void {
+        self.clear();
+        self.map.deinit(self.allocator);
+        self.key_buf.deinit(self.allocator);
+    }
 
-    if (verbose) {
-        std.debug.print("(standard input) ({d} bytes)\n", .{file_size});
+    fn clear(self: *ScriptCache) void {
+        var it = self.map.iterator();
+        while (it.next()) |entry| {
+            self.allocator.free(entry.key_ptr.*);
+            entry.value_ptr.deinit();
+        }
+        self.map.clearRetainingCapacity();
     }
 
-    // Select backend
-    // Note: cpu_gnu maps to .cpu backend but uses cpu_gnu module for matching
-    const backend: gpu.Backend = switch (backend_mode) {
-        .auto => selectOptimalBackend(cmd.pattern.len, file_size),
-        .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
-        .cpu_mode, .cpu_gnu => .cpu,
-        .metal => .metal,
-        .vulkan => .vulkan,
-    };
+    fn buildKey(self: *ScriptCache, expressions: []const []const u8, extended: bool) ![]const u8 {
+        self.key_buf.clearRetainingCapacity();
+        try self.key_buf.append(self.allocator, if (extended) 'E' else 'B');
+        for (expressions, 0..) |expr, idx| {
+            if (idx > 0) try self.key_buf.append(self.allocator, 0);
+            try self.key_buf.appendSlice(self.allocator, expr);
+        }
+        return self.key_buf.items;
+    }
 
-    if (verbose) {
-        std.debug.print("Backend: {s}\n", .{@tagName(backend)});
+    fn lookup(self: *ScriptCache, expressions: []const []const u8, extended: bool) ?*const script.Script {
+        const key = self.buildKey(expressions, extended) catch return null;
+        return self.map.getPtr(key);
     }
 
-    switch (cmd.cmd_type) {
-        .substitute => try processSubstituteStdin(allocator, text, cmd, backend, verbose, suppress_output),
-        .delete => try processDelete(allocator, text, cmd, backend, verbose, suppress_output),
-        .print => try processPrint(allocator, text, cmd, backend, verbose, suppress_output),
-        .transliterate => try processTransliterateStdin(allocator, text, cmd, verbose, suppress_output),
+    /// Take ownership of a script compiled from `expressions` (freed here on
+    /// failure). The pointer stays valid until the next insert.
+    fn insert(self: *ScriptCache, expressions: []const []const u8, extended: bool, compiled: script.Script) !*const script.Script {
+        var owned = compiled;
+        errdefer owned.deinit();
+        if (self.map.count() >= MAX_SCRIPTS) self.clear();
+
+        const key = try self.allocator.dupe(u8, try self.buildKey(expressions, extended));
+        errdefer self.allocator.free(key);
+        const entry = try self.map.getOrPut(self.allocator, key);
+        if (entry.found_existing) {
+            // Not looked up first; keep the script already there
+            self.allocator.free(key);
+            owned.deinit();
+        } else {
+            entry.value_ptr.* = owned;
+        }
+        return entry.value_ptr;
     }
-}
+};
 
-/// Count total lines in text
-fn countLines(text: []const u8) u32 {
-    var count: u32 = 1; // Start at 1 (line numbers are 1-indexed)
-    for (text) |c| {
-        if (c == '\n') count += 1;
+/// Compile -e expressions into a script; null once a bad expression has
+/// been reported
+fn compileExpressions(allocator: std.mem.Allocator, expressions: []const []const u8, extended: bool) !?script.Script {
+    for (expressions) |expr| {
+        _ = parseSedExpression(expr) catch |err| {
+            std.debug.print("Error parsing expression '{s}': {}\n", .{ expr, err });
+            return null;
+        };
     }
-    // Don't count extra line if text ends with newline
-    if (text.len > 0 and text[text.len - 1] == '\n') {
-        count -= 1;
+    return try script.Script.compile(allocator, expressions, .{ .extended = extended });
+}
+
+/// Parse a script file (one expression per line) and write it precompiled
+fn compileScriptFile(allocator: std.mem.Allocator, script_path: []const u8, out_path: []const u8, extended: bool) !void {
+    const contents = std.fs.cwd().readFileAlloc(allocator, script_path, 16 * 1024 * 1024) catch |err| {
+        std.debug.print("Error reading {s}: {}\n", .{ script_path, err });
+        return;
+    };
+    defer allocator.free(contents);
+    const expressions = try script_artifact.splitScript(allocator, contents);
+    defer allocator.free(expressions);
+
+    const commands = try allocator.alloc(SedCommand, expressions.len);
+    defer allocator.free(commands);
+    for (commands, expressions) |*cmd, expr| {
+        cmd.* = parseSedExpression(expr) catch |err| {
+            std.debug.print("Error parsing expression '{s}': {}\n", .{ expr, err });
+            return;
+        };
+        cmd.options.extended = extended;
     }
-    return if (count == 0) 1 else count;
+    try script_artifact.write(allocator, commands, out_path);
 }
 
-/// Apply a single command to text and return the result
-fn applyCommand(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend) ![]u8 {
-    // Count total lines for address handling
-    const total_lines = countLines(text);
-
-    switch (cmd.cmd_type) {
-        .substitute => {
-            // If we have an address, we need to process line-by-line
-            if (cmd.address) |addr| {
-                var output: std.ArrayListUnmanaged(u8) = .{};
-                errdefer output.deinit(allocator);
-
-                var line_num: u32 = 1;
-                var line_start: usize = 0;
-                var i: usize = 0;
-
-                while (i <= text.len) : (i += 1) {
-                    const at_end = i == text.len;
-                    const is_newline = !at_end and text[i] == '\n';
-
-                    if (is_newline or at_end) {
-                        const line_end = i;
-                        const line = text[line_start..line_end];
-
-                        if (addr.matches(line_num, total_lines)) {
-                            // Apply substitution to this line
-                            var line_result = try doFindMatches(line, cmd.pattern, cmd.options, allocator);
-                            defer line_result.deinit();
-
-                            var last_pos: usize = 0;
-                            for (line_result.matches) |match| {
-                                try output.appendSlice(allocator, line[last_pos..match.start]);
-                                const matched_text = line[match.start..match.end];
-                                try processReplacement(cmd.replacement, matched_text, &output, allocator);
-                                last_pos = match.end;
-                            }
-                            try output.appendSlice(allocator, line[last_pos..]);
-                        } else {
-                            // Pass through unchanged
-                            try output.appendSlice(allocator, line);
-                        }
+/// Warm Vulkan context of a --serve daemon; one-shot runs create their own
+var resident_vulkan: ?*gpu.vulkan.VulkanSubstituter = null;
 
-                        if (is_newline) {
-                            try output.append(allocator, '\n');
-                        }
+/// GPU regex tables of the script loaded with -F, for the duration of the run
+var precompiled_regexes: []const gpu.regex_compiler.PrecompiledRegex = &.{};
 
-                        line_start = i + 1;
-                        line_num += 1;
-                    }
-                }
+/// Sizing under --max-memory, for the duration of the run; null keeps whole inputs in memory
+var memory_plan: ?memory_budget.Plan = null;
 
-                return output.toOwnedSlice(allocator);
-            }
+/// Outcomes of earlier runs under --cache-dir, for the duration of the run
+var edit_cache: ?result_cache.ResultCache = null;
 
-            // No address - apply to all lines (original behavior)
-            var result = switch (backend) {
-                .metal => blk: {
-                    if (build_options.is_macos) {
-                        const substituter = gpu.metal.MetalSubstituter.init(allocator) catch {
-                            break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                        };
-                        defer substituter.deinit();
-                        break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                            substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-                        else
-                            substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                            break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                        };
-                    } else {
-                        break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                    }
-                },
-                .vulkan => blk: {
-                    const substituter = gpu.vulkan.VulkanSubstituter.init(allocator) catch {
-                        break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                    };
-                    defer substituter.deinit();
-                    break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                        substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-                    else
-                        substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                        break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                    };
-                },
-                else => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-            };
-            defer result.deinit();
-
-            // Build output with replacements
-            var output: std.ArrayListUnmanaged(u8) = .{};
-            errdefer output.deinit(allocator);
-
-            var last_pos: usize = 0;
-            for (result.matches) |match| {
-                try output.appendSlice(allocator, text[last_pos..match.start]);
-                const matched_text = text[match.start..match.end];
-                try processReplacement(cmd.replacement, matched_text, &output, allocator);
-                last_pos = match.end;
-            }
-            try output.appendSlice(allocator, text[last_pos..]);
-            return output.toOwnedSlice(allocator);
-        },
-        .delete => {
-            // If we have an address with empty pattern, delete by line number
-            if (cmd.address) |addr| {
-                if (cmd.pattern.len == 0) {
-                    var output: std.ArrayListUnmanaged(u8) = .{};
-                    errdefer output.deinit(allocator);
-
-                    var line_num: u32 = 1;
-                    var line_start: usize = 0;
-                    var i: usize = 0;
-
-                    while (i < text.len) : (i += 1) {
-                        if (text[i] == '\n') {
-                            if (!addr.matches(line_num, total_lines)) {
-                                try output.appendSlice(allocator, text[line_start .. i + 1]);
-                            }
-                            line_start = i + 1;
-                            line_num += 1;
-                        }
-                    }
-                    // Handle last line without newline
-                    if (line_start < text.len and !addr.matches(line_num, total_lines)) {
-                        try output.appendSlice(allocator, text[line_start..]);
-                    }
+fn openVulkan(allocator: std.mem.Allocator) !*gpu.vulkan.VulkanSubstituter {
+    const substituter = resident_vulkan orelse try gpu.vulkan.VulkanSubstituter.init(allocator);
+    substituter.precompiled_regexes = precompiled_regexes;
+    return substituter;
+}
 
-                    return output.toOwnedSlice(allocator);
-                }
-            }
+fn closeVulkan(substituter: *gpu.vulkan.VulkanSubstituter) void {
+    if (substituter != resident_vulkan) return substituter.deinit();
+    // The resident context outlives the -F mapping
+    substituter.precompiled_regexes = &.{};
+}
 
-            // Pattern-based delete (original behavior)
-            var result = try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            defer result.deinit();
+const ServeContext = struct {
+    allocator: std.mem.Allocator,
+    scripts: *ScriptCache,
+};
 
-            var output: std.ArrayListUnmanaged(u8) = .{};
-            errdefer output.deinit(allocator);
+/// Resident mode: keep Vulkan initialized and parsed scripts pooled, and run
+/// each --client invocation on the descriptors it passes over the socket
+fn serveScripts(allocator: std.mem.Allocator, socket_path: []const u8) !void {
+    resident_vulkan = gpu.vulkan.VulkanSubstituter.init(allocator) catch null;
+    defer if (resident_vulkan) |substituter| {
+        resident_vulkan = null;
+        substituter.deinit();
+    };
 
-            // Mark lines to delete (line_num is 0-indexed from doFindMatches)
-            var matched_lines = std.AutoHashMap(u32, void).init(allocator);
-            defer matched_lines.deinit();
+    var scripts = ScriptCache.init(allocator);
+    defer scripts.deinit();
 
-            for (result.matches) |match| {
-                try matched_lines.put(match.line_num, {});
-            }
+    try server.serve(allocator, socket_path, ServeContext{ .allocator = allocator, .scripts = &scripts }, serveRequest);
+}
+
+/// Drop the per-run state a request may have left behind (an early return or
+/// error in `run`), so the next request never sees another's -F tables,
+/// --max-memory plan or --cache-dir
+fn resetRunState() void {
+    precompiled_regexes = &.{};
+    memory_plan = null;
+    if (edit_cache) |*cache| {
+        cache.close();
+        edit_cache = null;
+    }
+    if (resident_vulkan) |substituter| substituter.precompiled_regexes = &.{};
+}
+
+fn serveRequest(context: ServeContext, args: []const [:0]u8) u8 {
+    resetRunState();
+    defer resetRunState();
+    // -V reports this request's GPU time, not the daemon's lifetime total
+    if (resident_vulkan) |substituter| substituter.timings = .{};
+    run(context.allocator, args, context.scripts) catch |err| {
+        std.debug.print("sed: {s}\n", .{@errorName(err)});
+        return 1;
+    };
+    return 0;
+}
 
-            // Build output excluding deleted lines (use 0-indexed line numbers)
-            var line_num: u32 = 0;
-            var line_start: usize = 0;
-            var i: usize = 0;
-            while (i < text.len) : (i += 1) {
-                if (text[i] == '\n') {
-                    if (!matched_lines.contains(line_num)) {
-                        try output.appendSlice(allocator, text[line_start .. i + 1]);
+/// Time the Vulkan kernels' launch shapes on this device and cache the fastest
+fn runAutotune(allocator: std.mem.Allocator, verbose: bool) !void {
+    const substituter = openVulkan(allocator) catch |err| {
+        std.debug.print("Error: Vulkan unavailable for autotuning: {}\n", .{err});
+        return;
+    };
+    defer closeVulkan(substituter);
+    defer if (verbose) substituter.getTimings().print("vulkan");
+
+    // Candidates are checked against the CPU on the same corpus
+    const corpus = try gpu.autotune.buildCorpus(allocator);
+    defer allocator.free(corpus);
+    const options = SubstituteOptions{ .global = true };
+    var literal = try cpu.findMatches(corpus, gpu.autotune.LITERAL_PATTERN, options, allocator);
+    defer literal.deinit();
+    var regex = try cpu.findMatchesRegex(corpus, gpu.autotune.REGEX_PATTERN, options, allocator);
+    defer regex.deinit();
+
+    const config = try substituter.tuneKernels(corpus, .{ .literal_matches = literal.total_matches, .regex_matches = regex.total_matches });
+    std.debug.print("literal: workgroup {d}, tile {d} bytes; regex: workgroup {d}\n", .{
+        config.literal_workgroup_size, config.literal_tile_bytes, config.regex_workgroup_size,
+    });
+}
+
+/// Process each file or stdin, then flush the shared output sink
+fn processInputs(allocator: std.mem.Allocator, files: []const []const u8, read_stdin: bool, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    if (read_stdin) {
+        try processStdinMulti(allocator, commands, backend_mode, verbose, suppress_output, sink);
+    } else {
+        // Runs of small files share one dispatch for a lone unaddressed s command
+        const batchable = commands.len == 1 and commands[0].cmd_type == .substitute and commands[0].address == null and
+            backend_mode != .cpu_mode and backend_mode != .cpu_gnu;
+        var pending = batch.Batch.init(allocator);
+        defer pending.deinit();
+        if (memory_plan) |plan| pending.max_bytes = plan.batch_bytes;
+
+        // With --cache-dir, each batched file's identity when it was read (null
+        // if it changed during the read), so its outcome can be recorded once
+        // the batch has run
+        const file_stats = try allocator.alloc(?std.fs.File.Stat, if (edit_cache != null) files.len else 0);
+        defer allocator.free(file_stats);
+        @memset(file_stats, null);
+
+        for (files, 0..) |filepath, file_id| {
+            // Files an earlier run left unchanged, untouched since: not even read under -i
+            if (edit_cache != null and !std.mem.eql(u8, filepath, "-")) {
+                if (openIfUnchanged(filepath)) |file| {
+                    defer file.close();
+                    if (verbose) std.debug.print("File: {s} (unchanged, cached)\n", .{filepath});
+                    if (!in_place) {
+                        try flushBatch(allocator, &pending, files, file_stats, commands[0], backend_mode, verbose, in_place, suppress_output, sink);
+                        try copyToSink(file, sink);
                     }
-                    line_start = i + 1;
-                    line_num += 1;
+                    continue;
                 }
             }
-            // Handle last line without newline
-            if (line_start < text.len and !matched_lines.contains(line_num)) {
-                try output.appendSlice(allocator, text[line_start..]);
-            }
 
-            return output.toOwnedSlice(allocator);
-        },
-        .print => {
-            // For print, just return a copy (print doesn't modify)
-            const copy = try allocator.dupe(u8, text);
-            return copy;
-        },
-        .transliterate => {
-            // Copy and transliterate
-            const copy = try allocator.dupe(u8, text);
-            errdefer allocator.free(copy);
-
-            const src_chars = cmd.pattern;
-            const dst_chars = cmd.replacement;
-
-            for (copy) |*c| {
-                for (src_chars, 0..) |src, j| {
-                    if (c.* == src and j < dst_chars.len) {
-                        c.* = dst_chars[j];
-                        break;
+            if (batchable and !std.mem.eql(u8, filepath, "-")) {
+                if (try readSmallFile(allocator, filepath, verbose)) |small| {
+                    defer allocator.free(small.contents);
+                    if (edit_cache != null) {
+                        if (contentUnchanged(result_cache.hashBytes(small.contents), small.stat)) {
+                            if (!in_place) {
+                                try flushBatch(allocator, &pending, files, file_stats, commands[0], backend_mode, verbose, in_place, suppress_output, sink);
+                                try sink.write(small.contents);
+                            }
+                            continue;
+                        }
+                        file_stats[file_id] = small.stat;
                     }
+                    if (!try pending.append(@intCast(file_id), small.contents)) {
+                        try flushBatch(allocator, &pending, files, file_stats, commands[0], backend_mode, verbose, in_place, suppress_output, sink);
+                        _ = try pending.append(@intCast(file_id), small.contents);
+                    }
+                    continue;
                 }
             }
-            return copy;
-        },
+            // Earlier (batched) files are written first
+            try flushBatch(allocator, &pending, files, file_stats, commands[0], backend_mode, verbose, in_place, suppress_output, sink);
+
+            // Handle "-" as stdin
+            if (std.mem.eql(u8, filepath, "-")) {
+                try processStdinMulti(allocator, commands, backend_mode, verbose, suppress_output, sink);
+            } else {
+                try processFileMulti(allocator, filepath, commands, backend_mode, verbose, in_place, suppress_output, sink);
+            }
+        }
+        try flushBatch(allocator, &pending, files, file_stats, commands[0], backend_mode, verbose, in_place, suppress_output, sink);
     }
+    try sink.flush();
 }
 
-/// Process stdin with multiple commands
-fn processStdinMulti(allocator: std.mem.Allocator, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, suppress_output: bool) !void {
-    // Read all stdin into a buffer
-    var stdin_list: std.ArrayListUnmanaged(u8) = .{};
-    defer stdin_list.deinit(allocator);
+/// A file read for batching, with its identity at the time it was read
+const SmallFile = struct {
+    contents: []u8,
+    /// Null when the file changed while it was read, or just before (stableStat)
+    stat: ?std.fs.File.Stat,
+};
 
-    var buf: [4096]u8 = undefined;
-    while (true) {
-        const bytes_read = std.posix.read(std.posix.STDIN_FILENO, &buf) catch |err| {
-            if (err == error.WouldBlock) continue;
-            return err;
-        };
-        if (bytes_read == 0) break;
-        try stdin_list.appendSlice(allocator, buf[0..bytes_read]);
-        if (stdin_list.items.len > gpu.MAX_GPU_BUFFER_SIZE) break;
-    }
+/// Contents of a file small enough to batch. Null when it is too large or
+/// can't be opened (the regular path handles and reports it).
+fn readSmallFile(allocator: std.mem.Allocator, filepath: []const u8, verbose: bool) !?SmallFile {
+    const file = std.fs.cwd().openFile(filepath, .{}) catch return null;
+    defer file.close();
 
-    const file_size = stdin_list.items.len;
+    const read_start = std.time.nanoTimestamp();
+    const stat = try file.stat();
+    if (stat.size > batch.MAX_BATCHED_FILE_SIZE) return null;
+
+    const contents = try file.readToEndAlloc(allocator, batch.MAX_BATCHED_FILE_SIZE);
+    if (compressed.detect(contents) != .none) {
+        // Decompressed size is unknown up front; take the regular path
+        allocator.free(contents);
+        return null;
+    }
 
     if (verbose) {
-        std.debug.print("(standard input) ({d} bytes)\n", .{file_size});
+        std.debug.print("File: {s} ({d} bytes, batched)\n", .{ filepath, contents.len });
     }
+    return .{ .contents = contents, .stat = stableStat(file, stat, read_start) };
+}
 
-    // Start with the original text
-    var current_text: []u8 = try allocator.dupe(u8, stdin_list.items);
+/// A file modified this close to when it was read could be written again in
+/// the same timestamp tick (coarse filesystem clocks, FAT's 2 s) without its
+/// mtime or size changing ("racily clean", as git calls it)
+const RACY_MARGIN_NS: i128 = 2 * std.time.ns_per_s;
+
+/// `before`, taken ahead of reading the file (and after the clock sample
+/// `read_start`), if it can vouch for the bytes read: the file still has that
+/// identity once read, and its mtime is clearly older than the read. Null
+/// otherwise, since a later write might leave the identity as it was.
+fn stableStat(file: std.fs.File, before: std.fs.File.Stat, read_start: i128) ?std.fs.File.Stat {
+    if (before.mtime > read_start - RACY_MARGIN_NS) return null;
+    const after = file.stat() catch return null;
+    if (after.inode != before.inode or after.mtime != before.mtime or after.size != before.size) return null;
+    return before;
+}
 
-    // Apply each command in sequence
-    for (commands, 0..) |cmd, idx| {
-        const backend: gpu.Backend = switch (backend_mode) {
-            .auto => selectOptimalBackend(cmd.pattern.len, @intCast(current_text.len)),
-            .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
-            .cpu_mode, .cpu_gnu => .cpu,
-            .metal => .metal,
-            .vulkan => .vulkan,
-        };
+/// With --cache-dir: the file, opened but unread, when an earlier run found
+/// the script leaves it unchanged and it has the same inode, mtime and size
+fn openIfUnchanged(filepath: []const u8) ?std.fs.File {
+    const cache = if (edit_cache) |*c| c else return null;
+    const file = std.fs.cwd().openFile(filepath, .{}) catch return null;
+    const stat = file.stat() catch {
+        file.close();
+        return null;
+    };
+    if (cache.isUnchanged(cache.statKey(stat))) return file;
+    file.close();
+    return null;
+}
 
-        if (verbose) {
-            std.debug.print("Command [{d}]: {s}, Backend: {s}\n", .{ idx, @tagName(cmd.cmd_type), @tagName(backend) });
-        }
+/// With --cache-dir: whether an earlier run found the script leaves these
+/// contents unchanged. A hit also records the file's identity (when it held
+/// still during the read), so later runs skip it without reading.
+fn contentUnchanged(content_hash: result_cache.Key, stat: ?std.fs.File.Stat) bool {
+    const cache = if (edit_cache) |*c| c else return false;
+    if (!cache.isUnchanged(cache.contentKey(content_hash))) return false;
+    if (stat) |identity| cache.record(cache.statKey(identity), .unchanged);
+    return true;
+}
 
-        const new_text = try applyCommand(allocator, current_text, cmd, backend);
-        allocator.free(current_text);
-        current_text = new_text;
+/// Record what the script did to a plain input edited whole (--cache-dir).
+/// True when the output equals the input, so -i can leave the file as it is.
+fn recordEdit(stat: ?std.fs.File.Stat, content_hash: result_cache.Key, edits: *const PieceTable) bool {
+    const cache = if (edit_cache) |*c| c else return false;
+    const output_hash = result_cache.hashPieces(edits);
+    if (!std.mem.eql(u8, &output_hash, &content_hash)) {
+        cache.record(cache.contentKey(content_hash), .{ .output = output_hash });
+        return false;
     }
-    defer allocator.free(current_text);
+    cache.record(cache.contentKey(content_hash), .unchanged);
+    if (stat) |identity| cache.record(cache.statKey(identity), .unchanged);
+    return true;
+}
 
-    // Output result (unless suppressed)
-    if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, current_text) catch {};
+/// Copy a file's bytes to the output as they are
+fn copyToSink(file: std.fs.File, sink: *output_sink.OutputSink) !void {
+    var buf: [64 * 1024]u8 = undefined;
+    while (true) {
+        const n = try file.read(&buf);
+        if (n == 0) break;
+        try sink.write(buf[0..n]);
     }
 }
 
-/// Process file with multiple commands
-fn processFileMulti(allocator: std.mem.Allocator, filepath: []const u8, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool) !void {
-    const file = std.fs.cwd().openFile(filepath, .{}) catch |err| {
-        std.debug.print("Error opening {s}: {}\n", .{ filepath, err });
-        return;
-    };
-    defer file.close();
+/// Run the batch's substitution in one dispatch and write each file's result in order
+fn flushBatch(allocator: std.mem.Allocator, pending: *batch.Batch, files: []const []const u8, file_stats: []const ?std.fs.File.Stat, cmd: SedCommand, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    if (pending.isEmpty()) return;
+    defer pending.reset();
 
-    const stat = try file.stat();
-    const file_size = stat.size;
+    const backend: gpu.Backend = switch (backend_mode) {
+        .auto => selectOptimalBackend(cmd.cmd_type, cmd.pattern.len, pending.text.items.len),
+        .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
+        .cpu_mode, .cpu_gnu => .cpu,
+        .metal => .metal,
+        .vulkan => .vulkan,
+    };
 
     if (verbose) {
-        std.debug.print("File: {s} ({d} bytes)\n", .{ filepath, file_size });
+        std.debug.print("Batch: {d} files ({d} bytes), Backend: {s}\n", .{ pending.segments.items.len, pending.text.items.len, @tagName(backend) });
     }
 
-    const original_text = try file.readToEndAlloc(allocator, gpu.MAX_GPU_BUFFER_SIZE);
+    var result = try findMatchesOn(pending.text.items, cmd, backend, verbose, allocator);
+    defer result.deinit();
+    try writeBatch(allocator, pending, files, file_stats, cmd, &result, backend_mode, verbose, in_place, suppress_output, sink);
+}
 
-    // Start with the original text
-    var current_text: []u8 = original_text;
+/// Write each batched file's result from the batch-wide matches
+fn writeBatch(allocator: std.mem.Allocator, pending: *const batch.Batch, files: []const []const u8, file_stats: []const ?std.fs.File.Stat, cmd: SedCommand, result: *gpu.SubstituteResult, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    // Results were capped (MAX_RESULTS): redo the files one at a time rather than lose replacements
+    if (result.total_matches > result.matches.len) {
+        for (pending.segments.items) |segment| {
+            const text = try allocator.dupe(u8, pending.segmentText(segment));
+            defer allocator.free(text);
+            var edited = try applyCommands(allocator, text, &.{cmd}, backend_mode, verbose, suppress_output, sink, null);
+            defer edited.deinit(allocator);
+            try writeFileResult(allocator, files[segment.file_id], &edited.edits, in_place, suppress_output, sink);
+        }
+        return;
+    }
 
-    // Apply each command in sequence
-    for (commands, 0..) |cmd, idx| {
-        const backend: gpu.Backend = switch (backend_mode) {
-            .auto => selectOptimalBackend(cmd.pattern.len, @intCast(current_text.len)),
-            .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
-            .cpu_mode, .cpu_gnu => .cpu,
-            .metal => .metal,
-            .vulkan => .vulkan,
-        };
+    const per_file = try pending.splitMatches(result.matches);
+    defer allocator.free(per_file);
 
-        if (verbose) {
-            std.debug.print("Command [{d}]: {s}, Backend: {s}\n", .{ idx, @tagName(cmd.cmd_type), @tagName(backend) });
-        }
+    for (pending.segments.items, per_file) |segment, matches| {
+        var output = PieceTable.init(allocator, pending.segmentText(segment));
+        defer output.deinit();
 
-        const new_text = try applyCommand(allocator, current_text, cmd, backend);
-        allocator.free(current_text);
-        current_text = new_text;
-    }
-    defer allocator.free(current_text);
+        var pieces = SubstitutePieces{ .output = &output, .replacement = cmd.replacement };
+        for (matches) |match| try pieces.add(match);
+        try pieces.finish(output.original.len);
 
-    // Write output
-    if (in_place) {
-        const out_file = try std.fs.cwd().createFile(filepath, .{});
-        defer out_file.close();
-        try out_file.writeAll(current_text);
-    } else if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, current_text) catch {};
+        // Unchanged output under -i leaves the file (and its cached identity) alone
+        if (file_stats.len > 0) {
+            if (recordEdit(file_stats[segment.file_id], result_cache.hashBytes(output.original), &output) and in_place) continue;
+        }
+        try writeFileResult(allocator, files[segment.file_id], &output, in_place, suppress_output, sink);
     }
 }
 
-fn processSubstituteStdin(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, suppress_output: bool) !void {
-    // Find matches
-    var result = switch (backend) {
-        .metal => blk: {
-            if (build_options.is_macos) {
-                const substituter = gpu.metal.MetalSubstituter.init(allocator) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
+/// Find a substitute command's matches on the given backend, falling back to the CPU
+fn findMatchesOn(text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, allocator: std.mem.Allocator) !gpu.SubstituteResult {
+    switch (backend) {
+        .metal => if (build_options.is_macos) {
+            if (gpu.metal.MetalSubstituter.init(allocator)) |substituter| {
                 defer substituter.deinit();
-                break :blk (if (needsRegex(cmd.pattern, cmd.options))
+                const result = (if (needsRegex(cmd.pattern, cmd.options))
                     substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
                 else
-                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-            } else {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            }
+                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch null;
+                if (result) |r| return r;
+            } else |_| {}
         },
-        .vulkan => blk: {
-            const substituter = gpu.vulkan.VulkanSubstituter.init(allocator) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-            defer substituter.deinit();
-            break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-            else
-                substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
+        .vulkan => {
+            if (openVulkan(allocator)) |substituter| {
+                defer closeVulkan(substituter);
+                defer if (verbose) substituter.getTimings().print("vulkan");
+                const result = (if (needsRegex(cmd.pattern, cmd.options))
+                    substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
+                else
+                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch null;
+                if (result) |r| return r;
+            } else |_| {}
         },
-        else => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-    };
-    defer result.deinit();
-
-    if (verbose) {
-        std.debug.print("Found {d} matches\n\n", .{result.total_matches});
+        else => {},
     }
+    return doFindMatches(text, cmd.pattern, cmd.options, allocator);
+}
 
-    // Build output with replacements
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(allocator);
-
-    var last_pos: usize = 0;
-    for (result.matches) |match| {
-        try output.appendSlice(allocator, text[last_pos..match.start]);
-        const matched_text = text[match.start..match.end];
-        try processReplacement(cmd.replacement, matched_text, &output, allocator);
-        last_pos = match.end;
+/// Stream a substitute command's matches to `onMatch` in text order, from the
+/// given backend when it can take the text and from the CPU matcher otherwise.
+/// GPU failures (including a full results buffer) happen before any match is
+/// passed on, so the CPU search starts from a clean slate.
+fn forEachMatchOn(text: []const u8, cmd: SedCommand, matcher: *const cpu.Matcher, backend: gpu.Backend, verbose: bool, allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !void {
+    const is_regex = needsRegex(cmd.pattern, cmd.options);
+    switch (backend) {
+        .metal => if (build_options.is_macos) {
+            if (gpu.metal.MetalSubstituter.init(allocator)) |substituter| {
+                defer substituter.deinit();
+                // Metal reads back sorted match records; replay them
+                var found = (if (is_regex)
+                    substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
+                else
+                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch null;
+                if (found) |*result| {
+                    defer result.deinit();
+                    if (result.total_matches <= result.matches.len) {
+                        for (result.matches) |match| try onMatch(context, match);
+                        return;
+                    }
+                }
+            } else |_| {}
+        },
+        .vulkan => {
+            if (openVulkan(allocator)) |substituter| {
+                defer closeVulkan(substituter);
+                defer if (verbose) substituter.getTimings().print("vulkan");
+                const found = (if (is_regex)
+                    substituter.forEachMatchRegex(text, cmd.pattern, cmd.options, allocator, context, onMatch)
+                else
+                    substituter.forEachMatch(text, cmd.pattern, cmd.options, allocator, context, onMatch)) catch |err| switch (err) {
+                    error.OutOfMemory => return err,
+                    else => null,
+                };
+                if (found != null) return;
+            } else |_| {}
+        },
+        else => {},
     }
-    try output.appendSlice(allocator, text[last_pos..]);
+    _ = try matcher.forEach(text, allocator, context, onMatch);
+}
 
-    if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, output.items) catch {};
+/// Select the lines a d/p pattern matches, on the GPU when the backend allows it.
+/// GPU line-mode kernels return a bitmap directly; any GPU failure falls back to the CPU.
+fn doSelectLines(text: []const u8, pattern: []const u8, options: SubstituteOptions, matcher: *const cpu.Matcher, backend: gpu.Backend, verbose: bool, allocator: std.mem.Allocator) !gpu.LineSelection {
+    const is_regex = needsRegex(pattern, options);
+    switch (backend) {
+        .metal => if (build_options.is_macos) {
+            if (gpu.metal.MetalSubstituter.init(allocator)) |substituter| {
+                defer substituter.deinit();
+                const selection = (if (is_regex)
+                    substituter.selectLinesRegex(text, pattern, options, allocator)
+                else
+                    substituter.selectLines(text, pattern, options, allocator)) catch null;
+                if (selection) |s| return s;
+            } else |_| {}
+        },
+        .vulkan => {
+            if (openVulkan(allocator)) |substituter| {
+                defer closeVulkan(substituter);
+                defer if (verbose) substituter.getTimings().print("vulkan");
+                const selection = (if (is_regex)
+                    substituter.selectLinesRegex(text, pattern, options, allocator)
+                else
+                    substituter.selectLines(text, pattern, options, allocator)) catch null;
+                if (selection) |s| return s;
+            } else |_| {}
+        },
+        else => {},
     }
+    return matcher.selectLines(text, allocator);
 }
 
-fn processTransliterateStdin(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, verbose: bool, suppress_output: bool) !void {
-    const mutable_text = try allocator.alloc(u8, text.len);
-    defer allocator.free(mutable_text);
-    @memcpy(mutable_text, text);
-
-    cpu.transliterate(mutable_text, cmd.pattern, cmd.replacement);
+/// script.applyCommand's engine for the CLI: whole-text searches and d/p
+/// selections on the chosen backend, addressed lines on the CPU matcher,
+/// printed lines to the sink
+const CommandEngine = struct {
+    cmd: SedCommand,
+    matcher: *const cpu.Matcher,
+    backend: gpu.Backend,
+    verbose: bool,
+    allocator: std.mem.Allocator,
+    sink: *output_sink.OutputSink,
+
+    pub fn search(self: CommandEngine, text: []const u8, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !void {
+        try forEachMatchOn(text, self.cmd, self.matcher, self.backend, self.verbose, self.allocator, context, onMatch);
+    }
 
-    if (verbose) {
-        std.debug.print("Transliterated {d} bytes\n\n", .{mutable_text.len});
+    pub fn searchLine(self: CommandEngine, line: []const u8, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !void {
+        _ = try self.matcher.forEach(line, self.allocator, context, onMatch);
     }
 
-    if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, mutable_text) catch {};
+    pub fn selectLines(self: CommandEngine, text: []const u8) !gpu.LineSelection {
+        return doSelectLines(text, self.cmd.pattern, self.cmd.options, self.matcher, self.backend, self.verbose, self.allocator);
     }
-}
 
-fn parseSedExpression(expr: []const u8) !SedCommand {
-    if (expr.len < 1) return error.InvalidExpression;
+    pub fn write(self: CommandEngine, bytes: []const u8) !void {
+        try self.sink.write(bytes);
+    }
+};
 
-    // First, try to parse a line address (number, range, or $)
-    var address: ?Address = null;
-    var cmd_start: usize = 0;
+/// Final text of a command chain: the last command's pieces, over the
+/// caller's text or over the last flattened text, which this owns
+const EditedText = struct {
+    flattened: ?[]u8,
+    edits: PieceTable,
 
-    if (expr[0] >= '0' and expr[0] <= '9') {
-        // Line number address
-        var i: usize = 0;
-        while (i < expr.len and expr[i] >= '0' and expr[i] <= '9') : (i += 1) {}
-        const line_num = std.fmt.parseInt(u32, expr[0..i], 10) catch return error.InvalidExpression;
-        address = Address{ .start = line_num };
-        cmd_start = i;
+    fn deinit(self: *EditedText, allocator: std.mem.Allocator) void {
+        self.edits.deinit();
+        if (self.flattened) |flat| allocator.free(flat);
+    }
+};
 
-        // Check for range (comma followed by another number or $)
-        if (i < expr.len and expr[i] == ',') {
-            i += 1;
-            if (i < expr.len) {
-                if (expr[i] == '$') {
-                    address.?.end_is_last = true;
-                    i += 1;
-                } else if (expr[i] >= '0' and expr[i] <= '9') {
-                    var j = i;
-                    while (j < expr.len and expr[j] >= '0' and expr[j] <= '9') : (j += 1) {}
-                    const end_num = std.fmt.parseInt(u32, expr[i..j], 10) catch return error.InvalidExpression;
-                    address.?.end = end_num;
-                    i = j;
-                }
+/// Apply each command in sequence to text, which stays the caller's (y///
+/// rewrites it in place) and must outlive the result, so an input read into
+/// page-aligned memory reaches the GPU as it is. Each command
+/// yields pieces over its input; they are flattened only when another
+/// command follows and something changed, and the last command's pieces are
+/// returned unflattened for writing. For a chunk of a larger input, `spans`
+/// holds each command's line numbering and is advanced past the chunk.
+/// Runs of adjacent y/// commands are composed into one byte map and applied in one pass.
+fn applyCommands(allocator: std.mem.Allocator, text: []u8, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, suppress_output: bool, sink: *output_sink.OutputSink, spans: ?[]LineSpan) !EditedText {
+    var current_text = text;
+    var flattened: ?[]u8 = null;
+    errdefer if (flattened) |flat| allocator.free(flat);
+    var edits: ?PieceTable = null;
+    errdefer if (edits) |*pieces| pieces.deinit();
+
+    var idx: usize = 0;
+    while (idx < commands.len) {
+        // Matching needs contiguous text: flatten the previous command's output
+        if (edits) |*pieces| {
+            if (!pieces.isIdentity()) {
+                const flat = try pieces.toOwnedSlice(allocator);
+                if (flattened) |previous| allocator.free(previous);
+                flattened = flat;
+                current_text = flat;
             }
-            cmd_start = i;
+            pieces.deinit();
+            edits = null;
         }
-    } else if (expr[0] == '$') {
-        // Last line address
-        address = Address{ .is_last_line = true };
-        cmd_start = 1;
-        // Check for range ($,number - unusual but valid)
-        if (cmd_start < expr.len and expr[cmd_start] == ',') {
-            cmd_start += 1;
-            if (cmd_start < expr.len and expr[cmd_start] >= '0' and expr[cmd_start] <= '9') {
-                var j = cmd_start;
-                while (j < expr.len and expr[j] >= '0' and expr[j] <= '9') : (j += 1) {}
-                const end_num = std.fmt.parseInt(u32, expr[cmd_start..j], 10) catch return error.InvalidExpression;
-                address.?.end = end_num;
-                cmd_start = j;
-            }
-        }
-    }
-
-    // Get the remaining expression after the address
-    const remaining = expr[cmd_start..];
-    if (remaining.len < 1) return error.InvalidExpression;
 
-    // Check for transliterate (y/source/dest/)
-    if (remaining[0] == 'y' and remaining.len >= 4) {
-        const delim = remaining[1];
-        var parts: [3][]const u8 = undefined;
-        var part_idx: usize = 0;
-        var start: usize = 2;
+        const cmd = commands[idx];
+        const backend: gpu.Backend = switch (backend_mode) {
+            .auto => selectOptimalBackend(cmd.cmd_type, cmd.pattern.len, @intCast(current_text.len)),
+            .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
+            .cpu_mode, .cpu_gnu => .cpu,
+            .metal => .metal,
+            .vulkan => .vulkan,
+        };
 
-        for (remaining[2..], 2..) |c, idx| {
-            if (c == delim) {
-                parts[part_idx] = remaining[start..idx];
-                part_idx += 1;
-                start = idx + 1;
-                if (part_idx >= 2) break;
+        if (cmd.cmd_type == .transliterate) {
+            var table = gpu.TransliterateTable.init(cmd.pattern, cmd.replacement);
+            var run_end = idx + 1;
+            while (run_end < commands.len and commands[run_end].cmd_type == .transliterate) : (run_end += 1) {
+                table = table.then(gpu.TransliterateTable.init(commands[run_end].pattern, commands[run_end].replacement));
             }
-        }
-        if (part_idx >= 2) {
-            return SedCommand{
-                .cmd_type = .transliterate,
-                .pattern = parts[0],
-                .replacement = parts[1],
-                .options = .{},
-                .address = address,
-            };
-        }
-    }
 
-    // Check for substitute (s/pattern/replacement/flags)
-    if (remaining[0] == 's' and remaining.len >= 4) {
-        const delim = remaining[1];
-        var pattern_end: usize = 2;
-        while (pattern_end < remaining.len and remaining[pattern_end] != delim) {
-            if (remaining[pattern_end] == '\\' and pattern_end + 1 < remaining.len) {
-                pattern_end += 2; // Skip escaped char
-            } else {
-                pattern_end += 1;
+            if (verbose) {
+                std.debug.print("Command [{d}..{d}]: transliterate, Backend: {s}\n", .{ idx, run_end - 1, @tagName(backend) });
             }
-        }
-
-        if (pattern_end >= remaining.len) return error.InvalidExpression;
 
-        const pattern = remaining[2..pattern_end];
-        var replacement_end = pattern_end + 1;
-        while (replacement_end < remaining.len and remaining[replacement_end] != delim) {
-            if (remaining[replacement_end] == '\\' and replacement_end + 1 < remaining.len) {
-                replacement_end += 2;
-            } else {
-                replacement_end += 1;
+            if (spans) |line_spans| {
+                const chunk_lines = gpu.lineCount(current_text);
+                for (line_spans[idx..run_end]) |*span| span.base += chunk_lines;
             }
+            try doTransliterate(allocator, current_text, &table, backend, verbose);
+            idx = run_end;
+            continue;
         }
 
-        const replacement = remaining[pattern_end + 1 .. replacement_end];
-
-        // Parse flags
-        var options = SubstituteOptions{};
-        if (replacement_end + 1 < remaining.len) {
-            const flags = remaining[replacement_end + 1 ..];
-            for (flags) |f| {
-                switch (f) {
-                    'g' => options.global = true,
-                    'i', 'I' => options.case_insensitive = true,
-                    '1' => options.first_only = true,
-                    else => {},
-                }
-            }
+        if (verbose) {
+            std.debug.print("Command [{d}]: {s}, Backend: {s}\n", .{ idx, @tagName(cmd.cmd_type), @tagName(backend) });
         }
 
-        return SedCommand{
-            .cmd_type = .substitute,
-            .pattern = pattern,
-            .replacement = replacement,
-            .options = options,
-            .address = address,
+        // Commands from a compiled script bring their matcher; others compile one here
+        var own_matcher: ?cpu.Matcher = null;
+        defer if (own_matcher) |*matcher| matcher.deinit();
+        const matcher = cmd.matcher orelse blk: {
+            own_matcher = try script.compileMatcher(allocator, cmd);
+            break :blk &own_matcher.?;
         };
+        const engine = CommandEngine{ .cmd = cmd, .matcher = matcher, .backend = backend, .verbose = verbose, .allocator = allocator, .sink = sink };
+        edits = try script.applyCommand(allocator, current_text, cmd, if (spans) |line_spans| line_spans[idx] else .{}, suppress_output, engine);
+        if (spans) |line_spans| line_spans[idx].base += gpu.lineCount(current_text);
+        idx += 1;
     }
 
-    // Check for just 'd' (delete addressed lines)
-    if (remaining[0] == 'd') {
-        return SedCommand{
-            .cmd_type = .delete,
-            .pattern = "", // No pattern - use address only
-            .replacement = "",
-            .options = .{},
-            .address = address,
-        };
-    }
+    return .{ .flattened = flattened, .edits = edits orelse try PieceTable.identity(allocator, current_text) };
+}
 
-    // Check for just 'p' (print addressed lines)
-    if (remaining[0] == 'p') {
-        return SedCommand{
-            .cmd_type = .print,
-            .pattern = "", // No pattern - use address only
-            .replacement = "",
-            .options = .{},
-            .address = address,
-        };
+/// Apply a y/// byte map in place, on the GPU when the backend allows it.
+/// A failed GPU run leaves text untouched, so the CPU fallback starts from the same input.
+fn doTransliterate(allocator: std.mem.Allocator, text: []u8, table: *const gpu.TransliterateTable, backend: gpu.Backend, verbose: bool) !void {
+    switch (backend) {
+        .metal => if (build_options.is_macos) {
+            if (gpu.metal.MetalSubstituter.init(allocator)) |substituter| {
+                defer substituter.deinit();
+                if (substituter.transliterate(text, &table.map)) |_| return else |_| {}
+            } else |_| {}
+        },
+        .vulkan => {
+            if (openVulkan(allocator)) |substituter| {
+                defer closeVulkan(substituter);
+                defer if (verbose) substituter.getTimings().print("vulkan");
+                if (substituter.transliterate(text, &table.map)) |_| return else |_| {}
+            } else |_| {}
+        },
+        else => {},
     }
+    cpu.transliterateTable(text, &table.map);
+}
+
+/// Process stdin with multiple commands
+fn processStdinMulti(allocator: std.mem.Allocator, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    // Read all stdin into a buffer
+    var stdin_list: std.ArrayListUnmanaged(u8) = .{};
+    defer stdin_list.deinit(allocator);
 
-    // Check for address/pattern command (/pattern/d or /pattern/p)
-    if (remaining[0] == '/') {
-        var pattern_end: usize = 1;
-        while (pattern_end < remaining.len and remaining[pattern_end] != '/') {
-            pattern_end += 1;
+    // Inputs larger than one GPU buffer stream in chunks even without --max-memory
+    const plan = memory_plan orelse memory_budget.Plan.unlimited();
+    var buf: [64 * 1024]u8 = undefined;
+    var at_eof = false;
+    while (true) {
+        const bytes_read = std.posix.read(std.posix.STDIN_FILENO, &buf) catch |err| {
+            if (err == error.WouldBlock) continue;
+            return err;
+        };
+        if (bytes_read == 0) {
+            at_eof = true;
+            break;
         }
+        try stdin_list.appendSlice(allocator, buf[0..bytes_read]);
+        const codec = compressed.detect(stdin_list.items);
+        // Past one chunk: stream the rest (compressed input is decoded whole, keep reading)
+        if (plan.needsChunking(stdin_list.items.len) and codec == .none) break;
+        // ...unless there is a budget: then it is decoded as it streams in
+        if (memory_plan != null and codec != .none) break;
+    }
 
-        if (pattern_end >= remaining.len) return error.InvalidExpression;
+    if (!at_eof) {
+        if (verbose) std.debug.print("(standard input) (streamed in {d}-byte chunks)\n", .{plan.chunk_size});
+        const source = ChunkSource{ .file = std.fs.File.stdin(), .prefix = stdin_list.items, .codec = compressed.detect(stdin_list.items) };
+        return processChunked(allocator, source, commands, plan, backend_mode, verbose, false, suppress_output, sink);
+    }
 
-        var pattern = remaining[1..pattern_end];
-        var options = SubstituteOptions{};
+    const file_size = stdin_list.items.len;
 
-        // Handle ^ anchor at start of pattern
-        if (pattern.len > 0 and pattern[0] == '^') {
-            options.anchor_start = true;
-            pattern = pattern[1..];
-        }
+    if (verbose) {
+        std.debug.print("(standard input) ({d} bytes)\n", .{file_size});
+    }
 
-        const cmd_char = if (pattern_end + 1 < remaining.len) remaining[pattern_end + 1] else 'p';
+    // Page-aligned, so the Vulkan backend can import it instead of copying it
+    const data = try allocator.alignedAlloc(u8, .fromByteUnits(std.heap.page_size_min), stdin_list.items.len);
+    @memcpy(data, stdin_list.items);
+    stdin_list.clearAndFree(allocator);
+    const input = try decodeInput(allocator, data, verbose);
+    defer input.deinit(allocator);
+    var edited = try applyCommands(allocator, input.text, commands, backend_mode, verbose, suppress_output, sink, null);
+    defer edited.deinit(allocator);
 
-        return SedCommand{
-            .cmd_type = if (cmd_char == 'd') .delete else .print,
-            .pattern = pattern,
-            .replacement = "",
-            .options = options,
-            .address = address,
-        };
+    // Output result (unless suppressed)
+    if (!suppress_output) {
+        try edited.edits.writeTo(sink);
     }
-
-    return error.InvalidExpression;
 }
 
-fn processFile(allocator: std.mem.Allocator, filepath: []const u8, cmd: SedCommand, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool) !void {
+/// Process file with multiple commands
+fn processFileMulti(allocator: std.mem.Allocator, filepath: []const u8, commands: []const SedCommand, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
     const file = std.fs.cwd().openFile(filepath, .{}) catch |err| {
         std.debug.print("Error opening {s}: {}\n", .{ filepath, err });
         return;
     };
     defer file.close();
 
+    const read_start = std.time.nanoTimestamp();
     const stat = try file.stat();
     const file_size = stat.size;
 
@@ -860,260 +1033,378 @@ fn processFile(allocator: std.mem.Allocator, filepath: []const u8, cmd: SedComma
         std.debug.print("File: {s} ({d} bytes)\n", .{ filepath, file_size });
     }
 
-    const text = try file.readToEndAlloc(allocator, gpu.MAX_GPU_BUFFER_SIZE);
-    defer allocator.free(text);
+    // Inputs larger than one GPU buffer stream in chunks even without --max-memory
+    const plan = memory_plan orelse memory_budget.Plan.unlimited();
+    if (plan.needsChunking(file_size) or memory_plan != null) {
+        var magic: [4]u8 = undefined;
+        const codec = compressed.detect(magic[0..try file.preadAll(&magic, 0)]);
+        // Under --max-memory compressed input streams whatever its size: its
+        // decoded size is unknown until it has been decoded
+        if (if (codec == .none) plan.needsChunking(file_size) else memory_plan != null) {
+            if (verbose) std.debug.print("Streaming in {d}-byte chunks\n", .{plan.chunk_size});
+            const source = ChunkSource{ .file = file, .path = filepath, .mode = stat.mode, .codec = codec };
+            return processChunked(allocator, source, commands, plan, backend_mode, verbose, in_place, suppress_output, sink);
+        }
+    }
 
-    // Select backend
-    // Note: cpu_gnu maps to .cpu backend but uses cpu_gnu module for matching
-    const backend: gpu.Backend = switch (backend_mode) {
-        .auto => selectOptimalBackend(cmd.pattern.len, file_size),
-        .gpu_mode => if (build_options.is_macos) .metal else .vulkan,
-        .cpu_mode, .cpu_gnu => .cpu,
-        .metal => .metal,
-        .vulkan => .vulkan,
-    };
+    const data = try readFileAligned(allocator, file, compressed.MAX_DECOMPRESSED_SIZE);
+    // --cache-dir records plain inputs, hashed before the commands edit them
+    const content_hash: ?result_cache.Key = if (edit_cache != null and compressed.detect(data) == .none) result_cache.hashBytes(data) else null;
+    const read_stat = if (content_hash != null) stableStat(file, stat, read_start) else null;
+    if (content_hash) |hash| {
+        if (contentUnchanged(hash, read_stat)) {
+            defer allocator.free(data);
+            if (verbose) std.debug.print("Unchanged (cached)\n", .{});
+            if (!in_place) try sink.write(data);
+            return;
+        }
+    }
+    const input = try decodeInput(allocator, data, verbose);
+    defer input.deinit(allocator);
 
-    if (verbose) {
-        std.debug.print("Backend: {s}\n", .{@tagName(backend)});
+    var edited = try applyCommands(allocator, input.text, commands, backend_mode, verbose, suppress_output, sink, null);
+    defer edited.deinit(allocator);
+
+    // Unchanged output under -i leaves the file (and its cached identity) alone
+    if (content_hash) |hash| {
+        if (recordEdit(read_stat, hash, &edited.edits) and in_place) return;
     }
 
-    switch (cmd.cmd_type) {
-        .substitute => try processSubstitute(allocator, text, cmd, backend, verbose, in_place, suppress_output, filepath),
-        .delete => try processDelete(allocator, text, cmd, backend, verbose, suppress_output),
-        .print => try processPrint(allocator, text, cmd, backend, verbose, suppress_output),
-        .transliterate => try processTransliterate(allocator, text, cmd, backend, verbose, in_place, suppress_output, filepath),
+    if (in_place and input.codec != .none) {
+        // Keep foo.gz a gzip file: recompress with the codec it came in, beside
+        // the original, which is only replaced once the compressor succeeded
+        const current_text = try edited.edits.toOwnedSlice(allocator);
+        defer allocator.free(current_text);
+        var tmp_buf: [std.fs.max_path_bytes]u8 = undefined;
+        const tmp = try createBeside(filepath, stat.mode, &tmp_buf);
+        errdefer std.fs.cwd().deleteFile(tmp.path) catch {};
+        {
+            defer tmp.file.close();
+            try compressed.compressTo(allocator, input.codec, current_text, tmp.file);
+        }
+        try std.fs.cwd().rename(tmp.path, filepath);
+        return;
     }
+    try writeFileResult(allocator, filepath, &edited.edits, in_place, suppress_output, sink);
 }
 
-fn selectOptimalBackend(pattern_len: usize, file_size: u64) gpu.Backend {
-    // GPU is better for larger files and most patterns
-    if (file_size < gpu.MIN_GPU_SIZE) return .cpu;
-    if (file_size > gpu.MAX_GPU_BUFFER_SIZE) return .cpu;
+/// Input of a chunked run
+const ChunkSource = struct {
+    file: std.fs.File,
+    /// Bytes already read from `file` (stdin, read until it outgrew the budget)
+    prefix: []const u8 = "",
+    /// A regular file: -i rewrites it
+    path: ?[]const u8 = null,
+    mode: std.fs.File.Mode = std.fs.File.default_mode,
+    /// Compressed input is decoded as it is read
+    codec: compressed.Codec = .none,
+
+    /// Whether the text can be read twice (to count lines for $)
+    fn rereadable(self: ChunkSource) bool {
+        return self.path != null and self.codec == .none;
+    }
+};
 
-    // Prefer GPU for most workloads
-    _ = pattern_len;
-    if (build_options.is_macos) return .metal;
-    return .vulkan;
-}
+/// What one stage reads: a file (after `prefix`), or the decoder over it
+const StageInput = struct {
+    file: std.fs.File,
+    prefix: []const u8 = "",
+    decoder: ?*compressed.StreamDecoder = null,
+};
 
-fn processSubstitute(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, in_place: bool, suppress_output: bool, filepath: []const u8) !void {
-    // Find matches
-    var result = switch (backend) {
-        .metal => blk: {
-            if (build_options.is_macos) {
-                const substituter = gpu.metal.MetalSubstituter.init(allocator) catch |err| {
-                    if (verbose) std.debug.print("Metal init failed: {}, falling back to CPU\n", .{err});
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-                defer substituter.deinit();
-                break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                    substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-                else
-                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch |err| {
-                    if (verbose) std.debug.print("Metal failed: {}, falling back to CPU\n", .{err});
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-            } else {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            }
-        },
-        .vulkan => blk: {
-            const substituter = gpu.vulkan.VulkanSubstituter.init(allocator) catch |err| {
-                if (verbose) std.debug.print("Vulkan init failed: {}, falling back to CPU\n", .{err});
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-            defer substituter.deinit();
-            break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-            else
-                substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch |err| {
-                if (verbose) std.debug.print("Vulkan failed: {}, falling back to CPU\n", .{err});
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-        },
-        .cpu => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-        else => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-    };
-    defer result.deinit();
+/// A new file next to `path` (same directory, so it can be renamed over it)
+/// for a -i rewrite; its name is formatted into `buf`
+fn createBeside(path: []const u8, mode: std.fs.File.Mode, buf: *[std.fs.max_path_bytes]u8) !struct { file: std.fs.File, path: []const u8 } {
+    const tmp_path = try std.fmt.bufPrint(buf, "{s}.sed-{x}", .{ path, std.crypto.random.int(u32) });
+    const file = try std.fs.cwd().createFile(tmp_path, .{ .exclusive = true, .mode = mode });
+    return .{ .file = file, .path = tmp_path };
+}
 
-    if (verbose) {
-        std.debug.print("Found {d} matches\n\n", .{result.total_matches});
-    }
+/// Stream an input through the commands in line-aligned chunks of the plan's
+/// size. Commands run in stages that each read their whole input once: a new
+/// stage starts at a command addressing $ (it needs the line count of its
+/// input) and, under -n, at a second p (prints stay in command order, as in
+/// the in-memory path). A stage's output is spilled to an unlinked temporary
+/// file for the next one; the last stage writes to the sink or, with -i, to a
+/// temporary file renamed over the original (recompressed first when the
+/// input was compressed, which only the first stage decodes).
+fn processChunked(allocator: std.mem.Allocator, source: ChunkSource, commands: []const SedCommand, plan: memory_budget.Plan, backend_mode: BackendMode, verbose: bool, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    const decoder = if (source.codec != .none) try compressed.StreamDecoder.init(allocator, source.codec, source.file, source.prefix) else null;
+    defer if (decoder) |d| d.deinit();
+    const chunk_plan = if (decoder != null) plan.withDecoder() else plan;
+    var input = if (decoder != null) StageInput{ .file = source.file, .decoder = decoder } else StageInput{ .file = source.file, .prefix = source.prefix };
+    var spill: ?std.fs.File = null;
+    defer if (spill) |file| file.close();
+    var input_lines: ?u64 = null;
+
+    var start: usize = 0;
+    // A pipe or a decoded stream can't be read twice: copy it aside (an empty
+    // stage) to count its lines
+    var end: usize = if (!source.rereadable() and needsLastLine(commands[0])) 0 else stageEnd(commands, 0, suppress_output);
+    while (true) : ({
+        start = end;
+        end = stageEnd(commands, start, suppress_output);
+    }) {
+        const spans = try allocator.alloc(LineSpan, end - start);
+        defer allocator.free(spans);
+        @memset(spans, .{});
+        if (end > start and needsLastLine(commands[start])) {
+            spans[0].total = input_lines orelse try countFileLines(input.file);
+        }
 
-    // Build output with replacements
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(allocator);
+        if (end < commands.len) {
+            const next = try createSpill();
+            errdefer next.close();
+            var spill_sink = try output_sink.OutputSink.init(allocator, next.handle, .full);
+            defer spill_sink.deinit();
+            input_lines = try runStage(allocator, input, commands[start..end], spans, chunk_plan, backend_mode, verbose, suppress_output, sink, &spill_sink);
+            try spill_sink.flush();
+            try next.seekTo(0);
+
+            if (spill) |previous| previous.close();
+            spill = next;
+            input = .{ .file = next };
+            if (verbose) std.debug.print("Spilled commands [{d}..{d}) to disk ({d} lines)\n", .{ start, end, input_lines.? });
+            continue;
+        }
 
-    var last_pos: usize = 0;
-    for (result.matches) |match| {
-        // Append text before match
-        try output.appendSlice(allocator, text[last_pos..match.start]);
-        // Append replacement with & expansion
-        const matched_text = text[match.start..match.end];
-        try processReplacement(cmd.replacement, matched_text, &output, allocator);
-        last_pos = match.end;
+        if (in_place and source.path != null) {
+            // The original is still being read: build the new file beside it
+            const path = source.path.?;
+            var tmp_buf: [std.fs.max_path_bytes]u8 = undefined;
+            const tmp = try createBeside(path, source.mode, &tmp_buf);
+            errdefer std.fs.cwd().deleteFile(tmp.path) catch {};
+            {
+                defer tmp.file.close();
+                // Compressed input: spill the edited text, then recompress it
+                const out_file = if (source.codec == .none) tmp.file else try createSpill();
+                defer if (out_file.handle != tmp.file.handle) out_file.close();
+                var file_sink = try output_sink.OutputSink.init(allocator, out_file.handle, .full);
+                defer file_sink.deinit();
+                _ = try runStage(allocator, input, commands[start..end], spans, chunk_plan, backend_mode, verbose, suppress_output, sink, &file_sink);
+                try file_sink.flush();
+                if (source.codec != .none) {
+                    try out_file.seekTo(0);
+                    try compressed.compressFileTo(allocator, source.codec, out_file, tmp.file);
+                }
+            }
+            try std.fs.cwd().rename(tmp.path, path);
+        } else {
+            _ = try runStage(allocator, input, commands[start..end], spans, chunk_plan, backend_mode, verbose, suppress_output, sink, if (suppress_output) null else sink);
+        }
+        return;
     }
-    // Append remaining text
-    try output.appendSlice(allocator, text[last_pos..]);
+}
 
-    if (in_place) {
-        const out_file = try std.fs.cwd().createFile(filepath, .{});
-        defer out_file.close();
-        try out_file.writeAll(output.items);
-    } else if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, output.items) catch {};
-    }
+fn needsLastLine(cmd: SedCommand) bool {
+    const addr = cmd.address orelse return false;
+    return addr.is_last_line or addr.end_is_last;
 }
 
-fn processDelete(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, suppress_output: bool) !void {
-    // Find matching lines
-    var result = switch (backend) {
-        .metal => blk: {
-            if (build_options.is_macos) {
-                const substituter = gpu.metal.MetalSubstituter.init(allocator) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-                defer substituter.deinit();
-                break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                    substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-                else
-                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-            } else {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            }
-        },
-        .vulkan => blk: {
-            const substituter = gpu.vulkan.VulkanSubstituter.init(allocator) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-            defer substituter.deinit();
-            break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-            else
-                substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-        },
-        else => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-    };
-    defer result.deinit();
+/// End (exclusive) of the stage starting at commands[start]
+fn stageEnd(commands: []const SedCommand, start: usize, suppress_output: bool) usize {
+    var saw_print = start < commands.len and commands[start].cmd_type == .print;
+    var end = start + 1;
+    while (end < commands.len) : (end += 1) {
+        const cmd = commands[end];
+        if (needsLastLine(cmd)) break;
+        if (suppress_output and cmd.cmd_type == .print) {
+            if (saw_print) break;
+            saw_print = true;
+        }
+    }
+    return @min(end, commands.len);
+}
 
-    // Build set of lines to delete
-    var delete_lines = std.AutoHashMap(u32, void).init(allocator);
-    defer delete_lines.deinit();
-    for (result.matches) |match| {
-        try delete_lines.put(match.line_num, {});
+/// Run one stage over its whole input, chunk by chunk, writing the result to
+/// `out` (null discards it). Returns the line count of what was written.
+fn runStage(allocator: std.mem.Allocator, input: StageInput, commands: []const SedCommand, spans: []LineSpan, plan: memory_budget.Plan, backend_mode: BackendMode, verbose: bool, suppress_output: bool, sink: *output_sink.OutputSink, out: ?*output_sink.OutputSink) !u64 {
+    var reader = ChunkReader{ .file = input.file, .decoder = input.decoder, .chunk_size = plan.chunk_size };
+    defer reader.deinit(allocator);
+    try reader.carry.appendSlice(allocator, input.prefix);
+
+    var newlines: u64 = 0;
+    var last_byte: ?u8 = null;
+    while (try reader.next(allocator)) |chunk| {
+        defer allocator.free(chunk);
+        var edited = try applyCommands(allocator, chunk, commands, backend_mode, verbose, suppress_output, sink, spans);
+        defer edited.deinit(allocator);
+
+        const o = out orelse continue;
+        try edited.edits.writeTo(o);
+        for (edited.edits.pieces.items) |piece| {
+            const bytes = edited.edits.pieceBytes(piece);
+            newlines += std.mem.count(u8, bytes, "\n");
+            last_byte = bytes[bytes.len - 1];
+        }
     }
+    // countLines() of the written text, without holding it
+    const last = last_byte orelse return 1;
+    return newlines + @intFromBool(last != '\n');
+}
 
-    if (verbose) {
-        std.debug.print("Deleting {d} lines\n\n", .{delete_lines.count()});
+/// Line count of a regular file as countLines() would report it; leaves the
+/// file positioned at its start
+fn countFileLines(file: std.fs.File) !u64 {
+    var buf: [64 * 1024]u8 = undefined;
+    var newlines: u64 = 0;
+    var last_byte: ?u8 = null;
+    try file.seekTo(0);
+    while (true) {
+        const n = try file.read(&buf);
+        if (n == 0) break;
+        newlines += std.mem.count(u8, buf[0..n], "\n");
+        last_byte = buf[n - 1];
     }
+    try file.seekTo(0);
+    const last = last_byte orelse return 1;
+    return newlines + @intFromBool(last != '\n');
+}
 
-    if (suppress_output) return;
+/// An unlinked read-write temporary file (gone when closed)
+fn createSpill() !std.fs.File {
+    const dir = std.posix.getenv("TMPDIR") orelse "/tmp";
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    const path = try std.fmt.bufPrint(&path_buf, "{s}/sed-spill-{x}", .{ dir, std.crypto.random.int(u64) });
+    const file = try std.fs.cwd().createFile(path, .{ .read = true, .exclusive = true, .mode = 0o600 });
+    std.fs.cwd().deleteFile(path) catch {};
+    return file;
+}
 
-    // Output non-deleted lines
-    var line_num: u32 = 0;
-    var line_start: usize = 0;
+/// Reads a file (or the text decoded from it) in chunks of about `chunk_size`
+/// bytes that end on a line boundary; the partial line after the last newline
+/// carries into the next
+const ChunkReader = struct {
+    file: std.fs.File,
+    decoder: ?*compressed.StreamDecoder = null,
+    chunk_size: usize,
+    carry: std.ArrayListUnmanaged(u8) = .{},
+    at_eof: bool = false,
+
+    fn deinit(self: *ChunkReader, allocator: std.mem.Allocator) void {
+        self.carry.deinit(allocator);
+    }
 
-    for (text, 0..) |c, i| {
-        if (c == '\n' or i == text.len - 1) {
-            const line_end = if (c == '\n') i + 1 else i + 1;
-            if (!delete_lines.contains(line_num)) {
-                _ = std.posix.write(std.posix.STDOUT_FILENO, text[line_start..line_end]) catch {};
+    /// Next chunk (caller owns it), null once the input is exhausted
+    fn next(self: *ChunkReader, allocator: std.mem.Allocator) !?[]u8 {
+        var chunk: std.ArrayListUnmanaged(u8) = .{};
+        errdefer chunk.deinit(allocator);
+        try chunk.ensureTotalCapacity(allocator, @max(self.chunk_size, self.carry.items.len));
+        chunk.appendSliceAssumeCapacity(self.carry.items);
+        self.carry.clearRetainingCapacity();
+
+        while (!self.at_eof) {
+            if (chunk.items.len >= self.chunk_size) {
+                if (std.mem.indexOfScalar(u8, chunk.items, '\n') != null) break;
+                // A line longer than a chunk: the chunk grows to hold it
+                try chunk.ensureUnusedCapacity(allocator, self.chunk_size);
             }
-            line_start = i + 1;
-            line_num += 1;
+            const n = if (self.decoder) |decoder| try decoder.read(chunk.unusedCapacitySlice()) else try self.file.read(chunk.unusedCapacitySlice());
+            if (n == 0) self.at_eof = true;
+            chunk.items.len += n;
         }
+        if (chunk.items.len == 0) {
+            chunk.deinit(allocator);
+            return null;
+        }
+        if (!self.at_eof) {
+            const cut = std.mem.lastIndexOfScalar(u8, chunk.items, '\n').? + 1;
+            try self.carry.appendSlice(allocator, chunk.items[cut..]);
+            chunk.shrinkRetainingCapacity(cut);
+        }
+        return try chunk.toOwnedSlice(allocator);
     }
-}
+};
 
-fn processPrint(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, suppress_output: bool) !void {
-    // Find matching lines
-    var result = switch (backend) {
-        .metal => blk: {
-            if (build_options.is_macos) {
-                const substituter = gpu.metal.MetalSubstituter.init(allocator) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-                defer substituter.deinit();
-                break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                    substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-                else
-                    substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                    break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-                };
-            } else {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            }
-        },
-        .vulkan => blk: {
-            const substituter = gpu.vulkan.VulkanSubstituter.init(allocator) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-            defer substituter.deinit();
-            break :blk (if (needsRegex(cmd.pattern, cmd.options))
-                substituter.findMatchesRegex(text, cmd.pattern, cmd.options, allocator)
-            else
-                substituter.findMatches(text, cmd.pattern, cmd.options, allocator)) catch {
-                break :blk try doFindMatches(text, cmd.pattern, cmd.options, allocator);
-            };
-        },
-        else => try doFindMatches(text, cmd.pattern, cmd.options, allocator),
-    };
-    defer result.deinit();
+const AlignedText = []align(std.heap.page_size_min) u8;
+
+const DecodedInput = struct {
+    /// The input itself when it was plain text
+    text: []u8,
+    codec: compressed.Codec,
 
-    // Build set of lines to print
-    var print_lines = std.AutoHashMap(u32, void).init(allocator);
-    defer print_lines.deinit();
-    for (result.matches) |match| {
-        try print_lines.put(match.line_num, {});
+    fn deinit(self: DecodedInput, allocator: std.mem.Allocator) void {
+        if (self.codec == .none) {
+            const data: AlignedText = @alignCast(self.text);
+            allocator.free(data);
+        } else {
+            allocator.free(self.text);
+        }
     }
+};
 
+/// Decompress gzip or zstd input (detected by magic number); takes ownership
+/// of `data`, plain text passes through untouched
+fn decodeInput(allocator: std.mem.Allocator, data: AlignedText, verbose: bool) !DecodedInput {
+    const codec = compressed.detect(data);
+    if (codec == .none) return .{ .text = data, .codec = .none };
+    defer allocator.free(data);
+
+    var timer = try std.time.Timer.start();
+    // A budgeted run streams compressed input; what still gets here is small
+    const max_workers: usize = if (memory_plan != null) 1 else std.math.maxInt(usize);
+    const text = try compressed.decompress(allocator, codec, data, max_workers);
     if (verbose) {
-        std.debug.print("Printing {d} matching lines\n\n", .{print_lines.count()});
+        std.debug.print("Decompressed {s}: {d} -> {d} bytes in {d:.2}ms\n", .{ @tagName(codec), data.len, text.len, @as(f64, @floatFromInt(timer.read())) / 1_000_000.0 });
     }
+    return .{ .text = text, .codec = codec };
+}
 
-    if (suppress_output) return;
-
-    // Output matching lines
-    var line_num: u32 = 0;
-    var line_start: usize = 0;
+/// Write a file's final text, piece by piece: back to the file with -i, otherwise to the output sink
+fn writeFileResult(allocator: std.mem.Allocator, filepath: []const u8, edits: *const PieceTable, in_place: bool, suppress_output: bool, sink: *output_sink.OutputSink) !void {
+    if (in_place) {
+        try writeInPlace(allocator, filepath, edits);
+    } else if (!suppress_output) {
+        try edits.writeTo(sink);
+    }
+}
 
-    for (text, 0..) |c, i| {
-        if (c == '\n' or i == text.len - 1) {
-            const line_end = if (c == '\n') i + 1 else i + 1;
-            if (print_lines.contains(line_num)) {
-                _ = std.posix.write(std.posix.STDOUT_FILENO, text[line_start..line_end]) catch {};
-            }
-            line_start = i + 1;
-            line_num += 1;
-        }
+/// Read a whole file into a page-aligned buffer, so the Vulkan backend can
+/// import it as the text buffer instead of copying it
+fn readFileAligned(allocator: std.mem.Allocator, file: std.fs.File, max_bytes: usize) !AlignedText {
+    const size = (try file.stat()).size;
+    if (size > max_bytes) return error.FileTooBig;
+    var text = try allocator.alignedAlloc(u8, .fromByteUnits(std.heap.page_size_min), @intCast(size));
+    errdefer allocator.free(text);
+    var len = try file.readAll(text);
+    // Read on past the size stat reported: files that grew, or report none (/proc)
+    while (len == text.len) {
+        var probe: [16 * 1024]u8 = undefined;
+        const n = try file.read(&probe);
+        if (n == 0) break;
+        if (len + n > max_bytes) return error.FileTooBig;
+        text = try allocator.realloc(text, @min(max_bytes, @max(len + n, 2 * len)));
+        @memcpy(text[len..][0..n], probe[0..n]);
+        len += n;
+        len += try file.readAll(text[len..]);
     }
+    return allocator.realloc(text, len);
 }
 
-fn processTransliterate(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, backend: gpu.Backend, verbose: bool, in_place: bool, suppress_output: bool, filepath: []const u8) !void {
-    // Make a mutable copy
-    const mutable_text = try allocator.alloc(u8, text.len);
-    defer allocator.free(mutable_text);
-    @memcpy(mutable_text, text);
+/// Replace a file's contents through a dedicated (fully buffered) sink
+fn writeInPlace(allocator: std.mem.Allocator, filepath: []const u8, edits: *const PieceTable) !void {
+    const out_file = try std.fs.cwd().createFile(filepath, .{});
+    defer out_file.close();
+    var file_sink = try output_sink.OutputSink.init(allocator, out_file.handle, .full);
+    defer file_sink.deinit();
+    try edits.writeTo(&file_sink);
+    try file_sink.flush();
+}
 
-    // Transliterate
-    _ = backend; // TODO: GPU transliterate
-    cpu.transliterate(mutable_text, cmd.pattern, cmd.replacement);
+fn selectOptimalBackend(cmd_type: CommandType, pattern_len: usize, file_size: u64) gpu.Backend {
+    // GPU is better for larger files and most patterns
+    if (file_size < gpu.MIN_GPU_SIZE) return .cpu;
+    if (file_size > gpu.MAX_GPU_BUFFER_SIZE) return .cpu;
 
-    if (verbose) {
-        std.debug.print("Transliterated {d} bytes\n\n", .{mutable_text.len});
-    }
+    // y/// does one table lookup per byte, so the GPU only pays off on large inputs
+    if (cmd_type == .transliterate and file_size < gpu.MIN_GPU_TRANSLITERATE_SIZE) return .cpu;
 
-    if (in_place) {
-        const out_file = try std.fs.cwd().createFile(filepath, .{});
-        defer out_file.close();
-        try out_file.writeAll(mutable_text);
-    } else if (!suppress_output) {
-        _ = std.posix.write(std.posix.STDOUT_FILENO, mutable_text) catch {};
-    }
+    // Prefer GPU for most workloads
+    _ = pattern_len;
+    if (build_options.is_macos) return .metal;
+    // Hosts known to have no device skip the probe (and its fallback) entirely
+    if (!gpu.vulkan.available()) return .cpu;
+    return .vulkan;
 }
 
 fn printUsage() void {
@@ -1130,6 +1421,16 @@ fn printUsage() void {
         \\  -E, -r, --regexp-extended
         \\                           use extended regex (ERE)               [GPU+SIMD]
         \\  -i, --in-place           edit files in place                    [GPU+SIMD]
+        \\  -u, --unbuffered         flush output after every write
+        \\  -F FILE                  run a script precompiled with --compile-script
+        \\      --compile-script FILE -o OUTPUT
+        \\                           precompile a script file (one command per line)
+        \\      --max-memory SIZE    keep peak memory near SIZE (e.g. 512M): stream large
+        \\                           inputs in chunks, spill to temporary files
+        \\      --cache-dir DIR      remember which files the script leaves unchanged and
+        \\                           skip them on later runs (keyed by script and file)
+        \\      --huge-pages MODE    back large buffers with huge pages: madvise (default,
+        \\                           transparent), hugetlb (reserved pages) or off
         \\  -V, --verbose            print backend and timing info
         \\  -h, --help               display this help and exit
         \\      --version            output version information and exit
@@ -1141,6 +1442,11 @@ fn printUsage() void {
         \\  --gnu                    force GNU sed backend (GPL, full features)
         \\  --metal                  force Metal backend (macOS only)
         \\  --vulkan                 force Vulkan backend
+        \\  --gpu-autotune           time Vulkan kernel shapes on this GPU and cache the best
+        \\
+        \\Resident mode:
+        \\  --serve SOCKET           stay resident on a Unix socket with a warm GPU context
+        \\  --client SOCKET ARGS...  run ARGS in the daemon at SOCKET (locally if none)
         \\
         \\Commands:
         \\  s/REGEXP/REPLACEMENT/FLAGS                                      [GPU+SIMD]
@@ -1148,7 +1454,7 @@ fn printUsage() void {
         \\      FLAGS: g (global), i (ignore case), 1 (first only)
         \\      Special: & = matched text, \n \t = newline/tab
         \\
-        \\  y/SOURCE/DEST/                                                  [SIMD]
+        \\  y/SOURCE/DEST/                                                  [GPU+SIMD]
         \\      Transliterate characters (256-byte lookup, 32-byte unroll)
         \\
         \\  /REGEXP/d                                                       [GPU+SIMD]
@@ -1183,61 +1489,254 @@ fn printUsage() void {
     _ = std.posix.write(std.posix.STDOUT_FILENO, help_text) catch {};
 }
 
-test "parse substitute expression" {
-    const cmd = try parseSedExpression("s/foo/bar/g");
-    try std.testing.expectEqual(CommandType.substitute, cmd.cmd_type);
-    try std.testing.expectEqualStrings("foo", cmd.pattern);
-    try std.testing.expectEqualStrings("bar", cmd.replacement);
-    try std.testing.expect(cmd.options.global);
-}
-
-test "parse transliterate expression" {
-    const cmd = try parseSedExpression("y/abc/xyz/");
-    try std.testing.expectEqual(CommandType.transliterate, cmd.cmd_type);
-    try std.testing.expectEqualStrings("abc", cmd.pattern);
-    try std.testing.expectEqualStrings("xyz", cmd.replacement);
+test {
+    _ = output_sink;
+    _ = batch;
+    _ = server;
+    _ = script;
+    _ = script_artifact;
+    _ = compressed;
+    _ = piece_table;
+    _ = memory_budget;
+    _ = huge_pages;
+    _ = result_cache;
 }
 
-test "parse delete expression" {
-    const cmd = try parseSedExpression("/error/d");
-    try std.testing.expectEqual(CommandType.delete, cmd.cmd_type);
-    try std.testing.expectEqualStrings("error", cmd.pattern);
+/// Everything written to `file` so far (a test sink's output)
+fn readBack(allocator: std.mem.Allocator, file: std.fs.File) ![]u8 {
+    try file.seekTo(0);
+    return file.readToEndAlloc(allocator, std.math.maxInt(usize));
 }
 
-test "parse print expression" {
-    const cmd = try parseSedExpression("/error/p");
-    try std.testing.expectEqual(CommandType.print, cmd.cmd_type);
-    try std.testing.expectEqualStrings("error", cmd.pattern);
+test "a capped batch dispatch redoes its files one at a time" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const out = try tmp.dir.createFile("out", .{ .read = true });
+    defer out.close();
+    var sink = try output_sink.OutputSink.init(allocator, out.handle, .full);
+    defer sink.deinit();
+
+    const cmd = try parseSedExpression("s/x/y/g");
+    var pending = batch.Batch.init(allocator);
+    defer pending.deinit();
+    _ = try pending.append(0, "ax\nbx\n");
+    _ = try pending.append(1, "xx");
+    const files = [_][]const u8{ "first", "second" };
+
+    var full = try doFindMatches(pending.text.items, cmd.pattern, cmd.options, allocator);
+    defer full.deinit();
+    try std.testing.expectEqual(@as(u64, 4), full.total_matches);
+    // What a dispatch whose results buffer filled after one record returns
+    var capped = gpu.SubstituteResult{ .matches = try allocator.dupe(gpu.MatchResult, full.matches[0..1]), .total_matches = full.total_matches, .allocator = allocator };
+    defer capped.deinit();
+
+    try writeBatch(allocator, &pending, &files, &.{}, cmd, &full, .cpu_mode, false, false, false, &sink);
+    try sink.flush();
+    const split = try readBack(allocator, out);
+    defer allocator.free(split);
+    try std.testing.expectEqualStrings("ay\nby\nyy", split);
+
+    try out.setEndPos(0);
+    try out.seekTo(0);
+    try writeBatch(allocator, &pending, &files, &.{}, cmd, &capped, .cpu_mode, false, false, false, &sink);
+    try sink.flush();
+    const redone = try readBack(allocator, out);
+    defer allocator.free(redone);
+    try std.testing.expectEqualStrings(split, redone);
 }
 
-test "processReplacement: & expands to matched text" {
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(std.testing.allocator);
+/// Chunks far smaller than the input, so every test line crosses a few
+const tiny_plan = memory_budget.Plan{ .budget = 256, .chunk_size = 64, .batch_bytes = 64 };
 
-    try processReplacement("[&]", "hello", &output, std.testing.allocator);
-    try std.testing.expectEqualStrings("[hello]", output.items);
+/// Numbered test lines, `count` of them; the last has no newline
+fn numberedLines(allocator: std.mem.Allocator, count: usize) ![]u8 {
+    var text: std.ArrayListUnmanaged(u8) = .{};
+    errdefer text.deinit(allocator);
+    for (1..count + 1) |n| try text.print(allocator, "line {d} foo{s}", .{ n, if (n < count) "\n" else "" });
+    return text.toOwnedSlice(allocator);
 }
 
-test "processReplacement: escaped ampersand" {
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(std.testing.allocator);
-
-    try processReplacement("\\&", "hello", &output, std.testing.allocator);
-    try std.testing.expectEqualStrings("&", output.items);
+/// What the in-memory path writes for `commands` over `input`
+fn wholeOutput(allocator: std.mem.Allocator, dir: std.fs.Dir, input: []const u8, commands: []const SedCommand, quiet: bool) ![]u8 {
+    const out = try dir.createFile("whole", .{ .read = true });
+    defer out.close();
+    var sink = try output_sink.OutputSink.init(allocator, out.handle, .full);
+    defer sink.deinit();
+    const text = try allocator.dupe(u8, input);
+    defer allocator.free(text);
+    var edited = try applyCommands(allocator, text, commands, .cpu_mode, false, quiet, &sink, null);
+    defer edited.deinit(allocator);
+    if (!quiet) try edited.edits.writeTo(&sink);
+    try sink.flush();
+    return readBack(allocator, out);
 }
 
-test "processReplacement: escape sequences" {
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(std.testing.allocator);
+test "chunked runs match the in-memory path" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const input = try numberedLines(allocator, 40);
+    defer allocator.free(input);
+    try tmp.dir.writeFile(.{ .sub_path = "in", .data = input });
+
+    const Case = struct { expressions: []const []const u8, quiet: bool = false };
+    const cases = [_]Case{
+        .{ .expressions = &.{ "s/foo/bar/g", "5,9d" } },
+        // $ after the first command: the first stage spills for the second
+        .{ .expressions = &.{ "s/o/0/", "$s/f0o/END/", "30,$d" } },
+        // $ first: a pipe is copied aside to count its lines
+        .{ .expressions = &.{ "$d", "s/line/L/" } },
+        // -n with a second p: each p is its own pass, prints in command order
+        .{ .expressions = &.{ "/1/p", "s/foo/bar/", "/bar/p" }, .quiet = true },
+    };
+    for (cases) |case| {
+        var commands: [4]SedCommand = undefined;
+        for (commands[0..case.expressions.len], case.expressions) |*cmd, expr| cmd.* = try parseSedExpression(expr);
+        const cmds = commands[0..case.expressions.len];
+        const expected = try wholeOutput(allocator, tmp.dir, input, cmds, case.quiet);
+        defer allocator.free(expected);
+
+        // As a regular file (read twice for $) and as a pipe would be
+        for ([_]?[]const u8{ "in", null }) |path| {
+            const in = try tmp.dir.openFile("in", .{});
+            defer in.close();
+            const out = try tmp.dir.createFile("chunked", .{ .read = true });
+            defer out.close();
+            var sink = try output_sink.OutputSink.init(allocator, out.handle, .full);
+            defer sink.deinit();
+            try processChunked(allocator, .{ .file = in, .path = path }, cmds, tiny_plan, .cpu_mode, false, false, case.quiet, &sink);
+            try sink.flush();
+            const chunked = try readBack(allocator, out);
+            defer allocator.free(chunked);
+            try std.testing.expectEqualStrings(expected, chunked);
+        }
+    }
+}
 
-    try processReplacement("a\\nb\\tc", "X", &output, std.testing.allocator);
-    try std.testing.expectEqualStrings("a\nb\tc", output.items);
+test "chunked -i renames the rewritten file over the original" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const input = try numberedLines(allocator, 30);
+    defer allocator.free(input);
+    try tmp.dir.writeFile(.{ .sub_path = "in", .data = input });
+    const dir_path = try tmp.dir.realpathAlloc(allocator, ".");
+    defer allocator.free(dir_path);
+    const path = try std.fs.path.join(allocator, &.{ dir_path, "in" });
+    defer allocator.free(path);
+
+    const commands = [_]SedCommand{ try parseSedExpression("s/foo/bar/"), try parseSedExpression("$d") };
+    const expected = try wholeOutput(allocator, tmp.dir, input, &commands, false);
+    defer allocator.free(expected);
+    try tmp.dir.deleteFile("whole");
+
+    {
+        const in = try tmp.dir.openFile("in", .{});
+        defer in.close();
+        var sink = try output_sink.OutputSink.init(allocator, std.posix.STDOUT_FILENO, .full);
+        defer sink.deinit();
+        try processChunked(allocator, .{ .file = in, .path = path, .mode = 0o640 }, &commands, tiny_plan, .cpu_mode, false, true, false, &sink);
+        // Nothing reaches the output under -i
+        try std.testing.expectEqual(@as(usize, 0), sink.len);
+    }
+    const rewritten = try tmp.dir.readFileAlloc(allocator, "in", 1 << 20);
+    defer allocator.free(rewritten);
+    try std.testing.expectEqualStrings(expected, rewritten);
+    try std.testing.expectEqual(@as(std.fs.File.Mode, 0o640), (try tmp.dir.statFile("in")).mode & 0o777);
+
+    // The temporary file was renamed, not left beside it
+    var it = tmp.dir.iterate();
+    var entries: usize = 0;
+    while (try it.next()) |_| entries += 1;
+    try std.testing.expectEqual(@as(usize, 1), entries);
 }
 
-test "processReplacement: mixed & and escapes" {
-    var output: std.ArrayListUnmanaged(u8) = .{};
-    defer output.deinit(std.testing.allocator);
+test "cache-dir skips files by identity only when they held still" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    try tmp.dir.makeDir("cache");
+    const cache_path = try tmp.dir.realpathAlloc(allocator, "cache");
+    defer allocator.free(cache_path);
+    const dir_path = try tmp.dir.realpathAlloc(allocator, ".");
+    defer allocator.free(dir_path);
+
+    const commands = [_]SedCommand{try parseSedExpression("s/x/y/")};
+    edit_cache = try result_cache.ResultCache.open(cache_path, &commands);
+    defer {
+        edit_cache.?.close();
+        edit_cache = null;
+    }
 
-    try processReplacement("<&>\\n", "FOO", &output, std.testing.allocator);
-    try std.testing.expectEqualStrings("<FOO>\n", output.items);
+    const out = try tmp.dir.createFile("out", .{ .read = true });
+    defer out.close();
+    var sink = try output_sink.OutputSink.init(allocator, out.handle, .full);
+    defer sink.deinit();
+
+    // Written well before the run, so the racy-clean guard lets them vouch
+    const old_mtime = std.time.nanoTimestamp() - 60 * std.time.ns_per_s;
+    const names = [_][]const u8{ "kept", "edited" };
+    const contents = [_][]const u8{ "abc\n", "xyz\n" };
+    var paths: [names.len][]const u8 = undefined;
+    for (&paths, names, contents) |*path, name, text| {
+        try tmp.dir.writeFile(.{ .sub_path = name, .data = text });
+        const file = try tmp.dir.openFile(name, .{ .mode = .read_write });
+        defer file.close();
+        try file.updateTimes(old_mtime, old_mtime);
+        path.* = try std.fs.path.join(allocator, &.{ dir_path, name });
+    }
+    defer for (paths) |path| allocator.free(path);
+
+    try processInputs(allocator, &paths, false, &commands, .cpu_mode, false, false, false, &sink);
+    const first = try readBack(allocator, out);
+    defer allocator.free(first);
+    try std.testing.expectEqualStrings("abc\nyyz\n", first);
+
+    // The no-op is skipped by its stat alone; the edited file is not
+    if (openIfUnchanged(paths[0])) |file| file.close() else return error.TestExpectedCached;
+    try std.testing.expect(openIfUnchanged(paths[1]) == null);
+
+    // Same size, new mtime: the stat no longer matches and the file is re-edited
+    {
+        try tmp.dir.writeFile(.{ .sub_path = "kept", .data = "abx\n" });
+        const file = try tmp.dir.openFile("kept", .{ .mode = .read_write });
+        defer file.close();
+        try file.updateTimes(old_mtime + std.time.ns_per_s, old_mtime + std.time.ns_per_s);
+    }
+    try std.testing.expect(openIfUnchanged(paths[0]) == null);
+    try out.setEndPos(0);
+    try out.seekTo(0);
+    try processInputs(allocator, paths[0..1], false, &commands, .cpu_mode, false, false, false, &sink);
+    const second = try readBack(allocator, out);
+    defer allocator.free(second);
+    try std.testing.expectEqualStrings("aby\n", second);
+
+    // Modified just now: its contents are recorded, its identity is not
+    try tmp.dir.writeFile(.{ .sub_path = "fresh", .data = "abc\n" });
+    const fresh_path = try std.fs.path.join(allocator, &.{ dir_path, "fresh" });
+    defer allocator.free(fresh_path);
+    try processInputs(allocator, &.{fresh_path}, false, &commands, .cpu_mode, false, false, false, &sink);
+    try std.testing.expect(openIfUnchanged(fresh_path) == null);
+    try std.testing.expect(contentUnchanged(result_cache.hashBytes("abc\n"), null));
+
+    // Changed between the stats around the read: no identity to record
+    {
+        try tmp.dir.writeFile(.{ .sub_path = "moving", .data = "abc\n" });
+        const file = try tmp.dir.openFile("moving", .{ .mode = .read_write });
+        defer file.close();
+        try file.updateTimes(old_mtime, old_mtime);
+        const read_start = std.time.nanoTimestamp();
+        const before = try file.stat();
+        try file.pwriteAll("abc\nmore\n", 0);
+        try std.testing.expect(stableStat(file, before, read_start) == null);
+
+        var edits = PieceTable.init(allocator, "abc\n");
+        defer edits.deinit();
+        try edits.appendOriginal(0, 4);
+        try std.testing.expect(recordEdit(null, result_cache.hashBytes("abc\n"), &edits));
+    }
+    const moving_path = try std.fs.path.join(allocator, &.{ dir_path, "moving" });
+    defer allocator.free(moving_path);
+    try std.testing.expect(openIfUnchanged(moving_path) == null);
 }
@@ -0,0 +1,96 @@
+const std = @import("std");
+const gpu = @import("gpu");
+
+// --max-memory: sizes the pieces of a run so that its peak stays near the
+// budget. Inputs larger than one chunk are streamed through the commands in
+// line-aligned chunks, and anything that must see the whole text first
+// (a later command addressing `$`, the rewritten file under -i) goes through
+// temporary files instead of memory.
+
+/// Live copies of a chunk at the peak of a command: the chunk itself, the
+/// previous command's flattened output, the piece table and added bytes, and
+/// headroom for match results and line selections
+const CHUNK_COPIES = 4;
+
+/// Output sink, stack buffers and allocator slack, outside any chunk
+const FIXED_OVERHEAD: usize = 1024 * 1024;
+
+/// Smallest chunk worth a read; a budget below this is met on a best-effort basis
+pub const MIN_CHUNK_SIZE: usize = 64 * 1024;
+
+/// A stream decoder for compressed input keeps a window of this size
+const DECODER_WINDOW: usize = std.compress.zstd.default_window_len + std.compress.zstd.block_size_max;
+
+pub const Plan = struct {
+    budget: usize,
+    /// Input bytes per chunk (a line longer than this makes its chunk larger)
+    chunk_size: usize,
+    /// Text packed into one batched GPU dispatch
+    batch_bytes: usize,
+
+    pub fn init(budget: usize) Plan {
+        const usable = budget -| FIXED_OVERHEAD;
+        const chunk_size = std.math.clamp(usable / CHUNK_COPIES, MIN_CHUNK_SIZE, gpu.MAX_GPU_BUFFER_SIZE);
+        return .{
+            .budget = budget,
+            .chunk_size = chunk_size,
+            // A batch holds its packed text plus each file's output
+            .batch_bytes = @max(chunk_size / 2, 2 * gpu.MIN_GPU_SIZE),
+        };
+    }
+
+    /// The plan for streamed compressed input: the decoder's window comes out
+    /// of the budget before it is split into chunks
+    pub fn withDecoder(self: Plan) Plan {
+        var plan = init(self.budget -| DECODER_WINDOW);
+        plan.budget = self.budget;
+        return plan;
+    }
+
+    /// No budget: inputs are only chunked once they outgrow one GPU buffer
+    pub fn unlimited() Plan {
+        return init(std.math.maxInt(usize));
+    }
+
+    /// Whether an input of `size` bytes has to be streamed in chunks
+    pub fn needsChunking(self: Plan, size: usize) bool {
+        return size > self.chunk_size;
+    }
+};
+
+/// Parse a size such as 4096, 512K, 256M or 2G (binary multiples)
+pub fn parseSize(text: []const u8) !usize {
+    if (text.len == 0) return error.InvalidSize;
+    const shift: u6 = switch (std.ascii.toUpper(text[text.len - 1])) {
+        'K' => 10,
+        'M' => 20,
+        'G' => 30,
+        else => 0,
+    };
+    const digits = if (shift == 0) text else text[0 .. text.len - 1];
+    const value = std.fmt.parseInt(usize, digits, 10) catch return error.InvalidSize;
+    return std.math.shlExact(usize, value, shift) catch error.InvalidSize;
+}
+
+test "parseSize" {
+    try std.testing.expectEqual(@as(usize, 4096), try parseSize("4096"));
+    try std.testing.expectEqual(@as(usize, 512 * 1024), try parseSize("512K"));
+    try std.testing.expectEqual(@as(usize, 256 * 1024 * 1024), try parseSize("256m"));
+    try std.testing.expectEqual(@as(usize, 2 * 1024 * 1024 * 1024), try parseSize("2G"));
+    try std.testing.expectError(error.InvalidSize, parseSize("M"));
+    try std.testing.expectError(error.InvalidSize, parseSize("12X"));
+}
+
+test "chunks shrink with the budget but stay readable" {
+    const roomy = Plan.init(1024 * 1024 * 1024);
+    try std.testing.expectEqual(gpu.MAX_GPU_BUFFER_SIZE, roomy.chunk_size);
+
+    const tight = Plan.init(16 * 1024 * 1024);
+    try std.testing.expect(tight.chunk_size * CHUNK_COPIES + FIXED_OVERHEAD <= 16 * 1024 * 1024);
+    try std.testing.expect(tight.needsChunking(8 * 1024 * 1024));
+
+    try std.testing.expectEqual(MIN_CHUNK_SIZE, Plan.init(1024).chunk_size);
+
+    const decoding = tight.withDecoder();
+    try std.testing.expect(decoding.chunk_size * CHUNK_COPIES + FIXED_OVERHEAD + DECODER_WINDOW <= 16 * 1024 * 1024);
+}
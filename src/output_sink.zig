@@ -0,0 +1,227 @@
+const std = @import("std");
+
+/// Size of each output buffer (page-aligned so direct writes hit the fast path)
+pub const BUFFER_SIZE: usize = 256 * 1024;
+
+const buffer_alignment = std.mem.Alignment.fromByteUnits(std.heap.page_size_min);
+
+/// When buffered output is pushed to the file descriptor
+pub const FlushPolicy = enum {
+    full, // Flush only when the buffer fills (pipes and files)
+    line, // Flush after every write that ends a line (TTYs)
+    unbuffered, // Flush after every write (-u/--unbuffered)
+
+    /// Pick the policy for a descriptor: -u wins, otherwise TTYs are line-buffered
+    pub fn detect(fd: std.posix.fd_t, unbuffered: bool) FlushPolicy {
+        if (unbuffered) return .unbuffered;
+        if (std.posix.isatty(fd)) return .line;
+        return .full;
+    }
+};
+
+/// High-throughput output sink shared by every command.
+/// Small writes are coalesced into one large aligned buffer; writes larger
+/// than the buffer bypass it entirely. Short writes and EAGAIN are retried.
+pub const OutputSink = struct {
+    fd: std.posix.fd_t,
+    buffer: []align(buffer_alignment.toByteUnits()) u8,
+    len: usize = 0,
+    policy: FlushPolicy,
+    bytes_written: u64 = 0,
+    write_calls: u64 = 0,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, fd: std.posix.fd_t, policy: FlushPolicy) !OutputSink {
+        const buffer = try allocator.alignedAlloc(u8, buffer_alignment, BUFFER_SIZE);
+        return OutputSink{ .fd = fd, .buffer = buffer, .policy = policy, .allocator = allocator };
+    }
+
+    /// Release the buffer. Callers must flush first; pending bytes are dropped.
+    pub fn deinit(self: *OutputSink) void {
+        self.allocator.free(self.buffer);
+    }
+
+    pub fn write(self: *OutputSink, bytes: []const u8) !void {
+        if (bytes.len == 0) return;
+
+        if (self.len + bytes.len <= self.buffer.len) {
+            @memcpy(self.buffer[self.len..][0..bytes.len], bytes);
+            self.len += bytes.len;
+        } else {
+            try self.flush();
+            if (bytes.len >= self.buffer.len) {
+                // Large run - skip the copy and write straight from the caller's memory
+                try self.writeAllDirect(bytes);
+            } else {
+                @memcpy(self.buffer[0..bytes.len], bytes);
+                self.len = bytes.len;
+            }
+        }
+
+        switch (self.policy) {
+            .full => {},
+            .line => if (bytes[bytes.len - 1] == '\n') try self.flush(),
+            .unbuffered => try self.flush(),
+        }
+    }
+
+    pub fn writeByte(self: *OutputSink, byte: u8) !void {
+        return self.write(&[_]u8{byte});
+    }
+
+    /// Write out the buffer. Bytes are only dropped once written, so after a
+    /// failed flush (EPIPE, ENOSPC) the unwritten rest is still pending.
+    pub fn flush(self: *OutputSink) !void {
+        while (self.len > 0) {
+            const n = try self.writeSome(self.buffer[0..self.len]);
+            if (n < self.len) std.mem.copyForwards(u8, self.buffer[0 .. self.len - n], self.buffer[n..self.len]);
+            self.len -= n;
+        }
+    }
+
+    /// Write every byte, retrying on short writes
+    fn writeAllDirect(self: *OutputSink, bytes: []const u8) !void {
+        var offset: usize = 0;
+        while (offset < bytes.len) offset += try self.writeSome(bytes[offset..]);
+    }
+
+    /// One write of a non-empty run, waiting out non-blocking descriptors; the
+    /// number of bytes written
+    fn writeSome(self: *OutputSink, bytes: []const u8) !usize {
+        while (true) {
+            const n = std.posix.write(self.fd, bytes) catch |err| switch (err) {
+                error.WouldBlock => {
+                    var fds = [_]std.posix.pollfd{.{ .fd = self.fd, .events = std.posix.POLL.OUT, .revents = 0 }};
+                    _ = try std.posix.poll(&fds, -1);
+                    continue;
+                },
+                else => return err,
+            };
+            if (n == 0) return error.WriteZero;
+            self.write_calls += 1;
+            self.bytes_written += n;
+            return n;
+        }
+    }
+};
+
+/// Coalesces kept line ranges of one text into as few writes to `Target`
+/// (anything with `write([]const u8)`, usually *OutputSink) as possible.
+/// Adjacent ranges are merged, so printing a run of consecutive matching lines
+/// costs one memcpy instead of one write per line.
+pub fn RunWriter(comptime Target: type) type {
+    return struct {
+        target: Target,
+        text: []const u8,
+        run_start: usize = 0,
+        run_end: usize = 0,
+
+        const Self = @This();
+
+        pub fn init(target: Target, text: []const u8) Self {
+            return .{ .target = target, .text = text };
+        }
+
+        /// Keep text[start..end]; ranges must be passed in ascending order
+        pub fn keep(self: *Self, start: usize, end: usize) !void {
+            if (start == self.run_end) {
+                self.run_end = end;
+                return;
+            }
+            try self.emit();
+            self.run_start = start;
+            self.run_end = end;
+        }
+
+        pub fn finish(self: *Self) !void {
+            try self.emit();
+        }
+
+        fn emit(self: *Self) !void {
+            if (self.run_end > self.run_start) {
+                try self.target.write(self.text[self.run_start..self.run_end]);
+            }
+            self.run_start = self.run_end;
+        }
+    };
+}
+
+fn readPipe(fd: std.posix.fd_t, buf: []u8) ![]u8 {
+    var total: usize = 0;
+    while (total < buf.len) {
+        const n = try std.posix.read(fd, buf[total..]);
+        if (n == 0) break;
+        total += n;
+    }
+    return buf[0..total];
+}
+
+test "OutputSink: buffers small writes until flush" {
+    const fds = try std.posix.pipe();
+    defer std.posix.close(fds[0]);
+
+    var sink = try OutputSink.init(std.testing.allocator, fds[1], .full);
+    defer sink.deinit();
+
+    try sink.write("hello ");
+    try sink.write("world\n");
+    try std.testing.expectEqual(@as(u64, 0), sink.write_calls);
+    try sink.flush();
+    try std.testing.expectEqual(@as(u64, 1), sink.write_calls);
+    std.posix.close(fds[1]);
+
+    var buf: [64]u8 = undefined;
+    try std.testing.expectEqualStrings("hello world\n", try readPipe(fds[0], &buf));
+}
+
+test "OutputSink: line policy flushes on newline" {
+    const fds = try std.posix.pipe();
+    defer std.posix.close(fds[0]);
+
+    var sink = try OutputSink.init(std.testing.allocator, fds[1], .line);
+    defer sink.deinit();
+
+    try sink.write("partial");
+    try std.testing.expectEqual(@as(u64, 0), sink.write_calls);
+    try sink.write(" line\n");
+    try std.testing.expectEqual(@as(u64, 1), sink.write_calls);
+    std.posix.close(fds[1]);
+
+    var buf: [64]u8 = undefined;
+    try std.testing.expectEqualStrings("partial line\n", try readPipe(fds[0], &buf));
+}
+
+test "OutputSink: a failed flush keeps the pending bytes" {
+    const fds = try std.posix.pipe();
+    std.posix.close(fds[0]);
+    defer std.posix.close(fds[1]);
+
+    var sink = try OutputSink.init(std.testing.allocator, fds[1], .full);
+    defer sink.deinit();
+
+    try sink.write("kept\n");
+    // No reader: EPIPE (SIGPIPE is ignored by the test runner)
+    try std.testing.expectError(error.BrokenPipe, sink.flush());
+    try std.testing.expectEqual(@as(usize, 5), sink.len);
+    try std.testing.expectEqualStrings("kept\n", sink.buffer[0..sink.len]);
+}
+
+test "RunWriter: coalesces adjacent lines" {
+    const fds = try std.posix.pipe();
+    defer std.posix.close(fds[0]);
+
+    var sink = try OutputSink.init(std.testing.allocator, fds[1], .unbuffered);
+    defer sink.deinit();
+
+    const text = "a\nb\nc\nd\n";
+    var runs = RunWriter(*OutputSink).init(&sink, text);
+    try runs.keep(0, 2);
+    try runs.keep(2, 4);
+    try runs.keep(6, 8);
+    try runs.finish();
+    try std.testing.expectEqual(@as(u64, 2), sink.write_calls);
+    std.posix.close(fds[1]);
+
+    var buf: [64]u8 = undefined;
+    try std.testing.expectEqualStrings("a\nb\nd\n", try readPipe(fds[0], &buf));
+}
@@ -0,0 +1,134 @@
+const std = @import("std");
+
+/// Where a piece's bytes live
+pub const Source = enum(u8) {
+    original,
+    added,
+};
+
+pub const Piece = struct {
+    source: Source,
+    start: usize,
+    len: usize,
+};
+
+/// A command's output as spans of its input plus an append-only buffer of
+/// new bytes (replacements, the newline p adds). Kept lines and unmatched
+/// text are never copied; the output is written straight from the pieces and
+/// only flattened when a later command needs contiguous text to scan.
+pub const PieceTable = struct {
+    original: []const u8,
+    added: std.ArrayListUnmanaged(u8) = .{},
+    pieces: std.ArrayListUnmanaged(Piece) = .{},
+    len: usize = 0,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, original: []const u8) PieceTable {
+        return .{ .original = original, .allocator = allocator };
+    }
+
+    /// The whole of `original`, unchanged
+    pub fn identity(allocator: std.mem.Allocator, original: []const u8) !PieceTable {
+        var table = init(allocator, original);
+        try table.appendOriginal(0, original.len);
+        return table;
+    }
+
+    pub fn deinit(self: *PieceTable) void {
+        self.added.deinit(self.allocator);
+        self.pieces.deinit(self.allocator);
+    }
+
+    /// Append original[start..end]; adjacent spans merge into one piece
+    pub fn appendOriginal(self: *PieceTable, start: usize, end: usize) !void {
+        try self.appendPiece(.original, start, end - start);
+    }
+
+    pub fn appendBytes(self: *PieceTable, bytes: []const u8) !void {
+        const mark = self.added.items.len;
+        try self.added.appendSlice(self.allocator, bytes);
+        try self.commitAdded(mark);
+    }
+
+    /// For producers that write into `added` directly (processReplacement):
+    /// record everything appended since `mark` as one piece
+    pub fn commitAdded(self: *PieceTable, mark: usize) !void {
+        try self.appendPiece(.added, mark, self.added.items.len - mark);
+    }
+
+    fn appendPiece(self: *PieceTable, source: Source, start: usize, len: usize) !void {
+        if (len == 0) return;
+        self.len += len;
+        if (self.pieces.items.len > 0) {
+            const last = &self.pieces.items[self.pieces.items.len - 1];
+            if (last.source == source and last.start + last.len == start) {
+                last.len += len;
+                return;
+            }
+        }
+        try self.pieces.append(self.allocator, .{ .source = source, .start = start, .len = len });
+    }
+
+    pub fn pieceBytes(self: *const PieceTable, piece: Piece) []const u8 {
+        const source = switch (piece.source) {
+            .original => self.original,
+            .added => self.added.items,
+        };
+        return source[piece.start..][0..piece.len];
+    }
+
+    /// True when the pieces spell out `original` exactly
+    pub fn isIdentity(self: *const PieceTable) bool {
+        if (self.len != self.original.len) return false;
+        if (self.pieces.items.len == 0) return true;
+        const only = self.pieces.items[0];
+        return self.pieces.items.len == 1 and only.source == .original and only.start == 0;
+    }
+
+    /// Write every piece in order to `writer` (anything with `write([]const u8)`)
+    pub fn writeTo(self: *const PieceTable, writer: anytype) !void {
+        for (self.pieces.items) |piece| try writer.write(self.pieceBytes(piece));
+    }
+
+    /// Flatten into one newly allocated buffer
+    pub fn toOwnedSlice(self: *const PieceTable, allocator: std.mem.Allocator) ![]u8 {
+        const out = try allocator.alloc(u8, self.len);
+        var pos: usize = 0;
+        for (self.pieces.items) |piece| {
+            @memcpy(out[pos..][0..piece.len], self.pieceBytes(piece));
+            pos += piece.len;
+        }
+        return out;
+    }
+};
+
+test "adjacent spans merge and the output flattens in order" {
+    const allocator = std.testing.allocator;
+    var table = PieceTable.init(allocator, "hello world\n");
+    defer table.deinit();
+
+    try table.appendOriginal(0, 6);
+    try table.appendBytes("big ");
+    try table.appendBytes("wide ");
+    try table.appendOriginal(6, 12);
+    try std.testing.expectEqual(@as(usize, 3), table.pieces.items.len);
+    try std.testing.expect(!table.isIdentity());
+
+    const flat = try table.toOwnedSlice(allocator);
+    defer allocator.free(flat);
+    try std.testing.expectEqualStrings("hello big wide world\n", flat);
+}
+
+test "untouched spans are recognized as the original" {
+    const allocator = std.testing.allocator;
+    var table = PieceTable.init(allocator, "a\nb\n");
+    defer table.deinit();
+
+    try table.appendOriginal(0, 2);
+    try table.appendOriginal(2, 4);
+    try std.testing.expect(table.isIdentity());
+
+    var empty = PieceTable.init(allocator, "");
+    defer empty.deinit();
+    try std.testing.expect(empty.isIdentity());
+}
@@ -0,0 +1,193 @@
+const std = @import("std");
+const script = @import("script.zig");
+const PieceTable = @import("piece_table.zig").PieceTable;
+
+pub const SedCommand = script.SedCommand;
+const Blake3 = std.crypto.hash.Blake3;
+
+// --cache-dir: what a script did to each input, so that repeated runs over
+// mostly static trees (a periodic `sed -i` over a config checkout) skip the
+// inputs it is known to leave alone. An entry is keyed by the script and
+// either the file's identity (inode, mtime and size: checked without reading
+// the file) or its contents, and records "unchanged" or the hash of the
+// edited output. Only inputs that were edited whole and uncompressed are
+// recorded.
+//
+// Entries are small files under DIR/xx/, named by the hex key, so concurrent
+// runs and crashes can at worst lose an entry, never corrupt another.
+
+/// Bumped whenever editing behavior changes in a way the script text doesn't show
+const CACHE_VERSION: u32 = 1;
+
+pub const Key = [16]u8;
+
+pub const Outcome = union(enum) {
+    unchanged,
+    /// Hash of the edited text
+    output: Key,
+};
+
+const UNCHANGED_TAG = 'U';
+const OUTPUT_TAG = 'O';
+
+pub const ResultCache = struct {
+    dir: std.fs.Dir,
+    script_hash: Key,
+
+    pub fn open(path: []const u8, commands: []const SedCommand) !ResultCache {
+        return .{ .dir = try std.fs.cwd().makeOpenPath(path, .{}), .script_hash = hashScript(commands) };
+    }
+
+    pub fn close(self: *ResultCache) void {
+        self.dir.close();
+    }
+
+    /// Key of a file by identity; any rewrite changes its mtime (or inode)
+    pub fn statKey(self: *const ResultCache, stat: std.fs.File.Stat) Key {
+        var hasher = self.keyHasher('S');
+        hasher.update(std.mem.asBytes(&@as(u64, stat.inode)));
+        hasher.update(std.mem.asBytes(&@as(i128, stat.mtime)));
+        hasher.update(std.mem.asBytes(&@as(u64, stat.size)));
+        return finish(&hasher);
+    }
+
+    /// Key of an input by contents (`content_hash` from hashBytes)
+    pub fn contentKey(self: *const ResultCache, content_hash: Key) Key {
+        var hasher = self.keyHasher('C');
+        hasher.update(&content_hash);
+        return finish(&hasher);
+    }
+
+    fn keyHasher(self: *const ResultCache, kind: u8) Blake3 {
+        var hasher = Blake3.init(.{});
+        hasher.update(&self.script_hash);
+        hasher.update(&[_]u8{kind});
+        return hasher;
+    }
+
+    pub fn lookup(self: *const ResultCache, key: Key) ?Outcome {
+        var path_buf: [entry_path_len]u8 = undefined;
+        var buf: [1 + @sizeOf(Key)]u8 = undefined;
+        const entry = self.dir.readFile(entryPath(key, &path_buf), &buf) catch return null;
+        if (entry.len == 1 and entry[0] == UNCHANGED_TAG) return .unchanged;
+        if (entry.len == buf.len and entry[0] == OUTPUT_TAG) return .{ .output = entry[1..][0..@sizeOf(Key)].* };
+        return null;
+    }
+
+    pub fn isUnchanged(self: *const ResultCache, key: Key) bool {
+        const outcome = self.lookup(key) orelse return false;
+        return outcome == .unchanged;
+    }
+
+    /// Store an outcome; a cache that can't be written only costs the skip
+    pub fn record(self: *const ResultCache, key: Key, outcome: Outcome) void {
+        var path_buf: [entry_path_len]u8 = undefined;
+        const path = entryPath(key, &path_buf);
+        self.dir.makePath(path[0..2]) catch return;
+
+        var buf: [1 + @sizeOf(Key)]u8 = undefined;
+        const data = switch (outcome) {
+            .unchanged => blk: {
+                buf[0] = UNCHANGED_TAG;
+                break :blk buf[0..1];
+            },
+            .output => |hash| blk: {
+                buf[0] = OUTPUT_TAG;
+                buf[1..].* = hash;
+                break :blk buf[0..];
+            },
+        };
+        self.dir.writeFile(.{ .sub_path = path, .data = data }) catch {};
+    }
+};
+
+const entry_path_len = 2 + 1 + 2 * @sizeOf(Key) - 2;
+
+/// xx/yyyy...: the first byte of the key picks the subdirectory
+fn entryPath(key: Key, buf: *[entry_path_len]u8) []const u8 {
+    const hex = std.fmt.bytesToHex(key, .lower);
+    buf[0..2].* = hex[0..2].*;
+    buf[2] = '/';
+    @memcpy(buf[3..], hex[2..]);
+    return buf;
+}
+
+fn finish(hasher: *Blake3) Key {
+    var key: Key = undefined;
+    hasher.final(&key);
+    return key;
+}
+
+pub fn hashBytes(bytes: []const u8) Key {
+    var hasher = Blake3.init(.{});
+    hasher.update(bytes);
+    return finish(&hasher);
+}
+
+/// Hash of a piece table's text, equal to hashBytes of it flattened
+pub fn hashPieces(table: *const PieceTable) Key {
+    var hasher = Blake3.init(.{});
+    for (table.pieces.items) |piece| hasher.update(table.pieceBytes(piece));
+    return finish(&hasher);
+}
+
+/// Everything about the commands that affects their output
+fn hashScript(commands: []const SedCommand) Key {
+    var hasher = Blake3.init(.{});
+    hasher.update(std.mem.asBytes(&CACHE_VERSION));
+    for (commands) |cmd| {
+        const options = cmd.options;
+        const header = [_]u32{
+            @intFromEnum(cmd.cmd_type),
+            options.toFlags() | @as(u32, @intFromBool(options.extended)) << 31,
+            @intCast(cmd.pattern.len),
+            @intCast(cmd.replacement.len),
+        };
+        hasher.update(std.mem.sliceAsBytes(&header));
+        hasher.update(cmd.pattern);
+        hasher.update(cmd.replacement);
+        if (cmd.address) |addr| {
+            const bounds = [_]u64{ addr.start orelse 0, addr.end orelse 0 };
+            const flags = [_]bool{ true, addr.start != null, addr.end != null, addr.is_last_line, addr.end_is_last };
+            hasher.update(std.mem.sliceAsBytes(&bounds));
+            hasher.update(std.mem.sliceAsBytes(&flags));
+        } else {
+            hasher.update(&[_]u8{0});
+        }
+    }
+    return finish(&hasher);
+}
+
+test "outcomes round-trip and are keyed by script" {
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const path = try tmp.dir.realpathAlloc(std.testing.allocator, ".");
+    defer std.testing.allocator.free(path);
+
+    const upper = [_]SedCommand{.{ .cmd_type = .substitute, .pattern = "a", .replacement = "A", .options = .{} }};
+    const lower = [_]SedCommand{.{ .cmd_type = .substitute, .pattern = "A", .replacement = "a", .options = .{} }};
+    var cache = try ResultCache.open(path, &upper);
+    defer cache.close();
+    var other = try ResultCache.open(path, &lower);
+    defer other.close();
+
+    const content = hashBytes("xyz\n");
+    cache.record(cache.contentKey(content), .unchanged);
+    try std.testing.expect(cache.isUnchanged(cache.contentKey(content)));
+    try std.testing.expect(!other.isUnchanged(other.contentKey(content)));
+
+    const changed = hashBytes("abc\n");
+    const output = hashBytes("Abc\n");
+    cache.record(cache.contentKey(changed), .{ .output = output });
+    try std.testing.expectEqual(Outcome{ .output = output }, cache.lookup(cache.contentKey(changed)).?);
+    try std.testing.expect(!cache.isUnchanged(cache.contentKey(changed)));
+}
+
+test "piece hash matches the flattened text" {
+    var table = PieceTable.init(std.testing.allocator, "hello world\n");
+    defer table.deinit();
+    try table.appendOriginal(0, 6);
+    try table.appendBytes("big ");
+    try table.appendOriginal(6, 12);
+    try std.testing.expectEqualSlices(u8, &hashBytes("hello big world\n"), &hashPieces(&table));
+}
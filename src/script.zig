@@ -0,0 +1,782 @@
+const std = @import("std");
+const gpu = @import("gpu");
+const cpu = @import("cpu");
+const piece_table = @import("piece_table.zig");
+const output_sink = @import("output_sink.zig");
+
+const SubstituteOptions = gpu.SubstituteOptions;
+const PieceTable = piece_table.PieceTable;
+
+// Sed scripts: the expression parser, replacement expansion, how one command
+// edits a text, and a compiled-script runner. The CLI and the embeddable
+// library both apply commands through applyCommand.
+
+/// Sed command type
+pub const CommandType = enum {
+    substitute, // s/pattern/replacement/flags
+    delete, // /pattern/d
+    print, // /pattern/p
+    transliterate, // y/source/dest/
+};
+
+/// Line address for sed commands
+pub const Address = struct {
+    start: ?u64 = null, // null means beginning or not specified
+    end: ?u64 = null, // null means same as start (single line) or end of file
+    is_last_line: bool = false, // $ address
+    end_is_last: bool = false, // $ as end of range
+
+    /// Check if a line number matches this address (line_num is 1-indexed)
+    pub fn matches(self: Address, line_num: u64, total_lines: u64) bool {
+        // Handle $ (last line)
+        const effective_start = if (self.is_last_line) total_lines else (self.start orelse 1);
+        const effective_end = if (self.end_is_last) total_lines else (self.end orelse effective_start);
+
+        return line_num >= effective_start and line_num <= effective_end;
+    }
+};
+
+/// Parsed sed command
+pub const SedCommand = struct {
+    cmd_type: CommandType,
+    pattern: []const u8,
+    replacement: []const u8,
+    options: SubstituteOptions,
+    address: ?Address = null, // Optional line address
+    // Pattern compiled with the script (Script.compile); commands parsed on
+    // their own compile it where they are applied
+    matcher: ?*const cpu.Matcher = null,
+};
+
+/// Process replacement string, expanding special sequences like & (matched text)
+pub fn processReplacement(replacement: []const u8, matched_text: []const u8, output: *std.ArrayListUnmanaged(u8), allocator: std.mem.Allocator) !void {
+    var i: usize = 0;
+    while (i < replacement.len) {
+        if (replacement[i] == '&') {
+            // & expands to the matched text
+            try output.appendSlice(allocator, matched_text);
+            i += 1;
+        } else if (replacement[i] == '\\' and i + 1 < replacement.len) {
+            const next = replacement[i + 1];
+            if (next == '&') {
+                // \& is a literal &
+                try output.append(allocator, '&');
+                i += 2;
+            } else if (next == '\\') {
+                // \\ is a literal \
+                try output.append(allocator, '\\');
+                i += 2;
+            } else if (next == 'n') {
+                // \n is a newline
+                try output.append(allocator, '\n');
+                i += 2;
+            } else if (next == 't') {
+                // \t is a tab
+                try output.append(allocator, '\t');
+                i += 2;
+            } else {
+                // Other escapes pass through
+                try output.append(allocator, replacement[i]);
+                i += 1;
+            }
+        } else {
+            try output.append(allocator, replacement[i]);
+            i += 1;
+        }
+    }
+}
+
+/// Check if pattern requires regex processing
+pub fn needsRegex(pattern: []const u8, options: SubstituteOptions) bool {
+    if (options.extended) return true;
+    // For BRE mode (default), also use regex for special characters
+    var i: usize = 0;
+    while (i < pattern.len) : (i += 1) {
+        const c = pattern[i];
+        if (c == '.' or c == '*' or c == '^' or c == '$' or c == '[') {
+            return true;
+        }
+        if (c == '\\' and i + 1 < pattern.len) {
+            const next = pattern[i + 1];
+            if (next == '+' or next == '?' or next == '|' or next == '(' or next == ')' or next == '{' or next == '}') {
+                return true;
+            }
+            i += 1;
+        }
+    }
+    return false;
+}
+
+/// Choose appropriate find function based on options (literal vs regex)
+pub fn doFindMatches(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator) !gpu.SubstituteResult {
+    if (needsRegex(pattern, options)) {
+        return cpu.findMatchesRegex(text, pattern, options, allocator);
+    }
+    return cpu.findMatches(text, pattern, options, allocator);
+}
+
+/// Streaming counterpart of doFindMatches: matches go to `onMatch` in text
+/// order as they are found. Returns the match count.
+pub fn doForEachMatch(text: []const u8, pattern: []const u8, options: SubstituteOptions, allocator: std.mem.Allocator, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !u64 {
+    if (needsRegex(pattern, options)) {
+        return cpu.forEachMatchRegex(text, pattern, options, allocator, context, onMatch);
+    }
+    return cpu.forEachMatch(text, pattern, options, context, onMatch);
+}
+
+/// Count total lines in text
+pub fn countLines(text: []const u8) u64 {
+    var count: u64 = 1; // Start at 1 (line numbers are 1-indexed)
+    for (text) |c| {
+        if (c == '\n') count += 1;
+    }
+    // Don't count extra line if text ends with newline
+    if (text.len > 0 and text[text.len - 1] == '\n') {
+        count -= 1;
+    }
+    return if (count == 0) 1 else count;
+}
+
+pub fn parseSedExpression(expr: []const u8) !SedCommand {
+    if (expr.len < 1) return error.InvalidExpression;
+
+    // First, try to parse a line address (number, range, or $)
+    var address: ?Address = null;
+    var cmd_start: usize = 0;
+
+    if (expr[0] >= '0' and expr[0] <= '9') {
+        // Line number address
+        var i: usize = 0;
+        while (i < expr.len and expr[i] >= '0' and expr[i] <= '9') : (i += 1) {}
+        const line_num = std.fmt.parseInt(u64, expr[0..i], 10) catch return error.InvalidExpression;
+        address = Address{ .start = line_num };
+        cmd_start = i;
+
+        // Check for range (comma followed by another number or $)
+        if (i < expr.len and expr[i] == ',') {
+            i += 1;
+            if (i < expr.len) {
+                if (expr[i] == '$') {
+                    address.?.end_is_last = true;
+                    i += 1;
+                } else if (expr[i] >= '0' and expr[i] <= '9') {
+                    var j = i;
+                    while (j < expr.len and expr[j] >= '0' and expr[j] <= '9') : (j += 1) {}
+                    const end_num = std.fmt.parseInt(u64, expr[i..j], 10) catch return error.InvalidExpression;
+                    address.?.end = end_num;
+                    i = j;
+                }
+            }
+            cmd_start = i;
+        }
+    } else if (expr[0] == '$') {
+        // Last line address
+        address = Address{ .is_last_line = true };
+        cmd_start = 1;
+        // Check for range ($,number - unusual but valid)
+        if (cmd_start < expr.len and expr[cmd_start] == ',') {
+            cmd_start += 1;
+            if (cmd_start < expr.len and expr[cmd_start] >= '0' and expr[cmd_start] <= '9') {
+                var j = cmd_start;
+                while (j < expr.len and expr[j] >= '0' and expr[j] <= '9') : (j += 1) {}
+                const end_num = std.fmt.parseInt(u64, expr[cmd_start..j], 10) catch return error.InvalidExpression;
+                address.?.end = end_num;
+                cmd_start = j;
+            }
+        }
+    }
+
+    // Get the remaining expression after the address
+    const remaining = expr[cmd_start..];
+    if (remaining.len < 1) return error.InvalidExpression;
+
+    // Check for transliterate (y/source/dest/)
+    if (remaining[0] == 'y' and remaining.len >= 4) {
+        const delim = remaining[1];
+        var parts: [3][]const u8 = undefined;
+        var part_idx: usize = 0;
+        var start: usize = 2;
+
+        for (remaining[2..], 2..) |c, idx| {
+            if (c == delim) {
+                parts[part_idx] = remaining[start..idx];
+                part_idx += 1;
+                start = idx + 1;
+                if (part_idx >= 2) break;
+            }
+        }
+        if (part_idx >= 2) {
+            return SedCommand{
+                .cmd_type = .transliterate,
+                .pattern = parts[0],
+                .replacement = parts[1],
+                .options = .{},
+                .address = address,
+            };
+        }
+    }
+
+    // Check for substitute (s/pattern/replacement/flags)
+    if (remaining[0] == 's' and remaining.len >= 4) {
+        const delim = remaining[1];
+        var pattern_end: usize = 2;
+        while (pattern_end < remaining.len and remaining[pattern_end] != delim) {
+            if (remaining[pattern_end] == '\\' and pattern_end + 1 < remaining.len) {
+                pattern_end += 2; // Skip escaped char
+            } else {
+                pattern_end += 1;
+            }
+        }
+
+        if (pattern_end >= remaining.len) return error.InvalidExpression;
+
+        const pattern = remaining[2..pattern_end];
+        var replacement_end = pattern_end + 1;
+        while (replacement_end < remaining.len and remaining[replacement_end] != delim) {
+            if (remaining[replacement_end] == '\\' and replacement_end + 1 < remaining.len) {
+                replacement_end += 2;
+            } else {
+                replacement_end += 1;
+            }
+        }
+
+        const replacement = remaining[pattern_end + 1 .. replacement_end];
+
+        // Parse flags
+        var options = SubstituteOptions{};
+        if (replacement_end + 1 < remaining.len) {
+            const flags = remaining[replacement_end + 1 ..];
+            for (flags) |f| {
+                switch (f) {
+                    'g' => options.global = true,
+                    'i', 'I' => options.case_insensitive = true,
+                    '1' => options.first_only = true,
+                    else => {},
+                }
+            }
+        }
+
+        return SedCommand{
+            .cmd_type = .substitute,
+            .pattern = pattern,
+            .replacement = replacement,
+            .options = options,
+            .address = address,
+        };
+    }
+
+    // Check for just 'd' (delete addressed lines)
+    if (remaining[0] == 'd') {
+        return SedCommand{
+            .cmd_type = .delete,
+            .pattern = "", // No pattern - use address only
+            .replacement = "",
+            .options = .{},
+            .address = address,
+        };
+    }
+
+    // Check for just 'p' (print addressed lines)
+    if (remaining[0] == 'p') {
+        return SedCommand{
+            .cmd_type = .print,
+            .pattern = "", // No pattern - use address only
+            .replacement = "",
+            .options = .{},
+            .address = address,
+        };
+    }
+
+    // Check for address/pattern command (/pattern/d or /pattern/p)
+    if (remaining[0] == '/') {
+        var pattern_end: usize = 1;
+        while (pattern_end < remaining.len and remaining[pattern_end] != '/') {
+            pattern_end += 1;
+        }
+
+        if (pattern_end >= remaining.len) return error.InvalidExpression;
+
+        var pattern = remaining[1..pattern_end];
+        var options = SubstituteOptions{};
+
+        // Handle ^ anchor at start of pattern
+        if (pattern.len > 0 and pattern[0] == '^') {
+            options.anchor_start = true;
+            pattern = pattern[1..];
+        }
+
+        const cmd_char = if (pattern_end + 1 < remaining.len) remaining[pattern_end + 1] else 'p';
+
+        return SedCommand{
+            .cmd_type = if (cmd_char == 'd') .delete else .print,
+            .pattern = pattern,
+            .replacement = "",
+            .options = options,
+            .address = address,
+        };
+    }
+
+    return error.InvalidExpression;
+}
+
+/// CPU matcher for a command's pattern; y commands get an unused literal one
+pub fn compileMatcher(allocator: std.mem.Allocator, cmd: SedCommand) !cpu.Matcher {
+    const is_regex = cmd.cmd_type != .transliterate and needsRegex(cmd.pattern, cmd.options);
+    return cpu.Matcher.init(allocator, cmd.pattern, cmd.options, is_regex);
+}
+
+/// Where a chunk sits in the whole input: its first line is line `base + 1`,
+/// and `total` is the input's line count ($). The defaults describe a whole input.
+pub const LineSpan = struct {
+    base: u64 = 0,
+    total: ?u64 = null,
+};
+
+/// Apply one s, d or p command to text and return its output as pieces of
+/// the text. `engine` runs the command's searches and takes what p prints
+/// under -n (`quiet`):
+///   search(text, context, onMatch)      matches over the whole text, in order
+///   searchLine(line, context, onMatch)  matches within one addressed line
+///   selectLines(text)                   lines a d or p pattern matches
+///   write(bytes)                        printed lines
+/// The CLI's engine tries the GPU first; Script's runs on the CPU. Runs of y
+/// commands are composed into one byte map and applied by the caller.
+pub fn applyCommand(allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, lines: LineSpan, quiet: bool, engine: anytype) !PieceTable {
+    // Count total lines for address handling
+    const total_lines = lines.total orelse lines.base + countLines(text);
+
+    var output = PieceTable.init(allocator, text);
+    errdefer output.deinit();
+
+    switch (cmd.cmd_type) {
+        .substitute => {
+            // No address: unmatched text stays a span of the input, replacements
+            // go to the add buffer, built as the search finds them rather than
+            // from a match array
+            const addr = cmd.address orelse {
+                var pieces = SubstitutePieces{ .output = &output, .replacement = cmd.replacement };
+                try engine.search(text, &pieces, SubstitutePieces.add);
+                try pieces.finish(text.len);
+                return output;
+            };
+
+            // With an address, line by line
+            var line_num: u64 = lines.base + 1;
+            var line_start: usize = 0;
+            while (line_start <= text.len) : (line_num += 1) {
+                // Text ending in a newline has no further line
+                if (line_start == text.len and text.len > 0) break;
+                const newline = std.mem.indexOfScalarPos(u8, text, line_start, '\n');
+                const line_end = newline orelse text.len;
+
+                if (addr.matches(line_num, total_lines)) {
+                    var pieces = SubstitutePieces{ .output = &output, .replacement = cmd.replacement, .base = line_start, .last_pos = line_start };
+                    try engine.searchLine(text[line_start..line_end], &pieces, SubstitutePieces.add);
+                    try pieces.finish(line_end);
+                } else {
+                    // Pass through unchanged
+                    try output.appendOriginal(line_start, line_end);
+                }
+
+                const nl = newline orelse break;
+                try output.appendOriginal(nl, nl + 1);
+                line_start = nl + 1;
+            }
+            return output;
+        },
+        .delete => {
+            // If we have an address with empty pattern, delete by line number
+            if (cmd.address) |addr| {
+                if (cmd.pattern.len == 0) {
+                    var line_num: u64 = lines.base + 1;
+                    var line_start: usize = 0;
+                    while (line_start < text.len) : (line_num += 1) {
+                        const line_end = if (std.mem.indexOfScalarPos(u8, text, line_start, '\n')) |nl| nl + 1 else text.len;
+                        if (!addr.matches(line_num, total_lines)) try output.appendOriginal(line_start, line_end);
+                        line_start = line_end;
+                    }
+                    return output;
+                }
+            }
+
+            // Pattern-based delete (its address is ignored): one bit per line
+            // (0-indexed) marks lines to drop
+            var selection = try engine.selectLines(text);
+            defer selection.deinit();
+
+            // Runs of kept lines become one piece each
+            var line_num: u32 = 0;
+            var line_start: usize = 0;
+            var run_start: usize = 0;
+            while (line_start < text.len) : (line_num += 1) {
+                const line_end = if (std.mem.indexOfScalarPos(u8, text, line_start, '\n')) |nl| nl + 1 else text.len;
+                if (selection.isSelected(line_num)) {
+                    try output.appendOriginal(run_start, line_start);
+                    run_start = line_end;
+                }
+                line_start = line_end;
+            }
+            try output.appendOriginal(run_start, text.len);
+            return output;
+        },
+        .print => {
+            // Lines to print: pattern matches (0-indexed), or everything the address selects
+            var matched_lines: ?gpu.LineSelection = if (cmd.pattern.len > 0) try engine.selectLines(text) else null;
+            defer if (matched_lines) |*selection| selection.deinit();
+
+            var runs = output_sink.RunWriter(@TypeOf(engine)).init(engine, text);
+
+            var line_num: u32 = 0;
+            var line_start: usize = 0;
+            while (line_start < text.len) : (line_num += 1) {
+                const newline = std.mem.indexOfScalarPos(u8, text, line_start, '\n');
+                const line_end = if (newline) |nl| nl + 1 else text.len;
+
+                const addressed = if (cmd.address) |addr| addr.matches(lines.base + line_num + 1, total_lines) else true;
+                const selected = addressed and (if (matched_lines) |selection| selection.isSelected(line_num) else true);
+
+                if (quiet) {
+                    // -n: only printed lines reach the output, write them straight out
+                    if (selected) try runs.keep(line_start, line_end);
+                } else {
+                    // Auto-print follows, so p shows up as a duplicated line
+                    try output.appendOriginal(line_start, line_end);
+                    if (selected) {
+                        if (newline == null) try output.appendBytes("\n");
+                        try output.appendOriginal(line_start, line_end);
+                    }
+                }
+                line_start = line_end;
+            }
+            try runs.finish();
+
+            if (quiet) try output.appendOriginal(0, text.len);
+            return output;
+        },
+        .transliterate => unreachable, // Composed into byte maps by the caller
+    }
+}
+
+/// Expand a replacement (& and \1 references) into the add buffer
+fn appendReplacement(output: *PieceTable, replacement: []const u8, matched_text: []const u8) !void {
+    const mark = output.added.items.len;
+    try processReplacement(replacement, matched_text, &output.added, output.allocator);
+    try output.commitAdded(mark);
+}
+
+/// onMatch target that builds a substitute's pieces as matches arrive. The
+/// search may cover a single line: `base` is where it starts in the original,
+/// and match offsets are relative to it.
+pub const SubstitutePieces = struct {
+    output: *PieceTable,
+    replacement: []const u8,
+    base: usize = 0,
+    /// End of the last match in the original; starts at `base`
+    last_pos: usize = 0,
+
+    pub fn add(self: *SubstitutePieces, match: gpu.MatchResult) anyerror!void {
+        const start = self.base + match.start;
+        const end = self.base + match.end;
+        try self.output.appendOriginal(self.last_pos, start);
+        try appendReplacement(self.output, self.replacement, self.output.original[start..end]);
+        self.last_pos = end;
+    }
+
+    /// The unmatched text from the last match up to `end`
+    pub fn finish(self: *SubstitutePieces, end: usize) !void {
+        try self.output.appendOriginal(self.last_pos, end);
+    }
+};
+
+pub const CompileOptions = struct {
+    extended: bool = false, // -E
+    quiet: bool = false, // -n
+};
+
+/// A script compiled once and run any number of times, also concurrently: a
+/// run only reads the script (patterns are compiled into matchers up front)
+/// and keeps its working buffers to itself. Runs use the CPU backend; GPU
+/// contexts are per process, not per script.
+pub const Script = struct {
+    allocator: std.mem.Allocator,
+    source: []u8, // Expressions joined by NUL; commands point into it
+    commands: []SedCommand,
+    // One per command; commands point at theirs
+    matchers: []cpu.Matcher,
+    // Composed byte map for a run of y commands, at the run's first index
+    tables: []?gpu.TransliterateTable,
+    quiet: bool,
+    // Texts longer than this are searched in line-aligned chunks
+    chunk_len: usize = gpu.MAX_CHUNK_LEN,
+
+    pub fn compile(allocator: std.mem.Allocator, expressions: []const []const u8, options: CompileOptions) !Script {
+        if (expressions.len == 0) return error.InvalidExpression;
+
+        var source: std.ArrayListUnmanaged(u8) = .{};
+        errdefer source.deinit(allocator);
+        for (expressions, 0..) |expr, idx| {
+            if (idx > 0) try source.append(allocator, 0);
+            try source.appendSlice(allocator, expr);
+        }
+        const owned = try source.toOwnedSlice(allocator);
+        errdefer allocator.free(owned);
+
+        const commands = try allocator.alloc(SedCommand, expressions.len);
+        errdefer allocator.free(commands);
+        var parts = std.mem.splitScalar(u8, owned, 0);
+        for (commands) |*cmd| {
+            cmd.* = try parseSedExpression(parts.next().?);
+            cmd.options.extended = options.extended;
+        }
+
+        return build(allocator, owned, commands, options.quiet);
+    }
+
+    /// Compile commands parsed elsewhere (a precompiled artifact), options
+    /// included; their strings must outlive the script
+    pub fn compileCommands(allocator: std.mem.Allocator, parsed: []const SedCommand, quiet: bool) !Script {
+        if (parsed.len == 0) return error.InvalidExpression;
+        const commands = try allocator.dupe(SedCommand, parsed);
+        errdefer allocator.free(commands);
+        return build(allocator, &.{}, commands, quiet);
+    }
+
+    /// Compile matchers and y tables; takes `source` and `commands` on success
+    fn build(allocator: std.mem.Allocator, source: []u8, commands: []SedCommand, quiet: bool) !Script {
+        const matchers = try allocator.alloc(cpu.Matcher, commands.len);
+        errdefer allocator.free(matchers);
+        var num_compiled: usize = 0;
+        errdefer for (matchers[0..num_compiled]) |*matcher| matcher.deinit();
+        for (commands, matchers) |*cmd, *matcher| {
+            matcher.* = try compileMatcher(allocator, cmd.*);
+            num_compiled += 1;
+            if (cmd.cmd_type != .transliterate) cmd.matcher = matcher;
+        }
+
+        const tables = try allocator.alloc(?gpu.TransliterateTable, commands.len);
+        @memset(tables, null);
+        var idx: usize = 0;
+        while (idx < commands.len) : (idx += 1) {
+            if (commands[idx].cmd_type != .transliterate) continue;
+            var table = gpu.TransliterateTable.init(commands[idx].pattern, commands[idx].replacement);
+            var run_end = idx + 1;
+            while (run_end < commands.len and commands[run_end].cmd_type == .transliterate) : (run_end += 1) {
+                table = table.then(gpu.TransliterateTable.init(commands[run_end].pattern, commands[run_end].replacement));
+            }
+            tables[idx] = table;
+            idx = run_end - 1;
+        }
+
+        return Script{ .allocator = allocator, .source = source, .commands = commands, .matchers = matchers, .tables = tables, .quiet = quiet };
+    }
+
+    pub fn deinit(self: *Script) void {
+        for (self.matchers) |*matcher| matcher.deinit();
+        self.allocator.free(self.matchers);
+        self.allocator.free(self.tables);
+        self.allocator.free(self.commands);
+        self.allocator.free(self.source);
+    }
+
+    /// Run over `text`, handing output to `emit(context, bytes)` in order:
+    /// p lines as they are printed, then the edited text unless quiet
+    pub fn run(self: *const Script, allocator: std.mem.Allocator, text: []const u8, context: anytype, comptime emit: fn (@TypeOf(context), []const u8) anyerror!void) !void {
+        var current = try allocator.dupe(u8, text);
+        defer allocator.free(current);
+
+        var idx: usize = 0;
+        while (idx < self.commands.len) {
+            if (self.tables[idx]) |*table| {
+                cpu.transliterateTable(current, &table.map);
+                idx += 1;
+                while (idx < self.commands.len and self.commands[idx].cmd_type == .transliterate and self.tables[idx] == null) idx += 1;
+                continue;
+            }
+            const next = try self.apply(allocator, current, self.commands[idx], context, emit);
+            allocator.free(current);
+            current = next;
+            idx += 1;
+        }
+        if (!self.quiet) try emit(context, current);
+    }
+
+    /// One s, d or p command through applyCommand, over line-aligned chunks
+    /// of at most chunk_len bytes
+    fn apply(self: *const Script, allocator: std.mem.Allocator, text: []const u8, cmd: SedCommand, context: anytype, comptime emit: fn (@TypeOf(context), []const u8) anyerror!void) ![]u8 {
+        const engine = CpuEngine(@TypeOf(context), emit){ .matcher = cmd.matcher.?, .allocator = allocator, .context = context };
+        const total_lines = countLines(text);
+        var output: std.ArrayListUnmanaged(u8) = .{};
+        errdefer output.deinit(allocator);
+
+        var base: gpu.ChunkBase = .{};
+        var rest = text;
+        while (true) {
+            const chunk = gpu.nextChunk(rest, self.chunk_len);
+            var edits = try applyCommand(allocator, chunk, cmd, .{ .base = base.line, .total = total_lines }, self.quiet, engine);
+            defer edits.deinit();
+            try output.ensureUnusedCapacity(allocator, edits.len);
+            for (edits.pieces.items) |piece| output.appendSliceAssumeCapacity(edits.pieceBytes(piece));
+
+            base = base.advance(chunk);
+            rest = rest[chunk.len..];
+            if (rest.len == 0) break;
+        }
+        return output.toOwnedSlice(allocator);
+    }
+};
+
+/// applyCommand's engine for Script: CPU searches through the command's
+/// compiled matcher, printed lines to `emit`
+fn CpuEngine(comptime Context: type, comptime emit: fn (Context, []const u8) anyerror!void) type {
+    return struct {
+        matcher: *const cpu.Matcher,
+        allocator: std.mem.Allocator,
+        context: Context,
+
+        const Self = @This();
+
+        pub fn search(self: Self, text: []const u8, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !void {
+            _ = try self.matcher.forEach(text, self.allocator, context, onMatch);
+        }
+
+        pub fn searchLine(self: Self, line: []const u8, context: anytype, comptime onMatch: fn (@TypeOf(context), gpu.MatchResult) anyerror!void) !void {
+            _ = try self.matcher.forEach(line, self.allocator, context, onMatch);
+        }
+
+        pub fn selectLines(self: Self, text: []const u8) !gpu.LineSelection {
+            return self.matcher.selectLines(text, self.allocator);
+        }
+
+        pub fn write(self: Self, bytes: []const u8) !void {
+            try emit(self.context, bytes);
+        }
+    };
+}
+
+test "parse substitute expression" {
+    const cmd = try parseSedExpression("s/foo/bar/g");
+    try std.testing.expectEqual(CommandType.substitute, cmd.cmd_type);
+    try std.testing.expectEqualStrings("foo", cmd.pattern);
+    try std.testing.expectEqualStrings("bar", cmd.replacement);
+    try std.testing.expect(cmd.options.global);
+}
+
+test "parse transliterate expression" {
+    const cmd = try parseSedExpression("y/abc/xyz/");
+    try std.testing.expectEqual(CommandType.transliterate, cmd.cmd_type);
+    try std.testing.expectEqualStrings("abc", cmd.pattern);
+    try std.testing.expectEqualStrings("xyz", cmd.replacement);
+}
+
+test "parse delete expression" {
+    const cmd = try parseSedExpression("/error/d");
+    try std.testing.expectEqual(CommandType.delete, cmd.cmd_type);
+    try std.testing.expectEqualStrings("error", cmd.pattern);
+}
+
+test "parse print expression" {
+    const cmd = try parseSedExpression("/error/p");
+    try std.testing.expectEqual(CommandType.print, cmd.cmd_type);
+    try std.testing.expectEqualStrings("error", cmd.pattern);
+}
+
+test "processReplacement: & expands to matched text" {
+    var output: std.ArrayListUnmanaged(u8) = .{};
+    defer output.deinit(std.testing.allocator);
+
+    try processReplacement("[&]", "hello", &output, std.testing.allocator);
+    try std.testing.expectEqualStrings("[hello]", output.items);
+}
+
+test "processReplacement: escaped ampersand" {
+    var output: std.ArrayListUnmanaged(u8) = .{};
+    defer output.deinit(std.testing.allocator);
+
+    try processReplacement("\\&", "hello", &output, std.testing.allocator);
+    try std.testing.expectEqualStrings("&", output.items);
+}
+
+test "processReplacement: escape sequences" {
+    var output: std.ArrayListUnmanaged(u8) = .{};
+    defer output.deinit(std.testing.allocator);
+
+    try processReplacement("a\\nb\\tc", "X", &output, std.testing.allocator);
+    try std.testing.expectEqualStrings("a\nb\tc", output.items);
+}
+
+test "processReplacement: mixed & and escapes" {
+    var output: std.ArrayListUnmanaged(u8) = .{};
+    defer output.deinit(std.testing.allocator);
+
+    try processReplacement("<&>\\n", "FOO", &output, std.testing.allocator);
+    try std.testing.expectEqualStrings("<FOO>\n", output.items);
+}
+
+fn collect(out: *std.ArrayListUnmanaged(u8), bytes: []const u8) anyerror!void {
+    try out.appendSlice(std.testing.allocator, bytes);
+}
+
+test "Script: compile once, run on several inputs" {
+    var compiled = try Script.compile(std.testing.allocator, &.{ "s/a/b/g", "y/b/c/", "/x/d" }, .{});
+    defer compiled.deinit();
+
+    var out: std.ArrayListUnmanaged(u8) = .{};
+    defer out.deinit(std.testing.allocator);
+    try compiled.run(std.testing.allocator, "aa\nxa\nba\n", &out, collect);
+    try std.testing.expectEqualStrings("cc\ncc\n", out.items);
+
+    out.clearRetainingCapacity();
+    try compiled.run(std.testing.allocator, "a", &out, collect);
+    try std.testing.expectEqualStrings("c", out.items);
+}
+
+test "Script: quiet print emits only printed lines" {
+    var compiled = try Script.compile(std.testing.allocator, &.{"/err/p"}, .{ .quiet = true });
+    defer compiled.deinit();
+
+    var out: std.ArrayListUnmanaged(u8) = .{};
+    defer out.deinit(std.testing.allocator);
+    try compiled.run(std.testing.allocator, "ok\nerr 1\nok\nerr 2", &out, collect);
+    try std.testing.expectEqualStrings("err 1\nerr 2", out.items);
+}
+
+test "Script: chunked runs keep line numbers and $ across chunks" {
+    const text = "one\ntwo\nthree\nfour\nfive\n";
+    var whole = try Script.compile(std.testing.allocator, &.{ "2,4s/o/0/", "$d", "s/e/E/" }, .{});
+    defer whole.deinit();
+    var chunked = try Script.compile(std.testing.allocator, &.{ "2,4s/o/0/", "$d", "s/e/E/" }, .{});
+    defer chunked.deinit();
+    chunked.chunk_len = 6; // One or two lines per chunk
+
+    var expected: std.ArrayListUnmanaged(u8) = .{};
+    defer expected.deinit(std.testing.allocator);
+    try whole.run(std.testing.allocator, text, &expected, collect);
+    try std.testing.expectEqualStrings("onE\ntw0\nthrEe\nf0ur\n", expected.items);
+
+    var out: std.ArrayListUnmanaged(u8) = .{};
+    defer out.deinit(std.testing.allocator);
+    try chunked.run(std.testing.allocator, text, &out, collect);
+    try std.testing.expectEqualStrings(expected.items, out.items);
+}
+
+test "matches stream in text order with line numbers" {
+    const text = "cat cat\ndog\ncat\n";
+    var lines: std.ArrayListUnmanaged(u32) = .{};
+    defer lines.deinit(std.testing.allocator);
+    const Lines = struct {
+        fn add(list: *std.ArrayListUnmanaged(u32), match: gpu.MatchResult) anyerror!void {
+            try list.append(std.testing.allocator, match.line_num);
+        }
+    };
+    const count = try doForEachMatch(text, "cat", .{ .global = true }, std.testing.allocator, &lines, Lines.add);
+    try std.testing.expectEqual(@as(u64, 3), count);
+    try std.testing.expectEqualSlices(u32, &.{ 0, 0, 2 }, lines.items);
+
+    // GPU readback replays unordered 8-byte records the same way
+    var packed_matches = [_]gpu.PackedMatch{ .{ .start = 12, .len = 3 }, .{ .start = 0, .len = 3 }, .{ .start = 4, .len = 3 } };
+    std.mem.sort(gpu.PackedMatch, &packed_matches, {}, gpu.PackedMatch.lessThan);
+    lines.clearRetainingCapacity();
+    try std.testing.expectEqual(@as(u64, 2), try gpu.emitPacked(text, &packed_matches, true, &lines, Lines.add));
+    try std.testing.expectEqualSlices(u32, &.{ 0, 2 }, lines.items);
+    try std.testing.expectEqual(@as(usize, 8), @sizeOf(gpu.PackedMatch));
+}
@@ -0,0 +1,373 @@
+const std = @import("std");
+const gpu = @import("gpu");
+const script = @import("script.zig");
+
+const SedCommand = script.SedCommand;
+const RegexState = gpu.RegexState;
+const RegexHeader = gpu.RegexHeader;
+const regex_compiler = gpu.regex_compiler;
+
+// Precompiled scripts (sed --compile-script FILE -o OUT, run with sed -F OUT).
+//
+// Layout, all little-endian and 8-byte aligned sections:
+//   Header
+//   CommandRecord[num_commands]
+//   RegexRecord[num_regexes]
+//   NFA states and bitmaps of each regex
+//   string table (patterns and replacements)
+// Loading maps the file and points commands and GPU regex tables straight at
+// it; nothing is parsed or compiled again. The header pins the format and
+// record layout, and a hash over the payload rejects truncated or edited files.
+
+const MAGIC = [4]u8{ 'S', 'E', 'D', 'C' };
+pub const FORMAT_VERSION: u32 = 2;
+
+const Header = extern struct {
+    magic: [4]u8,
+    format_version: u32,
+    layout_hash: u64, // Record and NFA layouts this build reads
+    payload_hash: u64,
+    payload_len: u64,
+    num_commands: u32,
+    num_regexes: u32,
+};
+
+const CommandRecord = extern struct {
+    cmd_type: u8,
+    address_flags: u8,
+    options: u16,
+    pattern_offset: u32,
+    address_start: u64,
+    address_end: u64,
+    pattern_len: u32,
+    replacement_offset: u32,
+    replacement_len: u32,
+    _pad: u32 = 0,
+
+    const HAS_ADDRESS: u8 = 1;
+    const HAS_START: u8 = 2;
+    const HAS_END: u8 = 4;
+    const IS_LAST_LINE: u8 = 8;
+    const END_IS_LAST: u8 = 16;
+};
+
+const RegexRecord = extern struct {
+    header: RegexHeader,
+    command: u32, // Index of the command whose pattern this is
+    case_insensitive: u32,
+    states_offset: u32,
+    num_states: u32,
+    bitmaps_offset: u32,
+    num_bitmaps: u32,
+};
+
+const layout_hash: u64 = blk: {
+    @setEvalBranchQuota(10_000);
+    var hasher = std.hash.Wyhash.init(FORMAT_VERSION);
+    for (.{ Header, CommandRecord, RegexRecord, RegexState, RegexHeader }) |T| {
+        hasher.update(@typeName(T));
+        hasher.update(std.mem.asBytes(&@as(u32, @sizeOf(T))));
+    }
+    hasher.update(std.mem.asBytes(&gpu.MAX_REGEX_STATES));
+    hasher.update(std.mem.asBytes(&gpu.BITMAP_WORDS_PER_CLASS));
+    break :blk hasher.final();
+};
+
+fn encodeOptions(options: gpu.SubstituteOptions) u16 {
+    var bits: u16 = @intCast(options.toFlags());
+    if (options.extended) bits |= 0x8000;
+    return bits;
+}
+
+fn decodeOptions(bits: u16) gpu.SubstituteOptions {
+    const flags = gpu.SubstituteFlags;
+    return .{
+        .case_insensitive = bits & flags.CASE_INSENSITIVE != 0,
+        .global = bits & flags.GLOBAL != 0,
+        .first_only = bits & flags.FIRST_ONLY != 0,
+        .line_mode = bits & flags.LINE_MODE != 0,
+        .anchor_start = bits & flags.ANCHOR_START != 0,
+        .extended = bits & 0x8000 != 0,
+    };
+}
+
+/// Script file text to expressions: one per line, blank lines and # comments skipped
+pub fn splitScript(allocator: std.mem.Allocator, contents: []const u8) ![][]const u8 {
+    var expressions: std.ArrayListUnmanaged([]const u8) = .{};
+    errdefer expressions.deinit(allocator);
+    var lines = std.mem.splitScalar(u8, contents, '\n');
+    while (lines.next()) |raw| {
+        const line = std.mem.trim(u8, raw, " \t\r");
+        if (line.len == 0 or line[0] == '#') continue;
+        try expressions.append(allocator, line);
+    }
+    return expressions.toOwnedSlice(allocator);
+}
+
+/// Serialize parsed commands, with GPU NFA tables for every regex pattern
+/// that compiles for the GPU (others are left to compile at run time)
+pub fn write(allocator: std.mem.Allocator, commands: []const SedCommand, out_path: []const u8) !void {
+    var regexes: std.ArrayListUnmanaged(struct { command: u32, compiled: regex_compiler.CompiledGpuRegex }) = .{};
+    defer {
+        for (regexes.items) |*entry| entry.compiled.deinit();
+        regexes.deinit(allocator);
+    }
+    for (commands, 0..) |cmd, idx| {
+        if (cmd.cmd_type == .transliterate or cmd.pattern.len == 0 or !script.needsRegex(cmd.pattern, cmd.options)) continue;
+        const compiled = regex_compiler.compileForGpu(cmd.pattern, .{ .case_insensitive = cmd.options.case_insensitive }, allocator) catch continue;
+        try regexes.append(allocator, .{ .command = @intCast(idx), .compiled = compiled });
+    }
+
+    var payload: std.ArrayListUnmanaged(u8) = .{};
+    defer payload.deinit(allocator);
+    var strings: std.ArrayListUnmanaged(u8) = .{};
+    defer strings.deinit(allocator);
+
+    // Records first, tables after them, strings last (offsets are from the payload start)
+    const records_len = commands.len * @sizeOf(CommandRecord) + regexes.items.len * @sizeOf(RegexRecord);
+    var tables_len: usize = 0;
+    for (regexes.items) |entry| {
+        tables_len += std.mem.alignForward(usize, std.mem.sliceAsBytes(entry.compiled.states).len, 8);
+        tables_len += std.mem.alignForward(usize, std.mem.sliceAsBytes(entry.compiled.bitmaps).len, 8);
+    }
+    const strings_base = records_len + tables_len;
+
+    for (commands) |cmd| {
+        var record = CommandRecord{
+            .cmd_type = @intFromEnum(cmd.cmd_type),
+            .address_flags = 0,
+            .options = encodeOptions(cmd.options),
+            .address_start = 0,
+            .address_end = 0,
+            .pattern_offset = @intCast(strings_base + strings.items.len),
+            .pattern_len = @intCast(cmd.pattern.len),
+            .replacement_offset = 0,
+            .replacement_len = @intCast(cmd.replacement.len),
+        };
+        try strings.appendSlice(allocator, cmd.pattern);
+        record.replacement_offset = @intCast(strings_base + strings.items.len);
+        try strings.appendSlice(allocator, cmd.replacement);
+
+        if (cmd.address) |addr| {
+            record.address_flags = CommandRecord.HAS_ADDRESS;
+            if (addr.start) |start| {
+                record.address_flags |= CommandRecord.HAS_START;
+                record.address_start = start;
+            }
+            if (addr.end) |end| {
+                record.address_flags |= CommandRecord.HAS_END;
+                record.address_end = end;
+            }
+            if (addr.is_last_line) record.address_flags |= CommandRecord.IS_LAST_LINE;
+            if (addr.end_is_last) record.address_flags |= CommandRecord.END_IS_LAST;
+        }
+        try payload.appendSlice(allocator, std.mem.asBytes(&record));
+    }
+
+    var table_offset = records_len;
+    for (regexes.items) |entry| {
+        const states_len = std.mem.sliceAsBytes(entry.compiled.states).len;
+        const record = RegexRecord{
+            .header = entry.compiled.header,
+            .command = entry.command,
+            .case_insensitive = @intFromBool(commands[entry.command].options.case_insensitive),
+            .states_offset = @intCast(table_offset),
+            .num_states = @intCast(entry.compiled.states.len),
+            .bitmaps_offset = @intCast(table_offset + std.mem.alignForward(usize, states_len, 8)),
+            .num_bitmaps = @intCast(entry.compiled.bitmaps.len),
+        };
+        table_offset = record.bitmaps_offset + std.mem.alignForward(usize, std.mem.sliceAsBytes(entry.compiled.bitmaps).len, 8);
+        try payload.appendSlice(allocator, std.mem.asBytes(&record));
+    }
+    for (regexes.items) |entry| {
+        for ([_][]const u8{ std.mem.sliceAsBytes(entry.compiled.states), std.mem.sliceAsBytes(entry.compiled.bitmaps) }) |bytes| {
+            try payload.appendSlice(allocator, bytes);
+            try payload.appendNTimes(allocator, 0, std.mem.alignForward(usize, bytes.len, 8) - bytes.len);
+        }
+    }
+    std.debug.assert(payload.items.len == strings_base);
+    try payload.appendSlice(allocator, strings.items);
+
+    const header = Header{
+        .magic = MAGIC,
+        .format_version = FORMAT_VERSION,
+        .layout_hash = layout_hash,
+        .payload_hash = std.hash.Wyhash.hash(0, payload.items),
+        .payload_len = payload.items.len,
+        .num_commands = @intCast(commands.len),
+        .num_regexes = @intCast(regexes.items.len),
+    };
+
+    const file = try std.fs.cwd().createFile(out_path, .{});
+    defer file.close();
+    try file.writeAll(std.mem.asBytes(&header));
+    try file.writeAll(payload.items);
+}
+
+/// A mapped artifact: commands and regex tables point into the mapping
+pub const Loaded = struct {
+    mapping: []align(std.heap.page_size_min) const u8,
+    commands: []SedCommand,
+    regexes: []regex_compiler.PrecompiledRegex,
+    allocator: std.mem.Allocator,
+
+    pub fn deinit(self: *Loaded) void {
+        self.allocator.free(self.regexes);
+        self.allocator.free(self.commands);
+        std.posix.munmap(self.mapping);
+    }
+};
+
+pub fn load(allocator: std.mem.Allocator, path: []const u8) !Loaded {
+    const file = try std.fs.cwd().openFile(path, .{});
+    defer file.close();
+    const size = (try file.stat()).size;
+    if (size < @sizeOf(Header)) return error.InvalidScriptArtifact;
+
+    const mapping = try std.posix.mmap(null, size, std.posix.PROT.READ, .{ .TYPE = .PRIVATE }, file.handle, 0);
+    errdefer std.posix.munmap(mapping);
+
+    const header: *const Header = @ptrCast(mapping.ptr);
+    if (!std.mem.eql(u8, &header.magic, &MAGIC)) return error.InvalidScriptArtifact;
+    if (header.format_version != FORMAT_VERSION or header.layout_hash != layout_hash) return error.ScriptArtifactVersionMismatch;
+    if (header.payload_len != size - @sizeOf(Header)) return error.InvalidScriptArtifact;
+    const payload = mapping[@sizeOf(Header)..];
+    if (std.hash.Wyhash.hash(0, payload) != header.payload_hash) return error.InvalidScriptArtifact;
+
+    const records_len = @as(usize, header.num_commands) * @sizeOf(CommandRecord) + @as(usize, header.num_regexes) * @sizeOf(RegexRecord);
+    if (records_len > payload.len) return error.InvalidScriptArtifact;
+    const commands_len = @as(usize, header.num_commands) * @sizeOf(CommandRecord);
+    const command_records: []const CommandRecord = @alignCast(std.mem.bytesAsSlice(CommandRecord, payload[0..commands_len]));
+    const regex_records: []const RegexRecord = @alignCast(std.mem.bytesAsSlice(RegexRecord, payload[commands_len..records_len]));
+
+    const commands = try allocator.alloc(SedCommand, command_records.len);
+    errdefer allocator.free(commands);
+    for (commands, command_records) |*cmd, record| {
+        if (record.cmd_type > @typeInfo(script.CommandType).@"enum".fields.len - 1) return error.InvalidScriptArtifact;
+        cmd.* = .{
+            .cmd_type = @enumFromInt(record.cmd_type),
+            .pattern = try slice(u8, payload, record.pattern_offset, record.pattern_len),
+            .replacement = try slice(u8, payload, record.replacement_offset, record.replacement_len),
+            .options = decodeOptions(record.options),
+        };
+        if (record.address_flags & CommandRecord.HAS_ADDRESS != 0) cmd.address = .{
+            .start = if (record.address_flags & CommandRecord.HAS_START != 0) record.address_start else null,
+            .end = if (record.address_flags & CommandRecord.HAS_END != 0) record.address_end else null,
+            .is_last_line = record.address_flags & CommandRecord.IS_LAST_LINE != 0,
+            .end_is_last = record.address_flags & CommandRecord.END_IS_LAST != 0,
+        };
+    }
+
+    const regexes = try allocator.alloc(regex_compiler.PrecompiledRegex, regex_records.len);
+    errdefer allocator.free(regexes);
+    for (regexes, regex_records) |*regex, record| {
+        if (record.command >= commands.len or record.num_states > gpu.MAX_REGEX_STATES) return error.InvalidScriptArtifact;
+        regex.* = .{
+            .pattern = commands[record.command].pattern,
+            .case_insensitive = record.case_insensitive != 0,
+            .tables = .{
+                .header = record.header,
+                .states = try slice(RegexState, payload, record.states_offset, record.num_states),
+                .bitmaps = try slice(u32, payload, record.bitmaps_offset, record.num_bitmaps),
+            },
+        };
+    }
+
+    return Loaded{ .mapping = mapping, .commands = commands, .regexes = regexes, .allocator = allocator };
+}
+
+/// Bounds- and alignment-checked view of `count` T at `offset` in the payload
+fn slice(comptime T: type, payload: []const u8, offset: u32, count: u32) ![]const T {
+    const len = @as(usize, count) * @sizeOf(T);
+    if (offset > payload.len or len > payload.len - offset) return error.InvalidScriptArtifact;
+    const bytes = payload[offset..][0..len];
+    if (@intFromPtr(bytes.ptr) % @alignOf(T) != 0) return error.InvalidScriptArtifact;
+    return @alignCast(std.mem.bytesAsSlice(T, bytes));
+}
+
+test "splitScript skips blanks and comments" {
+    const expressions = try splitScript(std.testing.allocator, "# rules\ns/a/b/g\n\n  /x/d  \r\n");
+    defer std.testing.allocator.free(expressions);
+    try std.testing.expectEqual(@as(usize, 2), expressions.len);
+    try std.testing.expectEqualStrings("/x/d", expressions[1]);
+}
+
+test "options survive encoding" {
+    const options = gpu.SubstituteOptions{ .global = true, .case_insensitive = true, .extended = true };
+    try std.testing.expectEqual(options, decodeOptions(encodeOptions(options)));
+}
+
+/// Write `expressions` as an artifact in `dir` and return its absolute path
+fn writeTestArtifact(allocator: std.mem.Allocator, dir: std.fs.Dir, expressions: []const []const u8) ![]u8 {
+    var commands: [4]SedCommand = undefined;
+    for (commands[0..expressions.len], expressions) |*cmd, expr| cmd.* = try script.parseSedExpression(expr);
+    const path = try dir.realpathAlloc(allocator, ".");
+    defer allocator.free(path);
+    const out_path = try std.fs.path.join(allocator, &.{ path, "rules.sedc" });
+    errdefer allocator.free(out_path);
+    try write(allocator, commands[0..expressions.len], out_path);
+    return out_path;
+}
+
+test "artifact round-trips commands, addresses and GPU regex tables" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const expressions = [_][]const u8{ "2,$s/[0-9][0-9]*/N/g", "/skip/d", "$s/x/y/" };
+    const path = try writeTestArtifact(allocator, tmp.dir, &expressions);
+    defer allocator.free(path);
+
+    var loaded = try load(allocator, path);
+    defer loaded.deinit();
+    try std.testing.expectEqual(expressions.len, loaded.commands.len);
+    for (expressions, loaded.commands) |expr, cmd| {
+        const expected = try script.parseSedExpression(expr);
+        try std.testing.expectEqual(expected.cmd_type, cmd.cmd_type);
+        try std.testing.expectEqualStrings(expected.pattern, cmd.pattern);
+        try std.testing.expectEqualStrings(expected.replacement, cmd.replacement);
+        try std.testing.expectEqual(expected.options, cmd.options);
+        try std.testing.expectEqual(expected.address, cmd.address);
+    }
+
+    // Only the bracket pattern needs a regex; its tables match a fresh compile
+    try std.testing.expectEqual(@as(usize, 1), loaded.regexes.len);
+    const regex = loaded.regexes[0];
+    try std.testing.expectEqualStrings("[0-9][0-9]*", regex.pattern);
+    var fresh = try regex_compiler.compileForGpu(regex.pattern, .{}, allocator);
+    defer fresh.deinit();
+    try std.testing.expectEqual(fresh.header, regex.tables.header);
+    try std.testing.expectEqualSlices(u8, std.mem.sliceAsBytes(fresh.states), std.mem.sliceAsBytes(regex.tables.states));
+    try std.testing.expectEqualSlices(u32, fresh.bitmaps, regex.tables.bitmaps);
+}
+
+test "truncated, edited and foreign-layout artifacts are rejected" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const path = try writeTestArtifact(allocator, tmp.dir, &.{ "1,3s/a.c/X/", "/q/p" });
+    defer allocator.free(path);
+    const good = try tmp.dir.readFileAlloc(allocator, "rules.sedc", 1 << 20);
+    defer allocator.free(good);
+    const bad = try allocator.dupe(u8, good);
+    defer allocator.free(bad);
+
+    // Truncated: the payload is shorter than the header says
+    try tmp.dir.writeFile(.{ .sub_path = "rules.sedc", .data = good[0 .. good.len - 1] });
+    try std.testing.expectError(error.InvalidScriptArtifact, load(allocator, path));
+
+    // Edited: same length, but the payload no longer hashes to the header's value
+    bad[bad.len - 1] ^= 0x20;
+    try tmp.dir.writeFile(.{ .sub_path = "rules.sedc", .data = bad });
+    try std.testing.expectError(error.InvalidScriptArtifact, load(allocator, path));
+
+    // Written by a build with different record layouts
+    @memcpy(bad, good);
+    std.mem.writeInt(u64, bad[@offsetOf(Header, "layout_hash")..][0..8], layout_hash ^ 1, .little);
+    try tmp.dir.writeFile(.{ .sub_path = "rules.sedc", .data = bad });
+    try std.testing.expectError(error.ScriptArtifactVersionMismatch, load(allocator, path));
+
+    // The untouched file still loads
+    try tmp.dir.writeFile(.{ .sub_path = "rules.sedc", .data = good });
+    var loaded = try load(allocator, path);
+    loaded.deinit();
+}
@@ -0,0 +1,228 @@
+const std = @import("std");
+const builtin = @import("builtin");
+
+const posix = std.posix;
+
+// Unix socket transport for `sed --serve` / `sed --client`.
+//
+// A request is one message: a u32 payload length, then the arguments (u32
+// count, then u32 length + bytes each), with the client's stdin, stdout,
+// stderr and working directory attached as SCM_RIGHTS descriptors. The
+// server runs the request directly on those descriptors, so files and pipes
+// are never copied through the socket, and answers with a one-byte exit
+// status. Requests are served one at a time.
+
+pub const MAX_REQUEST_SIZE: usize = 1024 * 1024;
+
+// stdin, stdout, stderr, cwd
+const PASSED_FDS = 4;
+
+const Cmsghdr = extern struct {
+    len: if (builtin.os.tag == .linux) usize else u32,
+    level: c_int,
+    type: c_int,
+};
+const SCM_RIGHTS: c_int = 1;
+const CMSG_ALIGN: usize = if (builtin.os.tag == .linux) @alignOf(usize) else 4;
+const CMSG_DATA_OFFSET = std.mem.alignForward(usize, @sizeOf(Cmsghdr), CMSG_ALIGN);
+const CONTROL_LEN = CMSG_DATA_OFFSET + std.mem.alignForward(usize, PASSED_FDS * @sizeOf(posix.fd_t), CMSG_ALIGN);
+
+/// Arguments and descriptors of one client invocation
+pub const Request = struct {
+    args: [][:0]u8,
+    fds: [PASSED_FDS]posix.fd_t,
+
+    pub fn deinit(self: *Request, allocator: std.mem.Allocator) void {
+        for (self.args) |arg| allocator.free(arg);
+        allocator.free(self.args);
+        for (self.fds) |fd| posix.close(fd);
+    }
+};
+
+/// Listen on `socket_path` (replacing a stale socket) and call
+/// `handler(context, args) u8` for every request, with the client's
+/// descriptors installed as fds 0-2 and its directory as the cwd
+pub fn serve(allocator: std.mem.Allocator, socket_path: []const u8, context: anytype, comptime handler: fn (@TypeOf(context), []const [:0]u8) u8) !void {
+    const address = try std.net.Address.initUnix(socket_path);
+    std.fs.cwd().deleteFile(socket_path) catch |err| switch (err) {
+        error.FileNotFound => {},
+        else => return err,
+    };
+
+    const listener = try posix.socket(posix.AF.UNIX, posix.SOCK.STREAM | posix.SOCK.CLOEXEC, 0);
+    defer posix.close(listener);
+    try posix.bind(listener, &address.any, address.getOsSockLen());
+    try posix.listen(listener, 16);
+
+    // The server's own stdio and cwd, restored after every request
+    const saved_cwd = try posix.open(".", .{ .ACCMODE = .RDONLY, .DIRECTORY = true, .CLOEXEC = true }, 0);
+    defer posix.close(saved_cwd);
+    var saved_stdio: [3]posix.fd_t = undefined;
+    for (&saved_stdio, 0..) |*fd, i| fd.* = try posix.dup(@intCast(i));
+    defer for (saved_stdio) |fd| posix.close(fd);
+
+    while (true) {
+        const conn = posix.accept(listener, null, null, posix.SOCK.CLOEXEC) catch |err| switch (err) {
+            error.ConnectionAborted => continue,
+            else => return err,
+        };
+        defer posix.close(conn);
+
+        var request = receiveRequest(allocator, conn) catch continue;
+        defer request.deinit(allocator);
+
+        // A client whose descriptors can't be installed fails alone
+        const status: u8 = if (enterClient(request.fds)) handler(context, request.args) else |_| 1;
+        // Every request installs its own, so a failed restore only misdirects
+        // the server's output between requests
+        for (saved_stdio, 0..) |fd, i| posix.dup2(fd, @intCast(i)) catch {};
+        posix.fchdir(saved_cwd) catch {};
+
+        _ = posix.write(conn, &.{status}) catch {};
+    }
+}
+
+/// Install a client's stdio as fds 0-2 and its directory as the cwd
+fn enterClient(fds: [PASSED_FDS]posix.fd_t) !void {
+    for (0..3) |i| try posix.dup2(fds[i], @intCast(i));
+    try posix.fchdir(fds[3]);
+}
+
+fn receiveRequest(allocator: std.mem.Allocator, conn: posix.fd_t) !Request {
+    var head: [4]u8 = undefined;
+    var control: [CONTROL_LEN]u8 align(@alignOf(Cmsghdr)) = undefined;
+    var iov = [_]posix.iovec{.{ .base = &head, .len = head.len }};
+    var msg = std.c.msghdr{
+        .name = null,
+        .namelen = 0,
+        .iov = &iov,
+        .iovlen = iov.len,
+        .control = &control,
+        .controllen = control.len,
+        .flags = 0,
+    };
+    const received = std.c.recvmsg(conn, &msg, 0);
+    if (received < 0) return error.ReceiveFailed;
+    if (received < head.len) {
+        // Finish the header; descriptors only ride on the first segment
+        if (received == 0) return error.EndOfStream;
+        _ = try posix.read(conn, head[@intCast(received)..]);
+    }
+
+    const cmsg: *const Cmsghdr = @ptrCast(&control);
+    if (msg.controllen < CONTROL_LEN or cmsg.level != posix.SOL.SOCKET or cmsg.type != SCM_RIGHTS or
+        cmsg.len != CMSG_DATA_OFFSET + PASSED_FDS * @sizeOf(posix.fd_t)) return error.MissingDescriptors;
+    var fds: [PASSED_FDS]posix.fd_t = undefined;
+    @memcpy(std.mem.sliceAsBytes(&fds), control[CMSG_DATA_OFFSET..][0 .. PASSED_FDS * @sizeOf(posix.fd_t)]);
+    errdefer for (fds) |fd| posix.close(fd);
+
+    const payload_len = std.mem.readInt(u32, &head, .little);
+    if (payload_len > MAX_REQUEST_SIZE) return error.RequestTooLarge;
+    const payload = try allocator.alloc(u8, payload_len);
+    defer allocator.free(payload);
+    var filled: usize = 0;
+    while (filled < payload.len) {
+        const n = try posix.read(conn, payload[filled..]);
+        if (n == 0) return error.EndOfStream;
+        filled += n;
+    }
+
+    return Request{ .args = try decodeArgs(allocator, payload), .fds = fds };
+}
+
+fn decodeArgs(allocator: std.mem.Allocator, payload: []const u8) ![][:0]u8 {
+    if (payload.len < 4) return error.InvalidRequest;
+    const count = std.mem.readInt(u32, payload[0..4], .little);
+    if (count > payload.len / 4) return error.InvalidRequest;
+
+    var args: std.ArrayListUnmanaged([:0]u8) = .{};
+    errdefer {
+        for (args.items) |arg| allocator.free(arg);
+        args.deinit(allocator);
+    }
+    var pos: usize = 4;
+    for (0..count) |_| {
+        if (payload.len - pos < 4) return error.InvalidRequest;
+        const len = std.mem.readInt(u32, payload[pos..][0..4], .little);
+        pos += 4;
+        if (payload.len - pos < len) return error.InvalidRequest;
+        try args.append(allocator, try allocator.dupeZ(u8, payload[pos..][0..len]));
+        pos += len;
+    }
+    return args.toOwnedSlice(allocator);
+}
+
+fn encodeArgs(allocator: std.mem.Allocator, args: []const []const u8) ![]u8 {
+    var payload: std.ArrayListUnmanaged(u8) = .{};
+    errdefer payload.deinit(allocator);
+    var word: [4]u8 = undefined;
+    std.mem.writeInt(u32, &word, @intCast(args.len), .little);
+    try payload.appendSlice(allocator, &word);
+    for (args) |arg| {
+        std.mem.writeInt(u32, &word, @intCast(arg.len), .little);
+        try payload.appendSlice(allocator, &word);
+        try payload.appendSlice(allocator, arg);
+    }
+    return payload.toOwnedSlice(allocator);
+}
+
+/// Send `args` with this process's stdio and cwd to the server at
+/// `socket_path` and return the exit status it reports. Fails with
+/// error.FileNotFound / error.ConnectionRefused when no server listens.
+pub fn runClient(allocator: std.mem.Allocator, socket_path: []const u8, args: []const []const u8) !u8 {
+    const address = try std.net.Address.initUnix(socket_path);
+    const conn = try posix.socket(posix.AF.UNIX, posix.SOCK.STREAM | posix.SOCK.CLOEXEC, 0);
+    defer posix.close(conn);
+    try posix.connect(conn, &address.any, address.getOsSockLen());
+
+    const cwd = try posix.open(".", .{ .ACCMODE = .RDONLY, .DIRECTORY = true, .CLOEXEC = true }, 0);
+    defer posix.close(cwd);
+
+    const payload = try encodeArgs(allocator, args);
+    defer allocator.free(payload);
+    if (payload.len > MAX_REQUEST_SIZE) return error.RequestTooLarge;
+    var head: [4]u8 = undefined;
+    std.mem.writeInt(u32, &head, @intCast(payload.len), .little);
+
+    var control: [CONTROL_LEN]u8 align(@alignOf(Cmsghdr)) = @splat(0);
+    const cmsg: *Cmsghdr = @ptrCast(&control);
+    cmsg.* = .{ .len = CMSG_DATA_OFFSET + PASSED_FDS * @sizeOf(posix.fd_t), .level = posix.SOL.SOCKET, .type = SCM_RIGHTS };
+    const fds = [PASSED_FDS]posix.fd_t{ posix.STDIN_FILENO, posix.STDOUT_FILENO, posix.STDERR_FILENO, cwd };
+    @memcpy(control[CMSG_DATA_OFFSET..][0 .. PASSED_FDS * @sizeOf(posix.fd_t)], std.mem.sliceAsBytes(&fds));
+
+    var iov = [_]posix.iovec_const{.{ .base = &head, .len = head.len }};
+    const msg = posix.msghdr_const{
+        .name = null,
+        .namelen = 0,
+        .iov = &iov,
+        .iovlen = iov.len,
+        .control = &control,
+        .controllen = control.len,
+        .flags = 0,
+    };
+    _ = try posix.sendmsg(conn, &msg, 0);
+
+    var written: usize = 0;
+    while (written < payload.len) written += try posix.write(conn, payload[written..]);
+
+    var status: [1]u8 = undefined;
+    if (try posix.read(conn, &status) != 1) return error.ServerClosed;
+    return status[0];
+}
+
+test "request arguments round-trip" {
+    const allocator = std.testing.allocator;
+    const payload = try encodeArgs(allocator, &.{ "sed", "-n", "s/a/b/p", "" });
+    defer allocator.free(payload);
+
+    const args = try decodeArgs(allocator, payload);
+    defer {
+        for (args) |arg| allocator.free(arg);
+        allocator.free(args);
+    }
+    try std.testing.expectEqual(@as(usize, 4), args.len);
+    try std.testing.expectEqualStrings("s/a/b/p", args[2]);
+    try std.testing.expectEqualStrings("", args[3]);
+
+    try std.testing.expectError(error.InvalidRequest, decodeArgs(allocator, payload[0 .. payload.len - 1]));
+}
@@ -0,0 +1,29 @@
+// Workgroup match compaction shared by the literal and regex kernels.
+// Hits reserve slots from a shared counter, one atomic per subgroup (ballot)
+// or per hit (fallback), so a workgroup publishes all of them with a single
+// global atomicAdd. Needs GL_KHR_shader_subgroup_ballot with -DSUBGROUP_OPS.
+
+// Published match, laid out as the host's gpu.PackedMatch: 8 bytes, half the
+// old (start, end, line, pad) record. The host recovers line numbers while it
+// replays the sorted records, so the kernels never count lines.
+struct MatchRecord {
+    uint start;
+    uint len;
+};
+
+shared uint s_staged;      // Slots reserved in this workgroup since the last publish
+shared uint s_global_base; // First global result index of the published slots
+
+// Workgroup-local slot for an invocation with a hit (ignored otherwise).
+// Must be reached by every invocation of the subgroup.
+uint stage_slot(bool hit) {
+#ifdef SUBGROUP_OPS
+    uvec4 ballot = subgroupBallot(hit);
+    uint hits = subgroupBallotBitCount(ballot);
+    uint base = 0u;
+    if (subgroupElect() && hits > 0u) base = atomicAdd(s_staged, hits);
+    return subgroupBroadcastFirst(base) + subgroupBallotExclusiveBitCount(ballot);
+#else
+    return hit ? atomicAdd(s_staged, 1u) : 0u;
+#endif
+}
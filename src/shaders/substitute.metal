@@ -28,6 +28,7 @@ struct MatchResult {
 
 // Flags
 constant uint FLAG_CASE_INSENSITIVE = 1;
+constant uint FLAG_ANCHOR_START = 16;
 // Reserved for future use:
 // FLAG_GLOBAL = 2 (Replace all occurrences - handled in host code)
 // FLAG_FIRST_ONLY = 4 (Replace first occurrence only - handled in host code)
@@ -84,12 +85,12 @@ kernel void find_matches(
 }
 
 // Line filtering kernel (for /pattern/d or /pattern/p)
-// Uses vectorized pattern matching for better performance
+// One thread per line, stops at the first hit and sets one bit per line
 kernel void filter_lines(
     device const uchar* text [[buffer(0)]],
     device const uchar* pattern [[buffer(1)]],
     device const SubstituteConfig& config [[buffer(2)]],
-    device uint* line_matches [[buffer(3)]],    // 1 if line matches, 0 otherwise
+    device atomic_uint* line_matches [[buffer(3)]],  // Bit i set if line i matches (zeroed by host)
     device const uint* line_offsets [[buffer(4)]],  // Start offset of each line
     device const uint* line_lengths [[buffer(5)]],  // Length of each line
     uint gid [[thread_position_in_grid]],
@@ -101,37 +102,29 @@ kernel void filter_lines(
     uint line_len = line_lengths[gid];
 
     bool case_insensitive = (config.flags & FLAG_CASE_INSENSITIVE) != 0;
+    bool anchored = (config.flags & FLAG_ANCHOR_START) != 0;
+    if (config.pattern_len > line_len) return;
+    uint last_pos = anchored ? 0 : line_len - config.pattern_len;
 
     // Search for pattern in this line using vectorized matching
-    bool found = false;
-    for (uint pos = 0; pos + config.pattern_len <= line_len && !found; pos++) {
+    for (uint pos = 0; pos <= last_pos; pos++) {
         if (match_at_position(text, config.text_len, line_start + pos, pattern, config.pattern_len, case_insensitive)) {
-            found = true;
+            atomic_fetch_or_explicit(&line_matches[gid >> 5], 1u << (gid & 31), memory_order_relaxed);
+            return;
         }
     }
-
-    line_matches[gid] = found ? 1 : 0;
 }
 
 // Transliterate kernel (for y/source/dest/)
+// Pure byte map through a 256-entry table, applied in place
 kernel void transliterate(
     device uchar* text [[buffer(0)]],
-    device const uchar* source_chars [[buffer(1)]],
-    device const uchar* dest_chars [[buffer(2)]],
-    device const SubstituteConfig& config [[buffer(3)]],
+    constant uchar* table [[buffer(1)]],
+    constant uint& text_len [[buffer(2)]],
     uint gid [[thread_position_in_grid]]
 ) {
-    if (gid >= config.text_len) return;
-
-    uchar c = text[gid];
-
-    // Look up character in source set
-    for (uint i = 0; i < config.pattern_len; i++) {
-        if (c == source_chars[i]) {
-            text[gid] = dest_chars[i];
-            break;
-        }
-    }
+    if (gid >= text_len) return;
+    text[gid] = table[text[gid]];
 }
 
 // ============================================================================
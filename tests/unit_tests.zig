@@ -2,6 +2,8 @@ const std = @import("std");
 const build_options = @import("build_options");
 const gpu = @import("gpu");
 const cpu = @import("cpu");
+const batch = @import("batch");
+const memory_budget = @import("memory_budget");
 
 const SubstituteOptions = gpu.SubstituteOptions;
 
@@ -132,6 +134,30 @@ test "cpu: anchor start" {
     try std.testing.expectEqual(@as(u64, 2), result.total_matches);
 }
 
+test "cpu: select lines" {
+    const allocator = std.testing.allocator;
+    const text = "keep\nfoo bar foo\nkeep\nfoo";
+
+    var selection = try cpu.selectLines(text, "foo", .{}, allocator);
+    defer selection.deinit();
+
+    try std.testing.expectEqual(@as(u32, 4), selection.num_lines);
+    try std.testing.expectEqual(@as(u32, 2), selection.count());
+    try std.testing.expect(!selection.isSelected(0));
+    try std.testing.expect(selection.isSelected(1));
+    try std.testing.expect(!selection.isSelected(2));
+    try std.testing.expect(selection.isSelected(3));
+}
+
+test "cpu: composed transliterate table" {
+    // y/abc/bcd/ then y/d/x/ behaves like one y/abc/bcx/ (and d -> x)
+    const table = gpu.TransliterateTable.init("abc", "bcd").then(gpu.TransliterateTable.init("d", "x"));
+
+    var text = "abcd zz".*;
+    cpu.transliterateTable(&text, &table.map);
+    try std.testing.expectEqualStrings("bcxx zz", &text);
+}
+
 // ----------------------------------------------------------------------------
 // Metal GPU Tests (macOS only)
 // ----------------------------------------------------------------------------
@@ -213,6 +239,14 @@ test "metal: matches cpu results" {
 // Vulkan GPU Tests
 // ----------------------------------------------------------------------------
 
+/// Vulkan context for a test, which is skipped on hosts without a device
+fn initVulkanOrSkip(allocator: std.mem.Allocator) !*gpu.vulkan.VulkanSubstituter {
+    return gpu.vulkan.VulkanSubstituter.init(allocator) catch |err| {
+        std.debug.print("Vulkan unavailable ({}), skipping\n", .{err});
+        return error.SkipZigTest;
+    };
+}
+
 test "vulkan: shader compilation" {
     const allocator = std.testing.allocator;
 
@@ -279,3 +313,273 @@ test "vulkan: matches cpu results" {
         }
     }
 }
+
+test "vulkan: tiled search matches cpu past the staging capacity" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    // Dense hits fill whole tiles; the counts are not multiples of the
+    // 2048-entry shared staging area, so every tile's last rounds must flush
+    const test_cases = [_]struct {
+        line: []const u8,
+        lines: usize,
+    }{
+        .{ .line = "a", .lines = 3001 },
+        .{ .line = "xyz abc", .lines = 5003 },
+        .{ .line = "abc", .lines = 70001 },
+    };
+
+    for (test_cases) |tc| {
+        var text: std.ArrayListUnmanaged(u8) = .{};
+        defer text.deinit(allocator);
+        for (0..tc.lines) |_| {
+            try text.appendSlice(allocator, tc.line);
+            try text.append(allocator, '\n');
+        }
+
+        var cpu_result = try cpu.findMatches(text.items, "a", .{ .global = true }, allocator);
+        defer cpu_result.deinit();
+
+        var vulkan_result = try searcher.findMatches(text.items, "a", .{ .global = true }, allocator);
+        defer vulkan_result.deinit();
+
+        try std.testing.expectEqual(@as(u64, tc.lines), cpu_result.total_matches);
+        try std.testing.expectEqual(cpu_result.total_matches, vulkan_result.total_matches);
+        for (cpu_result.matches, vulkan_result.matches) |expected, actual| {
+            try std.testing.expectEqual(expected.start, actual.start);
+            try std.testing.expectEqual(expected.end, actual.end);
+        }
+    }
+}
+
+test "vulkan: every valid kernel shape matches the default shape" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    const corpus = try gpu.autotune.buildCorpus(allocator);
+    defer allocator.free(corpus);
+    const options = SubstituteOptions{ .global = true };
+
+    try searcher.setKernelConfig(.{});
+    var literal_default = try searcher.findMatches(corpus, gpu.autotune.LITERAL_PATTERN, options, allocator);
+    defer literal_default.deinit();
+    var regex_default = try searcher.findMatchesRegex(corpus, gpu.autotune.REGEX_PATTERN, options, allocator);
+    defer regex_default.deinit();
+
+    for (gpu.autotune.literal_workgroup_sizes) |workgroup_size| {
+        for (gpu.autotune.literal_bytes_per_thread) |bytes_per_thread| {
+            for (gpu.autotune.regex_workgroup_sizes) |regex_workgroup_size| {
+                const config = gpu.KernelConfig{
+                    .literal_workgroup_size = workgroup_size,
+                    .literal_tile_bytes = workgroup_size * bytes_per_thread,
+                    .regex_workgroup_size = regex_workgroup_size,
+                };
+                if (!gpu.autotune.isValid(config, searcher.tune_limits)) continue;
+                try searcher.setKernelConfig(config);
+
+                var literal = try searcher.findMatches(corpus, gpu.autotune.LITERAL_PATTERN, options, allocator);
+                defer literal.deinit();
+                var regex = try searcher.findMatchesRegex(corpus, gpu.autotune.REGEX_PATTERN, options, allocator);
+                defer regex.deinit();
+
+                if (literal.total_matches != literal_default.total_matches or regex.total_matches != regex_default.total_matches) {
+                    std.debug.print("\nShape wg {d} / tile {d} / regex wg {d}:\n", .{ config.literal_workgroup_size, config.literal_tile_bytes, config.regex_workgroup_size });
+                    std.debug.print("  literal {d} (default {d}), regex {d} (default {d})\n", .{ literal.total_matches, literal_default.total_matches, regex.total_matches, regex_default.total_matches });
+                    return error.MatchCountMismatch;
+                }
+            }
+        }
+    }
+}
+
+test "vulkan: imported and copied text give the same results" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    // Page-aligned memory is imported when the device allows it; the same
+    // text one byte in always goes through the pooled copy
+    const len = 3 * std.heap.page_size_min + 5;
+    const aligned = try allocator.alignedAlloc(u8, .fromByteUnits(std.heap.page_size_min), len);
+    defer allocator.free(aligned);
+    const backing = try allocator.alloc(u8, len + 1);
+    defer allocator.free(backing);
+    const unaligned = backing[1..];
+
+    for (aligned, 0..) |*c, i| c.* = if (i % 13 == 12) '\n' else "the cat"[i % 7];
+    @memcpy(unaligned, aligned);
+
+    var cpu_result = try cpu.findMatches(aligned, "cat", .{ .global = true }, allocator);
+    defer cpu_result.deinit();
+    var imported_result = try searcher.findMatches(aligned, "cat", .{ .global = true }, allocator);
+    defer imported_result.deinit();
+    var copied_result = try searcher.findMatches(unaligned, "cat", .{ .global = true }, allocator);
+    defer copied_result.deinit();
+
+    try std.testing.expectEqual(cpu_result.total_matches, imported_result.total_matches);
+    try std.testing.expectEqual(cpu_result.total_matches, copied_result.total_matches);
+    for (imported_result.matches, copied_result.matches) |imported, copied| {
+        try std.testing.expectEqual(imported.start, copied.start);
+    }
+
+    // y/// writes an imported buffer in place (whole words only)
+    const table = gpu.TransliterateTable.init("ac", "AC");
+    const expected = try allocator.dupe(u8, aligned);
+    defer allocator.free(expected);
+    cpu.transliterateTable(expected, &table.map);
+    try searcher.transliterate(aligned[0 .. len - 1], &table.map);
+    try searcher.transliterate(unaligned[0 .. len - 1], &table.map);
+    try std.testing.expectEqualStrings(expected[0 .. len - 1], aligned[0 .. len - 1]);
+    try std.testing.expectEqualStrings(expected[0 .. len - 1], unaligned[0 .. len - 1]);
+}
+
+test "vulkan: batched search matches cpu per file" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    // A match may only straddle a boundary through the newline added after a
+    // file without one ("ab" + "\n" + "c..."), or run into the next file
+    // when the pattern spans lines; neither may be credited to either file
+    const files = [_][]const u8{
+        "foo bar\nbarfoo\n",
+        "fo",
+        "o foo\n",
+        "",
+        "foofoo",
+        "\nfoo",
+    };
+
+    var pending = batch.Batch.init(allocator);
+    defer pending.deinit();
+    for (files, 0..) |contents, file_id| {
+        try std.testing.expect(try pending.append(@intCast(file_id), contents));
+    }
+
+    for ([_][]const u8{ "foo", "o\nf", "o" }) |pattern| {
+        const options = SubstituteOptions{ .global = true };
+        var result = try searcher.findMatches(pending.text.items, pattern, options, allocator);
+        defer result.deinit();
+        const per_file = try pending.splitMatches(result.matches);
+        defer allocator.free(per_file);
+
+        for (files, per_file) |contents, matches| {
+            var expected = try cpu.findMatches(contents, pattern, options, allocator);
+            defer expected.deinit();
+
+            try std.testing.expectEqual(expected.matches.len, matches.len);
+            for (expected.matches, matches) |want, got| {
+                try std.testing.expectEqual(want.start, got.start);
+                try std.testing.expectEqual(want.end, got.end);
+                try std.testing.expectEqual(want.line_num, got.line_num);
+            }
+        }
+    }
+}
+
+test "vulkan: chunked search matches whole-input cpu" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    // The smallest --max-memory plan, over lines of varied length and one
+    // line longer than a whole chunk
+    const plan = memory_budget.Plan.init(0);
+    var text: std.ArrayListUnmanaged(u8) = .{};
+    defer text.deinit(allocator);
+    var line: usize = 0;
+    while (text.items.len < 5 * plan.chunk_size) : (line += 1) {
+        const len = if (line == 1000) plan.chunk_size + 7 else line % 97;
+        for (0..len) |i| try text.append(allocator, if (i % 11 == 3) 'x' else 'a' + @as(u8, @intCast((line + i) % 23)));
+        try text.append(allocator, '\n');
+    }
+
+    const options = SubstituteOptions{ .global = true };
+    var expected = try cpu.findMatches(text.items, "x", options, allocator);
+    defer expected.deinit();
+    var expected_lines = try cpu.selectLines(text.items, "x", .{}, allocator);
+    defer expected_lines.deinit();
+
+    var base = gpu.ChunkBase{};
+    var next_match: usize = 0;
+    var rest = text.items;
+    var chunks: usize = 0;
+    while (rest.len > 0) : (chunks += 1) {
+        const chunk = gpu.nextChunk(rest, plan.chunk_size);
+
+        var result = try searcher.findMatches(chunk, "x", options, allocator);
+        defer result.deinit();
+        for (result.matches) |match| {
+            const location = base.locate(match);
+            const want = expected.matches[next_match];
+            try std.testing.expectEqual(@as(u64, want.start), location.start);
+            try std.testing.expectEqual(@as(u64, want.end), location.end);
+            try std.testing.expectEqual(@as(u64, want.line_num), location.line);
+            next_match += 1;
+        }
+
+        var selection = try searcher.selectLines(chunk, "x", .{}, allocator);
+        defer selection.deinit();
+        for (0..selection.num_lines) |i| {
+            try std.testing.expectEqual(expected_lines.isSelected(@intCast(base.line + i)), selection.isSelected(@intCast(i)));
+        }
+
+        base = base.advance(chunk);
+        rest = rest[chunk.len..];
+    }
+    try std.testing.expect(chunks >= 5);
+    try std.testing.expectEqual(expected.matches.len, next_match);
+}
+
+test "vulkan: select lines matches cpu" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    const text = "error one\nok\nERROR two\nok\nerror\n";
+    const test_cases = [_]struct {
+        pattern: []const u8,
+        options: SubstituteOptions,
+    }{
+        .{ .pattern = "error", .options = .{} },
+        .{ .pattern = "error", .options = .{ .case_insensitive = true } },
+        .{ .pattern = "ok", .options = .{ .anchor_start = true } },
+    };
+
+    for (test_cases) |tc| {
+        var cpu_selection = try cpu.selectLines(text, tc.pattern, tc.options, allocator);
+        defer cpu_selection.deinit();
+
+        var vulkan_selection = try searcher.selectLines(text, tc.pattern, tc.options, allocator);
+        defer vulkan_selection.deinit();
+
+        try std.testing.expectEqualSlices(u32, cpu_selection.bits, vulkan_selection.bits);
+    }
+}
+
+test "vulkan: transliterate matches cpu" {
+    const allocator = std.testing.allocator;
+
+    const searcher = try initVulkanOrSkip(allocator);
+    defer searcher.deinit();
+
+    const table = gpu.TransliterateTable.init("abcxyz", "ABCXYZ");
+
+    // Odd length exercises the padded last word
+    const text = "the quick brown fox jumps over the lazy dog\n" ** 97 ++ "abc";
+    var cpu_text = text.*;
+    var vulkan_text = text.*;
+
+    cpu.transliterateTable(&cpu_text, &table.map);
+    try searcher.transliterate(&vulkan_text, &table.map);
+
+    try std.testing.expectEqualStrings(&cpu_text, &vulkan_text);
+}